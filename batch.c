@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_case.h"
+#include "tm_batch.h"
+#include "tm_db.h"
+#include "tm_def.h"
+#include "tm_enum.h"
+#include "tm_run.h"
+#include "tm_sink.h"
+#include "util.h"
+
+/*
+ * Runs the test cases as one batch over many threads, see tm_batch.c, and checks every result.
+ * Alternatively runs all TMs of a file, see tm_db.c, and prints how many halted.
+ */
+
+// Upper limit on the number of steps of each machine
+static const step_t MAX_STEPS = (step_t) 1 << 40;
+
+// Default limit for TMs from files, most of which never halt
+static const step_t DB_MAX_STEPS = 1000000;
+
+// Number of TMs from a file to run at once, which bounds the memory for results
+#define DB_CHUNK (1 << 16)
+
+// Where -r writes the results file of the test cases
+static const char *const SINK_PATH = "tmp/batch_test.res";
+
+// Default limit for enumerated TMs, well above the longest halting ones we can enumerate
+static const step_t ENUM_MAX_STEPS = 1000;
+
+/*
+ * The longest running halting machine of a given size, i.e. the busy beaver S(n, m), which we
+ * check when enumerating.
+ */
+struct enum_known_t {
+	int n_states;
+	int n_syms;
+	step_t steps;
+};
+
+static const struct enum_known_t ENUM_KNOWN[] = {
+	{2, 2, 6},
+	{3, 2, 21},
+	{2, 3, 38},
+	{4, 2, 107},
+};
+#define N_ENUM_KNOWN ((int) (sizeof ENUM_KNOWN / sizeof ENUM_KNOWN[0]))
+
+/*
+ * A malformed TM, with the error and position that tm_def_parse_into() should give for it.
+ * A cap of 0 means a buffer that is just large enough.
+ */
+struct parse_bad_t {
+	const char *txt;
+	size_t cap;
+	enum tm_parse_err_t err;
+	size_t err_pos;
+};
+
+static const struct parse_bad_t PARSE_BAD[] = {
+	{"1RB1L_1LA1RZ", 0, TM_PARSE_WIDTH, 5},
+	{"_1RB1LB", 0, TM_PARSE_WIDTH, 0},
+	{"1RB1LB_1LA", 0, TM_PARSE_LENGTH, 10},
+	{"1RB2LB_1LA1RZ", 0, TM_PARSE_SYM, 3},
+	{"1RB1XB_1LA1RZ", 0, TM_PARSE_DIR, 4},
+	{"1RB1Lb_1LA1RZ", 0, TM_PARSE_STATE, 5},
+	{"1RB1LB_1LA1RZ-1LA1RZ", 0, TM_PARSE_TERM, 13},
+	{"1RB1LB_1LA1RZ", 1, TM_PARSE_SPACE, 0},
+};
+#define N_PARSE_BAD ((int) (sizeof PARSE_BAD / sizeof PARSE_BAD[0]))
+
+static void usage(const char *const arg0)
+{
+	(void) fprintf(stderr, "Usage: %s [-q] [-k] [-c] [-t THREADS] [-n REPEATS] [-r] [-d FILE | -l FILE | -e STATES,SYMS] [-s STEPS] [-o FILE]\n", arg0);
+	(void) fprintf(stderr, "\t-q\tQuiet, only print the summary.\n");
+	(void) fprintf(stderr, "\t-k\tRun in lockstep lanes, see tm_lanes.c.\n");
+	(void) fprintf(stderr, "\t-c\tStop cyclers early for TMs from a file, see tm_decide.c.\n");
+	(void) fprintf(stderr, "\t-t\tNumber of worker threads, by default one per CPU.\n");
+	(void) fprintf(stderr, "\t-n\tRun every test case this many times, for benchmarking.\n");
+	(void) fprintf(stderr, "\t-r\tAlso run the test cases through files in tmp/.\n");
+	(void) fprintf(stderr, "\t-d\tRun the TMs of a bbchallenge seed database instead.\n");
+	(void) fprintf(stderr, "\t-l\tRun the TMs of a text file, one per line, instead.\n");
+	(void) fprintf(stderr, "\t-e\tEnumerate all TMs of a size in tree normal form instead, see tm_enum.c.\n");
+	(void) fprintf(stderr, "\t-s\tStep limit for TMs from a file, by default %lld, or %lld when enumerating.\n", DB_MAX_STEPS, ENUM_MAX_STEPS);
+	(void) fprintf(stderr, "\t-o\tWrite a record for each TM from a file to a binary results file, see tm_sink.c.\n");
+}
+
+/*
+ * What check_sink() has seen of a results file.
+ */
+struct sink_check_t {
+	const struct test_case_t *const *tcases;
+	int n_defs;
+	int n_bad;
+	int *seen;
+};
+
+static void check_sink_rec(void *const ctx, const struct tm_sink_rec_t *const rec)
+{
+	const struct sink_check_t *const check = ctx;
+	if (rec->machine < 0 || rec->machine >= check->n_defs || check->seen[rec->machine]++) {
+		ERROR("Results file %s has a bad or repeated record of machine %d.\n", SINK_PATH, rec->machine);
+	}
+	if (rec->machine >= check->n_defs - check->n_bad) {
+		if (rec->stop != TM_RUNNING) {
+			ERROR("Malformed machine %d has a result in %s.\n", rec->machine, SINK_PATH);
+		}
+		return;
+	}
+	const struct test_case_t *const tcase = check->tcases[rec->machine];
+	// The span can not be smaller than the nonzero cells, nor larger than one per step
+	if (rec->stop != TM_HALTED || rec->steps != tcase->steps || rec->sigma != tcase->nonzero
+			|| rec->span < rec->sigma || rec->span > rec->steps + 1 || rec->engine != TM_ENGINE_SPECIALIZED) {
+		ERROR("Machine %d (%s) has a record of %lld steps and %lld nonzero in %s, expected %lld and %d.\n",
+			rec->machine, tcase->txt, rec->steps, rec->sigma, SINK_PATH, tcase->steps, tcase->nonzero);
+	}
+}
+
+/*
+ * Closes the results file of a run of the given test cases followed by n_bad malformed TMs,
+ * and checks that reading it back gives one matching record for each.
+ */
+static void check_sink(struct tm_sink_t *const sink, const struct test_case_t *const *const tcases, const int n_defs, const int n_bad)
+{
+	if (tm_sink_close(sink) != 0) {
+		ERROR("Could not write %s.\n", SINK_PATH);
+	}
+	struct sink_check_t check = {tcases, n_defs, n_bad, calloc((size_t) (n_defs > 0 ? n_defs : 1), sizeof *check.seen)};
+	if (tm_sink_scan(SINK_PATH, check_sink_rec, &check) != n_defs) {
+		ERROR("Results file %s does not have one record for each of the %d machines.\n", SINK_PATH, n_defs);
+	}
+	free(check.seen);
+}
+
+/*
+ * Runs the TMs of the file at path, which must be the given test cases followed by n_bad
+ * malformed TMs, and checks every result.
+ */
+static void check_db(const char *const path, const enum tm_db_format_t format, const struct test_case_t *const *const tcases, const int n_bad, const int n_threads, const int use_lanes)
+{
+	struct tm_db_t *const db = tm_db_open(path, format);
+	const int n_defs = tm_db_count(db);
+	struct tm_result_t *const results = malloc((size_t) (n_defs > 0 ? n_defs : 1) * sizeof *results);
+	// The lanes only give the steps, so only the scalar runs write results files
+	struct tm_sink_t *const sink = use_lanes ? NULL : tm_sink_open(SINK_PATH, n_threads);
+	if (use_lanes)
+		tm_batch_run_db_lanes(db, 0, n_defs, MAX_STEPS, n_threads, results);
+	else
+		tm_batch_run_db(db, 0, n_defs, MAX_STEPS, n_threads, 0, results, sink);
+	if (sink)
+		check_sink(sink, tcases, n_defs, n_bad);
+	for (int i = n_defs - n_bad; i < n_defs; i++) {
+		if (results[i].stop != TM_RUNNING) {
+			ERROR("Malformed machine %d of %s was run.\n", i, path);
+		}
+	}
+	for (int i = 0; i < n_defs - n_bad; i++) {
+		if (results[i].stop != TM_HALTED || results[i].steps != tcases[i]->steps) {
+			ERROR("Machine %d (%s) of %s stopped after %lld steps, expected to halt after %lld.\n",
+				i, tcases[i]->txt, path, results[i].steps, tcases[i]->steps);
+		}
+	}
+	free(results);
+	tm_db_close(db);
+}
+
+/*
+ * Checks that tm_def_parse_into() gives the expected error and position for each malformed TM.
+ */
+static void check_parse_errors(void)
+{
+	for (int i = 0; i < N_PARSE_BAD; i++) {
+		const struct parse_bad_t *const bad = PARSE_BAD + i;
+		const size_t len = strlen(bad->txt);
+		const size_t cap = bad->cap > 0 ? bad->cap : tm_def_parse_bound(len);
+		struct tm_def_t *const def = malloc(tm_def_parse_bound(len));
+		size_t err_pos = (size_t) -1;
+		const enum tm_parse_err_t err = tm_def_parse_into(bad->txt, len, def, cap, &err_pos);
+		if (err != bad->err || err_pos != bad->err_pos) {
+			ERROR("Parsing %s gave %s at character %zu, expected %s at character %zu.\n",
+				bad->txt, tm_parse_err_str(err), err_pos, tm_parse_err_str(bad->err), bad->err_pos);
+		}
+		free(def);
+	}
+}
+
+/*
+ * Writes the test cases to files in tmp/, in both formats where possible, and checks that
+ * reading them back gives the same results, with and without lanes.
+ */
+static void check_files(const int n_threads, const int quiet)
+{
+	const char *const txt_path = "tmp/batch_test.txt";
+	const char *const bbc_path = "tmp/batch_test.bbc";
+	FILE *const txt = fopen(txt_path, "w");
+	FILE *const bbc = fopen(bbc_path, "wb");
+	if (!txt || !bbc) {
+		ERROR("Could not create %s and %s.\n", txt_path, bbc_path);
+	}
+	(void) fprintf(txt, "# Test cases\n");
+	unsigned char rec[TM_DB_BBC_RECORD_SIZE] = {0};
+	(void) fwrite(rec, 1, TM_DB_BBC_HEADER_SIZE, bbc);
+
+	const struct test_case_t **const bbc_cases = malloc((size_t) N_TEST_CASES * sizeof *bbc_cases);
+	const struct test_case_t **const txt_cases = malloc((size_t) N_TEST_CASES * sizeof *txt_cases);
+	int n_bbc = 0;
+	for (int i = 0; i < N_TEST_CASES; i++) {
+		txt_cases[i] = TEST_CASES + i;
+		(void) fprintf(txt, "%s\n", TEST_CASES[i].txt);
+		struct tm_def_t *const def = tm_def_parse(TEST_CASES[i].txt);
+		if (tm_db_encode_bbchallenge(def, rec) == 0) {
+			(void) fwrite(rec, 1, sizeof rec, bbc);
+			bbc_cases[n_bbc++] = TEST_CASES + i;
+		}
+		tm_def_free(def);
+	}
+	// Malformed TMs should be skipped without stopping the rest of the batch
+	check_parse_errors();
+	int n_bad_txt = 0;
+	for (int i = 0; i < N_PARSE_BAD; i++) {
+		// A text file always gives enough space
+		if (PARSE_BAD[i].err == TM_PARSE_SPACE)
+			continue;
+		(void) fprintf(txt, "%s\n", PARSE_BAD[i].txt);
+		n_bad_txt++;
+	}
+	memset(rec, 0, sizeof rec);
+	rec[1] = 2;
+	(void) fwrite(rec, 1, sizeof rec, bbc);
+	if (fclose(txt) != 0 || fclose(bbc) != 0) {
+		ERROR("Could not write %s and %s.\n", txt_path, bbc_path);
+	}
+
+	for (int use_lanes = 0; use_lanes <= 1; use_lanes++) {
+		check_db(txt_path, TM_DB_TEXT, txt_cases, n_bad_txt, n_threads, use_lanes);
+		check_db(bbc_path, TM_DB_BBCHALLENGE, bbc_cases, 1, n_threads, use_lanes);
+	}
+	if (!quiet) printf("All %d text and %d binary results are OK!\n", N_TEST_CASES, n_bbc);
+	free(txt_cases);
+	free(bbc_cases);
+}
+
+/*
+ * Runs every TM of the file at path in fixed-size chunks, and prints a summary of the results.
+ */
+static void run_db(const char *const path, const enum tm_db_format_t format, const step_t max_steps, const int n_threads, const int use_lanes, const int decide, const char *const out_path, const int quiet)
+{
+	struct tm_db_t *const db = tm_db_open(path, format);
+	struct tm_sink_t *const sink = out_path ? tm_sink_open(out_path, n_threads) : NULL;
+	const int n_defs = tm_db_count(db);
+	struct tm_result_t *const results = malloc(DB_CHUNK * sizeof *results);
+
+	if (!quiet) printf("Running %d machines from %s on %d threads...\n", n_defs, path, n_threads);
+	int n_halted = 0, n_budget = 0, n_nonhalt = 0, n_invalid = 0;
+	int longest = -1;
+	step_t longest_steps = 0;
+	double tot_steps = 0.0;
+	const double t = wall_seconds();
+	for (int first = 0; first < n_defs; first += DB_CHUNK) {
+		const int n = n_defs - first < DB_CHUNK ? n_defs - first : DB_CHUNK;
+		if (use_lanes)
+			tm_batch_run_db_lanes(db, first, n, max_steps, n_threads, results);
+		else
+			tm_batch_run_db(db, first, n, max_steps, n_threads, decide, results, sink);
+		for (int i = 0; i < n; i++) {
+			switch (results[i].stop) {
+			case TM_HALTED:
+				n_halted++;
+				if (results[i].steps > longest_steps) {
+					longest = first + i;
+					longest_steps = results[i].steps;
+				}
+				break;
+			case TM_BUDGET:
+				n_budget++;
+				break;
+			case TM_NONHALT:
+				n_nonhalt++;
+				break;
+			default:
+				if (!quiet) printf("Machine %d is invalid.\n", first + i);
+				n_invalid++;
+				break;
+			}
+			tot_steps += (double) results[i].steps;
+		}
+	}
+	if (sink && tm_sink_close(sink) != 0) {
+		ERROR("Could not write results file %s.\n", out_path);
+	}
+	const double runtime = wall_seconds() - t;
+
+	printf("Halted: %d Non-halting: %d Out of steps: %d Invalid: %d\n", n_halted, n_nonhalt, n_budget, n_invalid);
+	if (longest >= 0) printf("Longest halting: machine %d after %lld steps\n", longest, longest_steps);
+	printf("Total runtime: %fs (%.0f steps/s, %.0f machines/s) Threads: %d Engine: %s\n",
+		runtime, tot_steps / runtime, n_defs / runtime, n_threads, use_lanes ? "lanes" : "scalar");
+
+	free(results);
+	tm_db_close(db);
+}
+
+/*
+ * The counts of one worker of run_enum(), and the longest halting machine it found.
+ */
+struct enum_count_t {
+	step_t n_halted;
+	step_t n_budget;
+	double tot_steps;
+	step_t longest_steps;
+	struct tm_def_t *longest;
+};
+
+static void enum_count(void *const ctx, const int worker, const struct tm_def_t *const def, const struct tm_result_t res)
+{
+	struct enum_count_t *const count = (struct enum_count_t *) ctx + worker;
+	count->tot_steps += (double) res.steps;
+	if (res.stop != TM_HALTED) {
+		count->n_budget++;
+		return;
+	}
+	count->n_halted++;
+	if (res.steps > count->longest_steps) {
+		// The definition is only valid during the call
+		const size_t size = tm_def_size(def->n_syms, def->n_states);
+		if (!count->longest)
+			count->longest = malloc(size);
+		memcpy(count->longest, def, size);
+		count->longest_steps = res.steps;
+	}
+}
+
+/*
+ * Enumerates all TMs of the given size, see tm_enum.c, and prints a summary of the results.
+ * For the sizes in ENUM_KNOWN, we check that the longest halting machine is as long as known.
+ */
+static void run_enum(const int n_states, const int n_syms, const step_t max_steps, const int n_threads, const int quiet)
+{
+	if (!quiet) printf("Enumerating %d-state %d-symbol machines on %d threads...\n", n_states, n_syms, n_threads);
+	struct enum_count_t *const counts = calloc((size_t) n_threads, sizeof *counts);
+	const double t = wall_seconds();
+	tm_enum_run(n_states, n_syms, max_steps, n_threads, enum_count, counts);
+	const double runtime = wall_seconds() - t;
+
+	struct enum_count_t tot = {0, 0, 0.0, 0, NULL};
+	for (int i = 0; i < n_threads; i++) {
+		tot.n_halted += counts[i].n_halted;
+		tot.n_budget += counts[i].n_budget;
+		tot.tot_steps += counts[i].tot_steps;
+		if (counts[i].longest_steps > tot.longest_steps) {
+			tot.longest_steps = counts[i].longest_steps;
+			tot.longest = counts[i].longest;
+		}
+	}
+	const double n_defs = (double) (tot.n_halted + tot.n_budget);
+
+	printf("Halted: %lld Out of steps: %lld\n", tot.n_halted, tot.n_budget);
+	if (tot.longest) {
+		printf("Longest halting: ");
+		tm_def_print_text(tot.longest);
+		printf(" after %lld steps\n", tot.longest_steps);
+	}
+	for (int i = 0; i < N_ENUM_KNOWN; i++) {
+		const struct enum_known_t *const known = ENUM_KNOWN + i;
+		if (known->n_states == n_states && known->n_syms == n_syms && known->steps <= max_steps && known->steps != tot.longest_steps) {
+			ERROR("The longest halting %d-state %d-symbol machine took %lld steps, expected %lld.\n",
+				n_states, n_syms, tot.longest_steps, known->steps);
+		}
+	}
+	printf("Total runtime: %fs (%.0f steps/s, %.0f machines/s) Threads: %d Engine: enumerated\n",
+		runtime, tot.tot_steps / runtime, n_defs / runtime, n_threads);
+
+	for (int i = 0; i < n_threads; i++)
+		free(counts[i].longest);
+	free(counts);
+}
+
+int main(int argc, char **argv)
+{
+	int quiet = 0;
+	int use_lanes = 0;
+	int decide = 0;
+	int n_threads = tm_batch_default_threads();
+	int repeats = 1;
+	int files = 0;
+	const char *db_path = NULL;
+	const char *out_path = NULL;
+	enum tm_db_format_t db_format = TM_DB_BBCHALLENGE;
+	step_t db_max_steps = DB_MAX_STEPS;
+	int steps_given = 0;
+	int enum_states = 0, enum_syms = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-q") == 0) {
+			quiet = 1;
+		} else if (strcmp(argv[i], "-k") == 0) {
+			use_lanes = 1;
+		} else if (strcmp(argv[i], "-c") == 0) {
+			decide = 1;
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			n_threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			repeats = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-r") == 0) {
+			files = 1;
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			db_path = argv[++i];
+			db_format = TM_DB_BBCHALLENGE;
+		} else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+			db_path = argv[++i];
+			db_format = TM_DB_TEXT;
+		} else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d,%d", &enum_states, &enum_syms) != 2) {
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			out_path = argv[++i];
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			db_max_steps = atoll(argv[++i]);
+			steps_given = 1;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	// The lanes have no decider, and the test cases all halt
+	if (n_threads < 1 || repeats < 1 || db_max_steps < 0 || (decide && (use_lanes || !db_path))
+			|| (enum_states && (db_path || use_lanes || decide || db_max_steps < 1)) || (out_path && (!db_path || use_lanes))) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (enum_states) {
+		run_enum(enum_states, enum_syms, steps_given ? db_max_steps : ENUM_MAX_STEPS, n_threads, quiet);
+		return 0;
+	}
+	if (db_path) {
+		run_db(db_path, db_format, db_max_steps, n_threads, use_lanes, decide, out_path, quiet);
+		return 0;
+	}
+
+	struct tm_def_t **const parsed = malloc((size_t) N_TEST_CASES * sizeof *parsed);
+	for (int i = 0; i < N_TEST_CASES; i++)
+		parsed[i] = tm_def_parse(TEST_CASES[i].txt);
+
+	const int n_defs = N_TEST_CASES * repeats;
+	const struct tm_def_t **const defs = malloc((size_t) n_defs * sizeof *defs);
+	for (int i = 0; i < n_defs; i++)
+		defs[i] = parsed[i % N_TEST_CASES];
+	struct tm_result_t *const results = malloc((size_t) n_defs * sizeof *results);
+
+	if (!quiet) printf("Running %d machines on %d threads...\n", n_defs, n_threads);
+	const double t = wall_seconds();
+	if (use_lanes)
+		tm_batch_run_lanes(defs, n_defs, MAX_STEPS, n_threads, results);
+	else
+		tm_batch_run(defs, n_defs, MAX_STEPS, n_threads, results);
+	const double runtime = wall_seconds() - t;
+
+	double tot_steps = 0.0;
+	for (int i = 0; i < n_defs; i++) {
+		const struct test_case_t *const tcase = TEST_CASES + i % N_TEST_CASES;
+		if (results[i].stop != TM_HALTED || results[i].steps != tcase->steps) {
+			ERROR("Machine %d (%s) stopped after %lld steps, expected to halt after %lld.\n",
+				i, tcase->txt, results[i].steps, tcase->steps);
+		}
+		tot_steps += (double) results[i].steps;
+	}
+	if (!quiet) printf("All results are OK!\n");
+	if (files)
+		check_files(n_threads, quiet);
+	printf("Total runtime: %fs (%.0f steps/s, %.0f machines/s) Threads: %d Engine: %s\n",
+		runtime, tot_steps / runtime, n_defs / runtime, n_threads, use_lanes ? "lanes" : "scalar");
+
+	free(results);
+	free(defs);
+	for (int i = 0; i < N_TEST_CASES; i++)
+		tm_def_free(parsed[i]);
+	free(parsed);
+	return 0;
+}
@@ -0,0 +1,497 @@
+// Needed for fork() and syscall() with -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "mm_run.h"
+#include "tape.h"
+#include "tape_bit.h"
+#include "tape_flat.h"
+#include "tape_gap.h"
+#include "tape_hybrid.h"
+#include "tape_rle.h"
+#include "tm_def.h"
+#include "tm_jit.h"
+#include "tm_run.h"
+#include "util.h"
+
+/*
+ * Benchmarks the engines and tapes on a few long-running machines, so that the time is spent
+ * in the hot loops rather than in parsing and setup, as with the many short test cases.
+ *
+ * Every combination of machine, engine and tape runs in its own forked process, so that its
+ * peak RSS is its own, and is timed over several trials, each on fresh tapes. We print one
+ * CSV line per combination with the median and 10th and 90th percentiles of the time per step.
+ * With -p we also count cycles, instructions and cache misses of the median trial with
+ * perf_event_open(), where the kernel allows it.
+ */
+
+// Default number of trials of each combination
+static const int DEFAULT_TRIALS = 5;
+// Number of steps that the non-halting machines run for
+static const step_t DEFAULT_STEPS = 100000000;
+// Initial length of tapes that grow, as in the tests
+static const int TAPE_LEN = 16;
+
+/*
+ * A benchmark machine. The halters have their exact step count, which we check, while the
+ * others run for the step budget, as do halters when the budget is smaller.
+ */
+struct bench_case_t {
+	const char *kind;	// what kind of machine it is, for grouping the results
+	const char *txt;
+	step_t steps;		// the number of steps until it halts, or 0 if it never does
+};
+
+static const struct bench_case_t BENCH_CASES[] = {
+	{"halter", "1RB1LC_1RC1RB_1RD0LE_1LA1LD_1RZ0LA", 47176870},
+	{"halter", "1RB0LD_1LC1RD_1LA1LC_1RZ1RE_1RA0RB", 23554764},
+	{"halter", "1RB2LA1RA1RA_1LB1LA3RB1RZ", 3932964},
+	{"bouncer", "1RB1LA_1LA1RB", 0},
+	{"bouncer", "0RB1LA_1LA1RB", 0},
+	{"counter", "1LC1RA_1LB0LA_0RA0LC", 0},
+	{"translated", "1RC0LC_1LA1RB_1LB0RB", 0},
+};
+
+static const int N_BENCH_CASES = sizeof BENCH_CASES / sizeof *BENCH_CASES;
+
+enum bench_engine_t {
+	ENGINE_DISPATCHED,	// tm_run_steps()
+	ENGINE_SPECIALIZED,	// the single-tape loops, e.g. tm_run_fast_flat()
+	ENGINE_SKIPPING,	// tm_run_skip_rle()
+	ENGINE_THREADED,	// tm_run_fast_thread()
+	ENGINE_MACRO,		// mm_run_steps()
+	ENGINE_COMPILED,	// tm_jit_run(), on its own array
+	N_ENGINES,
+};
+
+static const char *const ENGINE_NAMES[N_ENGINES] = {"dispatched", "specialized", "skipping", "threaded", "macro", "compiled"};
+
+enum bench_tape_t {
+	TAPE_FLAT,
+	TAPE_RLE,
+	TAPE_GAP,
+	TAPE_HYBRID,
+	TAPE_BIT,
+	N_TAPES,
+};
+
+static const char *const TAPE_NAMES[N_TAPES] = {"flat", "rle", "gap", "hybrid", "bit"};
+
+// The hardware counters of -p
+enum {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	N_PERF,
+};
+
+struct bench_trial_t {
+	step_t steps;
+	double seconds;
+	long long counts[N_PERF];	// -1 if not counted
+};
+
+/*
+ * What a combination sends back from its process.
+ */
+struct bench_report_t {
+	int supported;		// 0 if the engine can not run the machine, e.g. without a JIT
+	long peak_rss;		// in kB
+	struct bench_trial_t trials[];
+};
+
+/*
+ * The counters of one process, a group of N_PERF events led by the cycle counter, or all -1
+ * if perf is not available.
+ */
+struct bench_perf_t {
+	int fds[N_PERF];
+};
+
+static void perf_open(struct bench_perf_t *const perf, const int enable)
+{
+	for (int i = 0; i < N_PERF; i++)
+		perf->fds[i] = -1;
+#ifdef __linux__
+	if (!enable)
+		return;
+	static const unsigned long long configs[N_PERF] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+	};
+	for (int i = 0; i < N_PERF; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof attr);
+		attr.size = sizeof attr;
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.disabled = i == 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		perf->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : perf->fds[0], 0);
+		if (perf->fds[i] < 0) {
+			WARN("Could not open hardware counter %d, the kernel may not allow it.\n", i);
+			for (int j = 0; j < i; j++)
+				close(perf->fds[j]);
+			for (int j = 0; j < N_PERF; j++)
+				perf->fds[j] = -1;
+			return;
+		}
+	}
+#else
+	if (enable)
+		WARN("Hardware counters are only supported on Linux.\n");
+#endif
+}
+
+static void perf_start(const struct bench_perf_t *const perf)
+{
+#ifdef __linux__
+	if (perf->fds[0] < 0)
+		return;
+	(void) ioctl(perf->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	(void) ioctl(perf->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+	(void) perf;
+#endif
+}
+
+static void perf_stop(const struct bench_perf_t *const perf, long long *const counts)
+{
+	for (int i = 0; i < N_PERF; i++)
+		counts[i] = -1;
+#ifdef __linux__
+	if (perf->fds[0] < 0)
+		return;
+	(void) ioctl(perf->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	// With PERF_FORMAT_GROUP we read the number of events followed by their values
+	uint64_t values[1 + N_PERF];
+	if (read(perf->fds[0], values, sizeof values) != (ssize_t) sizeof values || values[0] != N_PERF)
+		return;
+	for (int i = 0; i < N_PERF; i++)
+		counts[i] = (long long) values[1 + i];
+#else
+	(void) perf;
+#endif
+}
+
+static void perf_close(const struct bench_perf_t *const perf)
+{
+	for (int i = 0; i < N_PERF; i++) {
+		if (perf->fds[i] >= 0)
+			close(perf->fds[i]);
+	}
+}
+
+/*
+ * Checks whether the engine runs on the tape. The compiled engine has its own array, which
+ * we report as the flat tape.
+ */
+static int bench_valid(const enum bench_engine_t engine, const enum bench_tape_t tape)
+{
+	switch (engine) {
+	case ENGINE_SKIPPING:
+		return tape == TAPE_RLE;
+	case ENGINE_THREADED:
+		return tape == TAPE_FLAT || tape == TAPE_BIT;
+	case ENGINE_MACRO:
+		return tape == TAPE_RLE || tape == TAPE_FLAT;
+	case ENGINE_COMPILED:
+		return tape == TAPE_FLAT;
+	default:
+		return 1;
+	}
+}
+
+static struct tape_t *bench_tape_init(const enum bench_tape_t tape, const unsigned sym_bits)
+{
+	switch (tape) {
+	case TAPE_FLAT:
+		return flat_tape_init(sym_bits, TAPE_LEN, TAPE_LEN / 2, FLAT_HEAP);
+	case TAPE_RLE:
+		return rle_tape_init(sym_bits);
+	case TAPE_GAP:
+		return gap_tape_init(sym_bits);
+	case TAPE_HYBRID:
+		return hybrid_tape_init(sym_bits);
+	case TAPE_BIT:
+		return bit_tape_init(sym_bits, TAPE_LEN, TAPE_LEN / 2);
+	default:
+		ERROR("Invalid tape %d.\n", tape);
+	}
+}
+
+/*
+ * Runs one trial of the machine for the budget, and times only the stepping. Returns the
+ * result with TM_RUNNING if the engine does not support the machine.
+ */
+static struct tm_result_t bench_trial(const struct tm_def_t *const def, const enum bench_engine_t engine, const enum bench_tape_t tape_kind, const step_t budget, const struct bench_perf_t *const perf, struct bench_trial_t *const trial)
+{
+	struct tm_result_t res = {0, TM_BUDGET};
+	double t = 0.0;
+	if (engine == ENGINE_COMPILED) {
+		struct tm_jit_t *const jit = tm_jit_compile(def);
+		if (!jit)
+			return (struct tm_result_t) {0, TM_RUNNING};
+		struct tm_jit_ctx_t ctx;
+		ctx.tape = calloc((size_t) TAPE_LEN, sizeof *ctx.tape);
+		ctx.pos = TAPE_LEN / 2;
+		ctx.len = TAPE_LEN;
+		ctx.lo = ctx.pos;
+		ctx.hi = ctx.pos;
+		ctx.origin = ctx.pos;
+		ctx.budget = budget;
+		ctx.state = 0;
+		perf_start(perf);
+		t = wall_seconds();
+		res.stop = tm_jit_run(jit, &ctx);
+		t = wall_seconds() - t;
+		perf_stop(perf, trial->counts);
+		res.steps = budget - ctx.budget;
+		free(ctx.tape);
+		tm_jit_free(jit);
+	} else if (engine == ENGINE_MACRO) {
+		const int block_size = mm_max_block_size(def);
+		struct tape_t *const tape = bench_tape_init(tape_kind, mm_sym_bits(def, block_size));
+		struct mm_run_t *const run = mm_run_init(def, block_size, tape);
+		perf_start(perf);
+		t = wall_seconds();
+		while (res.stop == TM_BUDGET && run->steps < budget)
+			res = mm_run_steps(run, budget - run->steps);
+		t = wall_seconds() - t;
+		perf_stop(perf, trial->counts);
+		res.steps = run->steps;
+		mm_run_free(run);
+		tape->free(tape);
+	} else {
+		struct tape_t *tape = bench_tape_init(tape_kind, ceil_log2((unsigned) def->n_syms));
+		struct tm_run_t *const run = tm_run_init(def, 1, &tape);
+		static struct tm_result_t (*const fast_fns[N_TAPES])(struct tm_run_t *, step_t) = {
+			tm_run_fast_flat, tm_run_fast_rle, tm_run_fast_gap, tm_run_fast_hybrid, tm_run_fast_bit,
+		};
+		struct tm_result_t (*const run_fn)(struct tm_run_t *, step_t) = engine == ENGINE_DISPATCHED ? tm_run_steps
+			: engine == ENGINE_SKIPPING ? tm_run_skip_rle : engine == ENGINE_THREADED ? tm_run_fast_thread : fast_fns[tape_kind];
+		perf_start(perf);
+		t = wall_seconds();
+		while (res.stop == TM_BUDGET && run->steps < budget)
+			res = run_fn(run, budget - run->steps);
+		t = wall_seconds() - t;
+		perf_stop(perf, trial->counts);
+		res.steps = run->steps;
+		tm_run_free(run);
+		tape->free(tape);
+	}
+	trial->steps = res.steps;
+	trial->seconds = t;
+	return res;
+}
+
+/*
+ * Runs all trials of a combination in the current process, and checks the halters.
+ */
+static void bench_combination(const struct bench_case_t *const bcase, const enum bench_engine_t engine, const enum bench_tape_t tape, const step_t budget, const int perf_enable, struct bench_report_t *const report, const int n_trials)
+{
+	struct tm_def_t *const def = tm_def_parse(bcase->txt);
+	struct bench_perf_t perf;
+	perf_open(&perf, perf_enable);
+	report->supported = 1;
+	for (int i = 0; i < n_trials; i++) {
+		const struct tm_result_t res = bench_trial(def, engine, tape, budget, &perf, report->trials + i);
+		if (res.stop == TM_RUNNING) {
+			report->supported = 0;
+			break;
+		}
+		if (bcase->steps && budget > bcase->steps && (res.stop != TM_HALTED || res.steps != bcase->steps)) {
+			ERROR("%s on %s stopped with %d after %lld steps, expected to halt after %lld.\n",
+				bcase->txt, TAPE_NAMES[tape], res.stop, res.steps, bcase->steps);
+		}
+	}
+	perf_close(&perf);
+	tm_def_free(def);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	report->peak_rss = usage.ru_maxrss;
+}
+
+/*
+ * Runs a combination in a child process, see above, which sends back its report through a pipe.
+ */
+static void bench_fork(const struct bench_case_t *const bcase, const enum bench_engine_t engine, const enum bench_tape_t tape, const step_t budget, const int perf_enable, struct bench_report_t *const report, const int n_trials)
+{
+	const size_t size = sizeof *report + (size_t) n_trials * sizeof *report->trials;
+	int fds[2];
+	if (pipe(fds) != 0) {
+		ERROR("Could not create a pipe.\n");
+	}
+	(void) fflush(stdout);
+	const pid_t pid = fork();
+	if (pid < 0) {
+		ERROR("Could not fork.\n");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		bench_combination(bcase, engine, tape, budget, perf_enable, report, n_trials);
+		const int ok = write(fds[1], report, size) == (ssize_t) size;
+		_exit(ok ? 0 : 1);
+	}
+	close(fds[1]);
+	size_t got = 0;
+	while (got < size) {
+		const ssize_t n = read(fds[0], (char *) report + got, size - got);
+		if (n <= 0)
+			break;
+		got += (size_t) n;
+	}
+	close(fds[0]);
+	int status;
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || got != size) {
+		ERROR("Benchmark of %s with the %s engine on %s failed.\n", bcase->txt, ENGINE_NAMES[engine], TAPE_NAMES[tape]);
+	}
+}
+
+static int cmp_double(const void *const a, const void *const b)
+{
+	const double x = *(const double *) a;
+	const double y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * The p-th percentile of the n sorted values, by the nearest rank.
+ */
+static double percentile(const double *const sorted, const int n, const double p)
+{
+	return sorted[(int) (p * (n - 1) + 0.5)];
+}
+
+static void print_report(const struct bench_case_t *const bcase, const enum bench_engine_t engine, const enum bench_tape_t tape, const struct bench_report_t *const report, const int n_trials)
+{
+	double *const ns_step = malloc((size_t) n_trials * sizeof *ns_step);
+	for (int i = 0; i < n_trials; i++)
+		ns_step[i] = report->trials[i].seconds * 1e9 / (double) (report->trials[i].steps > 0 ? report->trials[i].steps : 1);
+	// The median trial by time per step, for its step count and counters
+	int median = 0;
+	for (int i = 0; i < n_trials; i++) {
+		int below = 0;
+		for (int j = 0; j < n_trials; j++)
+			below += ns_step[j] < ns_step[i];
+		if (below == (n_trials - 1) / 2)
+			median = i;
+	}
+	const struct bench_trial_t *const trial = report->trials + median;
+	qsort(ns_step, (size_t) n_trials, sizeof *ns_step, cmp_double);
+	const double med = percentile(ns_step, n_trials, 0.5);
+
+	printf("%s,%s,%s,%s,%lld,%d,%.4f,%.4f,%.4f,%.0f,%ld",
+		bcase->kind, bcase->txt, ENGINE_NAMES[engine], TAPE_NAMES[tape], trial->steps, n_trials,
+		med, percentile(ns_step, n_trials, 0.1), percentile(ns_step, n_trials, 0.9), 1e9 / med, report->peak_rss);
+	for (int i = 0; i < N_PERF; i++) {
+		if (trial->counts[i] >= 0)
+			printf(",%lld", trial->counts[i]);
+		else
+			printf(",");
+	}
+	printf("\n");
+	free(ns_step);
+}
+
+static void usage(const char *const arg0)
+{
+	(void) fprintf(stderr, "Usage: %s [-n TRIALS] [-s STEPS] [-p] [-e ENGINE] [-t TAPE]\n", arg0);
+	(void) fprintf(stderr, "\t-n\tNumber of trials of each combination, by default %d.\n", DEFAULT_TRIALS);
+	(void) fprintf(stderr, "\t-s\tStep limit of every machine, by default %lld for the non-halting ones.\n", DEFAULT_STEPS);
+	(void) fprintf(stderr, "\t-p\tAlso count cycles, instructions and cache misses with perf_event_open().\n");
+	(void) fprintf(stderr, "\t-e\tOnly run one engine: dispatched, specialized, skipping, threaded, macro or compiled.\n");
+	(void) fprintf(stderr, "\t-t\tOnly run on one tape: flat, rle, gap, hybrid or bit.\n");
+}
+
+static int find_name(const char *const *const names, const int n, const char *const name)
+{
+	for (int i = 0; i < n; i++) {
+		if (strcmp(names[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	int n_trials = DEFAULT_TRIALS;
+	step_t max_steps = 0;
+	int perf_enable = 0;
+	int only_engine = -1;
+	int only_tape = -1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n_trials = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			max_steps = atoll(argv[++i]);
+		} else if (strcmp(argv[i], "-p") == 0) {
+			perf_enable = 1;
+		} else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			only_engine = find_name(ENGINE_NAMES, N_ENGINES, argv[++i]);
+			if (only_engine < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			only_tape = find_name(TAPE_NAMES, N_TAPES, argv[++i]);
+			if (only_tape < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (n_trials < 1 || max_steps < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// Check once that we can count, instead of warning in every process
+	if (perf_enable) {
+		struct bench_perf_t probe;
+		perf_open(&probe, 1);
+		perf_enable = probe.fds[0] >= 0;
+		perf_close(&probe);
+	}
+
+	struct bench_report_t *const report = malloc(sizeof *report + (size_t) n_trials * sizeof *report->trials);
+	printf("kind,machine,engine,tape,steps,trials,ns_step_median,ns_step_p10,ns_step_p90,steps_s_median,peak_rss_kb,cycles,instructions,cache_misses\n");
+	for (int c = 0; c < N_BENCH_CASES; c++) {
+		const struct bench_case_t *const bcase = BENCH_CASES + c;
+		// A halter must be allowed its halting step
+		step_t budget = bcase->steps ? bcase->steps + 1 : DEFAULT_STEPS;
+		if (max_steps > 0 && max_steps < budget)
+			budget = max_steps;
+		for (int e = 0; e < N_ENGINES; e++) {
+			for (int t = 0; t < N_TAPES; t++) {
+				if ((only_engine >= 0 && e != only_engine) || (only_tape >= 0 && t != only_tape) || !bench_valid(e, t))
+					continue;
+				bench_fork(bcase, e, t, budget, perf_enable, report, n_trials);
+				if (report->supported)
+					print_report(bcase, e, t, report, n_trials);
+			}
+		}
+	}
+	free(report);
+	return 0;
+}
@@ -1,3 +1,6 @@
+// Needed for popen() with -std=c99
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -7,23 +10,65 @@
 
 // Used only to get exit status of system(cmd) calls
 #include <sys/wait.h>
+// Used to load batch modules in-process with -d
+#include <dlfcn.h>
 
 /*
  * This file contains a "translator" (compiler, code generator) from the common Turing Machine
  * specification language into C. Later on we might add a translator to some assembly language,
  * but a modern C compiler should be faster than handwritten assembly, given that the generated C
- * is somewhat cleverly designed.
+ * is somewhat cleverly designed. With -j we instead use the in-process JIT in tm_jit.c, which
+ * avoids the compiler and subprocess entirely.
+ *
+ * The generated file contains one function per TM and a dispatcher table, so a whole batch of
+ * machines is compiled at once (-b), and then either run as a single process or loaded with
+ * dlopen() and called directly (-d).
  */
 
 #include "test_case.h"
 #include "tm_def.h"
+#include "tm_jit.h"
 
 static const char *const COMPILE_CMD = "clang -O3 -g3 -Weverything -Wno-unsafe-buffer-usage -std=c99 -pedantic %s -o %s";
+static const char *const COMPILE_SHARED_CMD = "clang -O3 -g3 -Weverything -Wno-unsafe-buffer-usage -std=c99 -pedantic -shared -fPIC %s -o %s";
 static const char *const RUN_CMD = "./%s";
 
-static const int TAPE_SIZE = 100000;
+// The entry point of a batch module, see tm_gen_write()
+typedef void (*tm_gen_fn_t)(int idx, long long *rec, unsigned char **span);
+
+// Initial tape length, both the generated code and the JIT grow the tape when needed
+static const int TAPE_SIZE = 1024;
 static const int INIT_POS = TAPE_SIZE / 2;
 
+/*
+ * The fields of the binary result record written by a compiled TM. The record is an array of
+ * N_RES long longs, so that the generated code doesn't need to share a struct definition with
+ * us. Positions are relative to the starting position. It is followed by the hi - lo + 1
+ * symbols of the visited tape span, one byte each.
+ */
+enum {
+	RES_STEPS = 0,		// number of steps taken
+	RES_STATE,			// the halting state
+	RES_NONZERO,		// number of nonzero symbols on the tape
+	RES_POS,			// final head position
+	RES_LO,				// lowest position visited
+	RES_HI,				// highest position visited
+	N_RES,
+};
+
+/*
+ * The result of running a compiled TM, from either backend.
+ */
+struct tm_gen_result_t {
+	step_t steps;
+	int state;
+	long long nonzero;
+	long long pos;
+	long long lo;
+	long long hi;
+	sym_t *span;		// the hi - lo + 1 symbols in the visited span
+};
+
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wformat-nonliteral"
 static void write_tabbed(FILE *out, int level, const char *const fmt, ...)
@@ -37,60 +82,175 @@ static void write_tabbed(FILE *out, int level, const char *const fmt, ...)
 }
 #pragma clang diagnostic pop
 
-static void tm_write_instruction(const struct tm_instr_t instr, FILE *out)
+/*
+ * Whether the generated code for a TM packs its tape, 8 cells per byte, which we do for all
+ * 2-symbol machines. Otherwise each cell is a uint8_t, which is enough since sym_t is too.
+ */
+static int tm_gen_packed(const struct tm_def_t *const def)
+{
+	return def->n_syms == 2;
+}
+
+static void tm_write_instruction(const struct tm_def_t *const def, const sym_t read_sym, const struct tm_instr_t instr, FILE *out)
 {
 	const int lvl = 3;
-	write_tabbed(out, lvl, "tape[pos] = %d;\n", instr.sym);
-	write_tabbed(out, lvl, "pos += %d;\n", instr.dir == DIR_RIGHT ? 1 : -1);
-	write_tabbed(out, lvl, "goto state_%c;\n", instr.state + 'A');
+	const int packed = tm_gen_packed(def);
+	if (instr.sym != read_sym) {
+		if (packed)
+			write_tabbed(out, lvl, "%s(pos);\n", instr.sym ? "SET_BIT" : "CLEAR_BIT");
+		else
+			write_tabbed(out, lvl, "tape[pos] = %d;\n", instr.sym);
+	}
+	write_tabbed(out, lvl, "step++;\n");
+	write_tabbed(out, lvl, "%s(%d);\n", instr.dir == DIR_RIGHT ? "MOVE_RIGHT" : "MOVE_LEFT", packed ? 8 : 1);
+	if (instr.state >= def->n_states) {
+		write_tabbed(out, lvl, "state = %d;\n", instr.state);
+		write_tabbed(out, lvl, "goto halt;\n");
+	} else {
+		write_tabbed(out, lvl, "goto state_%c;\n", instr.state + 'A');
+	}
 }
 
 /*
- * Generates a C file for the given TM definition.
+ * Writes the code shared by all machines in a file: the tape, growing it, and accessing it.
+ * The tape is an array of bytes holding len cells, either one cell per byte or 8 bits per byte.
  */
-static void tm_gen_write(const struct tm_def_t *const def, const char *const src_file, const int safe)
+static void tm_gen_write_prelude(FILE *out)
 {
-	FILE *out = fopen(src_file, "w");
-	write_tabbed(out, 0, "static int tape[%d] = {0};\n", TAPE_SIZE);
-	write_tabbed(out, 0, "int main(int argc, char **argv)\n");
+	write_tabbed(out, 0, "#include <stdint.h>\n");
+	write_tabbed(out, 0, "#include <stdio.h>\n");
+	write_tabbed(out, 0, "#include <stdlib.h>\n");
+	write_tabbed(out, 0, "#include <string.h>\n");
+	write_tabbed(out, 0, "static uint8_t *tape;\n");
+	write_tabbed(out, 0, "static long long len;\n");
+	write_tabbed(out, 0, "static long long grow(long long pos, long long cells_per_byte)\n");
 	write_tabbed(out, 0, "{\n");
-	write_tabbed(out, 1, "int pos = %d;\n", INIT_POS);
-	write_tabbed(out, 1, "int step = 0;\n", INIT_POS);
-	write_tabbed(out, 1, "(void) argc; (void) argv; // Surpress unused\n");
+	write_tabbed(out, 1, "uint8_t *const old = tape;\n");
+	write_tabbed(out, 1, "const long long bytes = len / cells_per_byte;\n");
+	write_tabbed(out, 1, "const long long shift = pos < 0 ? bytes : 0;\n");
+	write_tabbed(out, 1, "tape = calloc((size_t) (2 * bytes), 1);\n");
+	write_tabbed(out, 1, "if (!tape) exit(2);\n");
+	write_tabbed(out, 1, "memcpy(tape + shift, old, (size_t) bytes);\n");
+	write_tabbed(out, 1, "free(old);\n");
+	write_tabbed(out, 1, "len *= 2;\n");
+	write_tabbed(out, 1, "return shift * cells_per_byte;\n");
+	write_tabbed(out, 0, "}\n");
+	write_tabbed(out, 0, "#define GROW(cpb) { const long long shift = grow(pos, cpb); pos += shift; lo += shift; hi += shift; origin += shift; }\n");
+	write_tabbed(out, 0, "#define MOVE_LEFT(cpb) if (--pos < lo) { lo = pos; if (pos < 0) GROW(cpb) }\n");
+	write_tabbed(out, 0, "#define MOVE_RIGHT(cpb) if (++pos > hi) { hi = pos; if (pos >= len) GROW(cpb) }\n");
+	write_tabbed(out, 0, "#define READ_BIT(i) ((tape[(i) >> 3] >> ((i) & 7)) & 1)\n");
+	write_tabbed(out, 0, "#define SET_BIT(i) (tape[(i) >> 3] |= (uint8_t) (1U << ((i) & 7)))\n");
+	write_tabbed(out, 0, "#define CLEAR_BIT(i) (tape[(i) >> 3] &= (uint8_t) ~(1U << ((i) & 7)))\n");
+}
+
+/*
+ * Writes a function tm_<idx>(rec, span) that runs the given TM until it halts, then fills in
+ * the result record (see RES_STEPS etc) and returns the visited span in a new allocation.
+ * It tracks the visited span [lo, hi], and only checks the tape bounds when the span grows,
+ * doubling the tape on that side. Unless safe is set, reading a symbol that the TM does not
+ * have is undefined, so that the compiler can drop the range check on the switch.
+ */
+static void tm_gen_write_machine(FILE *out, const struct tm_def_t *const def, const int idx, const int safe)
+{
+	const int packed = tm_gen_packed(def);
+
+	write_tabbed(out, 0, "static void tm_%d(long long *const rec, unsigned char **const span)\n", idx);
+	write_tabbed(out, 0, "{\n");
+	write_tabbed(out, 1, "len = %d;\n", TAPE_SIZE);
+	write_tabbed(out, 1, "tape = calloc((size_t) len / %d, 1);\n", packed ? 8 : 1);
+	write_tabbed(out, 1, "if (!tape) exit(2);\n");
+	write_tabbed(out, 1, "long long pos = %d, lo = pos, hi = pos, origin = pos;\n", INIT_POS);
+	write_tabbed(out, 1, "long long step = 0;\n");
+	write_tabbed(out, 1, "int state;\n");
 	for (state_t i_state = 0; i_state < (state_t) def->n_states; i_state++) {
 		write_tabbed(out, 0, "state_%c:\n", i_state + 'A');
-		write_tabbed(out, 1, "step++;\n"); // TODO where should we actually place this instruction?
-		if (safe) {
-			write_tabbed(out, 1, "if (pos < 0 || pos >= %d)\n", TAPE_SIZE);
-			write_tabbed(out, 2, "return -12345;\n");
-		}
-		write_tabbed(out, 1, "switch (tape[pos]) {\n");
+		if (packed)
+			write_tabbed(out, 1, "switch (READ_BIT(pos)) {\n");
+		else
+			write_tabbed(out, 1, "switch (tape[pos]) {\n");
 		for (sym_t i_sym = 0; i_sym < (sym_t) def->n_syms; i_sym++) {
 			const struct tm_instr_t instr = tm_def_lookup(def, i_state, i_sym);
 			write_tabbed(out, 2, "case %d:\n", i_sym);
-			tm_write_instruction(instr, out);
+			tm_write_instruction(def, i_sym, instr, out);
 		}
-		// ERROR HANDLING
 		write_tabbed(out, 2, "default:\n");
-		write_tabbed(out, 3, "return -12345;\n");
-		// ERROR HANDLING
+		if (safe) {
+			// ERROR HANDLING
+			write_tabbed(out, 3, "exit(3);\n");
+			// ERROR HANDLING
+		} else {
+			write_tabbed(out, 3, "__builtin_unreachable();\n");
+		}
 		write_tabbed(out, 1, "}\n");
 	}
-	// TODO handle other halt states than Z
-	write_tabbed(out, 0, "state_Z:\n");
-	write_tabbed(out, 1, "return step;\n");
+	write_tabbed(out, 0, "halt:;\n");
+	write_tabbed(out, 1, "long long nonzero = 0;\n");
+	write_tabbed(out, 1, "*span = malloc((size_t) (hi - lo + 1));\n");
+	write_tabbed(out, 1, "if (!*span) exit(2);\n");
+	write_tabbed(out, 1, "for (long long i = lo; i <= hi; i++) {\n");
+	if (packed)
+		write_tabbed(out, 2, "(*span)[i - lo] = (unsigned char) READ_BIT(i);\n");
+	else
+		write_tabbed(out, 2, "(*span)[i - lo] = tape[i];\n");
+	write_tabbed(out, 2, "nonzero += (*span)[i - lo] != 0;\n");
+	write_tabbed(out, 1, "}\n");
+	write_tabbed(out, 1, "rec[%d] = step;\n", RES_STEPS);
+	write_tabbed(out, 1, "rec[%d] = state;\n", RES_STATE);
+	write_tabbed(out, 1, "rec[%d] = nonzero;\n", RES_NONZERO);
+	write_tabbed(out, 1, "rec[%d] = pos - origin;\n", RES_POS);
+	write_tabbed(out, 1, "rec[%d] = lo - origin;\n", RES_LO);
+	write_tabbed(out, 1, "rec[%d] = hi - origin;\n", RES_HI);
+	write_tabbed(out, 1, "free(tape);\n");
+	write_tabbed(out, 0, "}\n");
+}
+
+/*
+ * Generates a C file for the given TM definitions. It contains one function per TM and a
+ * dispatcher table indexed like defs, exported as tm_batch_run(idx, rec, span) for dlopen().
+ * When run as a program it runs every TM in order, and writes their binary result records,
+ * each followed by its span, to stdout.
+ */
+static void tm_gen_write(struct tm_def_t *const *const defs, const int n_defs, const char *const src_file, const int safe)
+{
+	FILE *out = fopen(src_file, "w");
+	tm_gen_write_prelude(out);
+	for (int i = 0; i < n_defs; i++)
+		tm_gen_write_machine(out, defs[i], i, safe);
+
+	write_tabbed(out, 0, "static void (*const TM_FNS[%d])(long long *, unsigned char **) = {\n", n_defs);
+	for (int i = 0; i < n_defs; i++)
+		write_tabbed(out, 1, "tm_%d,\n", i);
+	write_tabbed(out, 0, "};\n");
+	write_tabbed(out, 0, "void tm_batch_run(int idx, long long *rec, unsigned char **span);\n");
+	write_tabbed(out, 0, "void tm_batch_run(int idx, long long *rec, unsigned char **span)\n");
+	write_tabbed(out, 0, "{\n");
+	write_tabbed(out, 1, "TM_FNS[idx](rec, span);\n");
+	write_tabbed(out, 0, "}\n");
+
+	write_tabbed(out, 0, "int main(void)\n");
+	write_tabbed(out, 0, "{\n");
+	write_tabbed(out, 1, "for (int i = 0; i < %d; i++) {\n", n_defs);
+	write_tabbed(out, 2, "long long rec[%d];\n", N_RES);
+	write_tabbed(out, 2, "unsigned char *span;\n");
+	write_tabbed(out, 2, "TM_FNS[i](rec, &span);\n");
+	write_tabbed(out, 2, "fwrite(rec, sizeof *rec, %d, stdout);\n", N_RES);
+	write_tabbed(out, 2, "fwrite(span, 1, (size_t) (rec[%d] - rec[%d] + 1), stdout);\n", RES_HI, RES_LO);
+	write_tabbed(out, 2, "free(span);\n");
+	write_tabbed(out, 1, "}\n");
+	write_tabbed(out, 1, "return 0;\n");
 	write_tabbed(out, 0, "}\n");
 	fclose(out);
 }
 
 /*
- * Compiles the generated file.
+ * Compiles the generated file, either as a program or as a shared library.
  */
-static void tm_gen_compile(const char *const src_file, const char *const bin_file)
+static void tm_gen_compile(const char *const src_file, const char *const bin_file, const int shared)
 {
-	const size_t buflen = strlen(COMPILE_CMD) + strlen(src_file) + strlen(bin_file) + 1; // NB. a few extra chars
+	const char *const cmd = shared ? COMPILE_SHARED_CMD : COMPILE_CMD;
+	const size_t buflen = strlen(cmd) + strlen(src_file) + strlen(bin_file) + 1; // NB. a few extra chars
 	char *buf = malloc(buflen);
-	snprintf(buf, buflen, COMPILE_CMD, src_file, bin_file);
+	snprintf(buf, buflen, cmd, src_file, bin_file);
 	buf[buflen - 1] = 0; // Ensure null termination
 	int stat_val = system(buf);
 	free(buf);
@@ -100,20 +260,100 @@ static void tm_gen_compile(const char *const src_file, const char *const bin_fil
 }
 
 /*
- * Runs the compiled file and returns the number of steps taken.
+ * Unpacks a binary result record.
  */
-static int tm_gen_run(const char *const bin_file)
+static struct tm_gen_result_t tm_gen_result(const long long *const rec)
+{
+	struct tm_gen_result_t res;
+	res.steps = rec[RES_STEPS];
+	res.state = (int) rec[RES_STATE];
+	res.nonzero = rec[RES_NONZERO];
+	res.pos = rec[RES_POS];
+	res.lo = rec[RES_LO];
+	res.hi = rec[RES_HI];
+	res.span = NULL;
+	return res;
+}
+
+/*
+ * Runs the compiled file and reads the result records of its n_res machines through a pipe.
+ */
+static void tm_gen_run(const char *const bin_file, const int n_res, struct tm_gen_result_t *const res)
 {
 	const size_t buflen = strlen(RUN_CMD) + strlen(bin_file) + 1; // NB. a few extra chars
 	char *buf = malloc(buflen);
 	snprintf(buf, buflen, RUN_CMD, bin_file);
-	int stat_val = system(buf); // NB. Can't be const due to WIFEXITED() etc
+	FILE *const pipe = popen(buf, "r");
 	free(buf);
-	if (!WIFEXITED(stat_val)) {
+	if (!pipe) {
+		ERROR("Run of compiled TM failed!\n");
+	}
+
+	for (int i = 0; i < n_res; i++) {
+		long long rec[N_RES];
+		if (fread(rec, sizeof *rec, N_RES, pipe) != N_RES) {
+			ERROR("Compiled TM did not write a result record!\n");
+		}
+		res[i] = tm_gen_result(rec);
+		const size_t span_len = (size_t) (res[i].hi - res[i].lo + 1);
+		res[i].span = malloc(span_len * sizeof *res[i].span);
+		if (fread(res[i].span, sizeof *res[i].span, span_len, pipe) != span_len) {
+			ERROR("Compiled TM wrote a truncated tape span!\n");
+		}
+	}
+
+	int stat_val = pclose(pipe); // NB. Can't be const due to WIFEXITED() etc
+	if (!WIFEXITED(stat_val) || WEXITSTATUS(stat_val)) {
 		ERROR("Run of compiled TM failed!\n");
 	}
-	const int steps = WEXITSTATUS(stat_val);
-	return steps;
+}
+
+/*
+ * Loads a compiled batch module and calls it directly for each of its n_res machines.
+ */
+static void tm_gen_load_and_run(const char *const lib_file, const int n_res, struct tm_gen_result_t *const res)
+{
+	void *const lib = dlopen(lib_file, RTLD_NOW | RTLD_LOCAL);
+	if (!lib) {
+		ERROR("Could not load compiled TMs: %s\n", dlerror());
+	}
+	// ISO C has no conversion from object to function pointers, but POSIX requires it to work
+	union {
+		void *obj;
+		tm_gen_fn_t fn;
+	} conv;
+	conv.obj = dlsym(lib, "tm_batch_run");
+	if (!conv.obj) {
+		ERROR("Compiled TMs have no entry point: %s\n", dlerror());
+	}
+
+	for (int i = 0; i < n_res; i++) {
+		long long rec[N_RES];
+		unsigned char *span;
+		conv.fn(i, rec, &span);
+		res[i] = tm_gen_result(rec);
+		res[i].span = span;
+	}
+	dlclose(lib);
+}
+
+/*
+ * Checks a result against the expected steps and number of nonzero symbols, and that the
+ * visited span is consistent with them.
+ */
+static void tm_gen_check(const struct test_case_t *const tcase, const struct tm_gen_result_t *const res)
+{
+	long long nonzero = 0;
+	for (long long i = 0; i <= res->hi - res->lo; i++)
+		nonzero += res->span[i] != 0;
+
+	if (res->steps != tcase->steps || res->nonzero != tcase->nonzero || nonzero != res->nonzero) {
+		ERROR("Compiled TM %s halted after %lld steps with %lld nonzero, expected %lld steps and %d nonzero.\n",
+			tcase->txt, res->steps, res->nonzero, tcase->steps, tcase->nonzero);
+	}
+	if (!(res->lo <= 0 && 0 <= res->hi && res->lo <= res->pos && res->pos <= res->hi)) {
+		ERROR("Compiled TM %s has invalid span [%lld, %lld] with position %lld.\n", tcase->txt, res->lo, res->hi, res->pos);
+	}
 }
 
 static double verify_test_case(const struct test_case_t *const tcase, const int quiet)
@@ -136,21 +376,23 @@ static double verify_test_case(const struct test_case_t *const tcase, const int
 
 	t = clock();
 	const int safe = 0;
-	tm_gen_write(def, src_file, safe);
+	tm_gen_write(&def, 1, src_file, safe);
 	if (!quiet) printf("Generated code in %fs\n", seconds(clock(), t));
 
 	t = clock();
-	tm_gen_compile(src_file, bin_file);
+	tm_gen_compile(src_file, bin_file, 0);
 	if (!quiet) printf("Compiled code code in %fs\n", seconds(clock(), t));
 
 	t = clock();
-	const int steps = tm_gen_run(bin_file);
+	struct tm_gen_result_t res;
+	tm_gen_run(bin_file, 1, &res);
 	const double runtime = seconds(clock(), t);
-	if (!quiet) printf("Ran %d steps in %fs\n", steps, runtime);
+	if (!quiet) printf("Ran %lld steps in %fs\n", res.steps, runtime);
 
-	assert(steps == (tcase->steps & 0xFF)); // FIXME the exit status only gets the lowest byte, so we need to use program output instead...
+	tm_gen_check(tcase, &res);
 	if (!quiet) printf("Test case is OK!\n");
 
+	free(res.span);
 	tm_def_free(def);
 	free(src_file);
 	free(bin_file);
@@ -158,18 +400,134 @@ static double verify_test_case(const struct test_case_t *const tcase, const int
 	return runtime;
 }
 
-int main(const int argc, const char *const *const argv) {
-	// More concise way to surpress "unused" warnings, #pragma is messy for clang
-	(void) argc;
-	(void) argv;
+/*
+ * Same as verify_test_case() but for all test cases at once, compiled into a single module.
+ * It is run as a program, or loaded in-process if use_dlopen is set.
+ */
+static double verify_test_case_batch(const int quiet, const int use_dlopen)
+{
+	struct tm_def_t **const defs = malloc((size_t) N_TEST_CASES * sizeof *defs);
+	for (int i = 0; i < N_TEST_CASES; i++)
+		defs[i] = tm_def_parse(TEST_CASES[i].txt);
 
+	const char *const src_file = "./tmp/batch.c";
+	const char *const bin_file = use_dlopen ? "./tmp/batch.so" : "./tmp/batch";
+	const int safe = 0;
+	tm_gen_write(defs, N_TEST_CASES, src_file, safe);
+	tm_gen_compile(src_file, bin_file, use_dlopen);
+	if (!quiet) printf("Compiled %d TMs into %s\n", N_TEST_CASES, bin_file);
+
+	struct tm_gen_result_t *const res = malloc((size_t) N_TEST_CASES * sizeof *res);
+	const clock_t t = clock();
+	if (use_dlopen)
+		tm_gen_load_and_run(bin_file, N_TEST_CASES, res);
+	else
+		tm_gen_run(bin_file, N_TEST_CASES, res);
+	const double runtime = seconds(clock(), t);
+
+	for (int i = 0; i < N_TEST_CASES; i++) {
+		tm_gen_check(TEST_CASES + i, res + i);
+		free(res[i].span);
+		tm_def_free(defs[i]);
+	}
+	if (!quiet) printf("All %d test cases are OK!\n", N_TEST_CASES);
+	free(res);
+	free(defs);
+	return runtime;
+}
+
+/*
+ * Same as verify_test_case() but compiles with the JIT and runs in-process. Falls back to
+ * the C backend if JIT compilation is not supported on this platform.
+ */
+static double verify_test_case_jit(const struct test_case_t *const tcase, const int quiet)
+{
+	clock_t t = clock();
+	struct tm_def_t *const def = tm_def_parse(tcase->txt);
+	struct tm_jit_t *const jit = tm_jit_compile(def);
+	if (!jit) {
+		tm_def_free(def);
+		return verify_test_case(tcase, quiet);
+	}
+	if (!quiet) printf("Parsed and compiled %s in %fs\n", tcase->txt, seconds(clock(), t));
+
+	struct tm_jit_ctx_t ctx;
+	ctx.tape = calloc((size_t) TAPE_SIZE, sizeof *ctx.tape);
+	ctx.pos = INIT_POS;
+	ctx.len = TAPE_SIZE;
+	ctx.lo = INIT_POS;
+	ctx.hi = INIT_POS;
+	ctx.origin = INIT_POS;
+	ctx.budget = tcase->steps + 1;
+	ctx.state = 0;
+
+	t = clock();
+	const enum tm_stop_t stop = tm_jit_run(jit, &ctx);
+	const double runtime = seconds(clock(), t);
+	if (stop != TM_HALTED) {
+		ERROR("Compiled TM %s did not halt within %lld steps.\n", tcase->txt, tcase->steps + 1);
+	}
+
+	struct tm_gen_result_t res;
+	res.steps = tcase->steps + 1 - ctx.budget;
+	res.state = ctx.state;
+	res.pos = ctx.pos - ctx.origin;
+	res.lo = ctx.lo - ctx.origin;
+	res.hi = ctx.hi - ctx.origin;
+	res.span = ctx.tape + ctx.lo;
+	res.nonzero = 0;
+	for (long long i = ctx.lo; i <= ctx.hi; i++)
+		res.nonzero += ctx.tape[i] != 0;
+	if (!quiet) printf("Ran %lld steps in %fs\n", res.steps, runtime);
+
+	tm_gen_check(tcase, &res);
+	if (!quiet) printf("Test case is OK!\n");
+
+	free(ctx.tape);
+	tm_jit_free(jit);
+	tm_def_free(def);
+	return runtime;
+}
+
+int main(const int argc, const char *const *const argv) {
 	int quiet = 1;
+	int jit = 0;
+	int batch = 0;
+	int use_dlopen = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0) {
+			jit = 1;
+		} else if (strcmp(argv[i], "-b") == 0) {
+			batch = 1;
+		} else if (strcmp(argv[i], "-d") == 0) {
+			batch = 1;
+			use_dlopen = 1;
+		} else if (strcmp(argv[i], "-v") == 0) {
+			quiet = 0;
+		} else {
+			(void) fprintf(stderr, "Usage: %s [-j] [-b] [-d] [-v]\n", argv[0]);
+			(void) fprintf(stderr, "\t-j\tJIT compile in-process instead of generating C.\n");
+			(void) fprintf(stderr, "\t-b\tBatch, compile all test cases into one program.\n");
+			(void) fprintf(stderr, "\t-d\tSame as -b, but compile a shared library and load it with dlopen().\n");
+			(void) fprintf(stderr, "\t-v\tVerbose output.\n");
+			return 1;
+		}
+	}
 
+	const clock_t t = clock();
 	double tot_runtime = 0.0;
 	if (!quiet) printf("Verifying test cases...\n");
-	for (int i = 0; i < N_TEST_CASES; i++) {
-		tot_runtime += verify_test_case(TEST_CASES + i, quiet);
+	if (batch && !jit) {
+		tot_runtime = verify_test_case_batch(quiet, use_dlopen);
+	} else {
+		for (int i = 0; i < N_TEST_CASES; i++) {
+			if (jit)
+				tot_runtime += verify_test_case_jit(TEST_CASES + i, quiet);
+			else
+				tot_runtime += verify_test_case(TEST_CASES + i, quiet);
+		}
 	}
+	printf("Total wall time including compilation: %fs\n", seconds(clock(), t));
 	printf("Total runtime: %fs\n", tot_runtime);
 	return 0;
 }
@@ -0,0 +1,259 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mm_run.h"
+#include "tm_def.h"
+#include "util.h"
+
+#include "mm_cache.h"
+
+/*
+ * This file contains a bounded hash table of macro transitions, shared between runs of the
+ * same or different machines. The dense table of a single mm_run_t already computes each
+ * transition at most once, so this is for when we run many machines, e.g. in an enumeration,
+ * or the same one again, with another tape, after a restart, or in many threads.
+ *
+ * A macro transition only depends on the few base transitions that it used while being
+ * computed, so rather than the whole machine we key it on those. Each entry holds the
+ * (n_states, block size, state, entry direction, macro symbol) of the transition together with
+ * the base transitions (rows) it used, and a lookup only hits if the machine has exactly the
+ * same base transitions in all those rows. Then it would go through the same steps, so the
+ * result is the same, and machines that share some rows share the transitions that only use
+ * those. As the rows are compared in full, different machines can never be confused. Only
+ * transitions that used at most MM_CACHE_ROWS rows are cached.
+ *
+ * We use open addressing with linear probing over a short window of slots, from the hash of
+ * the key and the first row, which is the only one known before the transition is computed.
+ * When the window is full we overwrite its first slot, so the table never grows and inserting
+ * never fails.
+ *
+ * Any number of threads may use the same cache. Each slot is a small seqlock: the writer makes
+ * the sequence number odd, writes the slot and makes it even again, and a reader only trusts
+ * what it read if the sequence number was the same, even value before and after. Writers never
+ * wait for each other, they just give up when another one holds the slot. Lookups are thus as
+ * cheap as in a single thread, which suits the read-mostly use. We use the GCC/clang __atomic
+ * builtins, as C11 atomics are not available in C99, see tm_batch.c.
+ */
+
+// Number of slots to look at for each key before giving up
+#define MM_CACHE_PROBES 8
+
+// Set in every tag and row, so that the tag of an empty slot and its unused rows are 0
+#define MM_CACHE_USED 0x80000000U
+
+/*
+ * One slot of the cache, of 64 bytes. All fields are only accessed through __atomic builtins.
+ */
+struct mm_cache_slot_t {
+	uint32_t seq;					// even when stable, odd while being written
+	uint32_t tag;					// the packed key, see mm_cache_tag(), or 0 if empty
+	uint32_t rows[MM_CACHE_ROWS];	// the packed rows used, see mm_cache_row(), then 0s
+	uint64_t instr;					// the packed macro transition
+};
+
+struct mm_cache_t {
+	uint64_t mask;		// number of slots - 1
+	step_t evictions;	// number of slots overwritten with another key
+	struct mm_cache_slot_t slots[];
+};
+
+/*
+ * Constructs a new empty cache with 2^log2_size slots, of 64 bytes each.
+ */
+struct mm_cache_t *mm_cache_init(const int log2_size)
+{
+	if (log2_size < 4 || log2_size > 30) {
+		ERROR("Invalid cache size 2^%d, must be 2^4 to 2^30 slots.\n", log2_size);
+	}
+
+	const size_t n_slots = (size_t) 1 << (unsigned) log2_size;
+	// NB. this sets all tags to 0
+	struct mm_cache_t *const cache = calloc(1, sizeof *cache + n_slots * sizeof *cache->slots);
+	if (!cache) {
+		ERROR("Could not allocate a cache of %zu slots.\n", n_slots);
+	}
+	cache->mask = n_slots - 1;
+	cache->evictions = 0;
+	return cache;
+}
+
+void mm_cache_free(struct mm_cache_t *const cache)
+{
+	free(cache);
+}
+
+static uint32_t mm_cache_tag(const struct mm_run_t *const run, const state_t state, const dir_t dir, const sym_t msym)
+{
+	assert(0 < run->block_size && run->block_size <= MAX_SYM_BITS);
+	assert(0 < run->sym_bits && run->sym_bits <= MAX_SYM_BITS);
+	assert(run->def->n_states < 32 && state < 32);
+	return MM_CACHE_USED | (uint32_t) run->def->n_states << 22 | (uint32_t) run->sym_bits << 18
+		| (uint32_t) run->block_size << 14 | (uint32_t) dir << 13 | (uint32_t) state << 8 | msym;
+}
+
+/*
+ * Packs one row of the base machine, i.e. the base transition from (state, sym).
+ */
+static uint32_t mm_cache_row(const struct tm_def_t *const def, const state_t state, const sym_t sym)
+{
+	const struct tm_instr_t instr = tm_def_lookup(def, state, sym);
+	assert(state < 0x80 && instr.state < 0x80);
+	return MM_CACHE_USED | (uint32_t) state << 24 | (uint32_t) sym << 16 | (uint32_t) instr.sym << 8
+		| (uint32_t) instr.state << 1 | (uint32_t) instr.dir;
+}
+
+/*
+ * Checks whether the machine has the same base transitions as all the packed rows.
+ */
+static int mm_cache_rows_match(const struct tm_def_t *const def, const uint32_t *const rows)
+{
+	for (int i = 0; i < MM_CACHE_ROWS && rows[i] != 0; i++) {
+		const state_t state = (state_t) (rows[i] >> 24 & 0x7F);
+		const sym_t sym = (sym_t) (rows[i] >> 16 & 0xFF);
+		if (state >= def->n_states || (int) sym >= def->n_syms || mm_cache_row(def, state, sym) != rows[i])
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * The first slot to look at for a key, from the splitmix64 finalizer of the tag and the first
+ * row, i.e. the base transition from the state and the base symbol the head enters on.
+ */
+static uint64_t mm_cache_index(const struct mm_cache_t *const cache, const struct mm_run_t *const run, const uint32_t tag, const state_t state, const dir_t dir, const sym_t msym)
+{
+	const unsigned pos = dir == DIR_RIGHT ? 0U : (unsigned) run->block_size - 1U;
+	const sym_t sym = (sym_t) (((unsigned) msym >> (pos * run->sym_bits)) & ((1U << run->sym_bits) - 1U));
+	uint64_t x = (uint64_t) tag << 32 | mm_cache_row(run->def, state, sym);
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9U;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBU;
+	return (x ^ (x >> 31)) & cache->mask;
+}
+
+static uint64_t mm_cache_pack(const struct mm_instr_t instr)
+{
+	assert(instr.steps >= 0);
+	return (uint64_t) instr.kind | (uint64_t) instr.sym << 8 | (uint64_t) instr.state << 16
+		| (uint64_t) instr.dir << 24 | (uint64_t) (uint32_t) instr.steps << 32;
+}
+
+static struct mm_instr_t mm_cache_unpack(const uint64_t packed)
+{
+	struct mm_instr_t instr;
+	instr.kind = (unsigned char) (packed & 0xFF);
+	instr.sym = (sym_t) ((packed >> 8) & 0xFF);
+	instr.state = (state_t) ((packed >> 16) & 0xFF);
+	instr.dir = (dir_t) ((packed >> 24) & 0xFF);
+	instr.steps = (int) (packed >> 32);
+	return instr;
+}
+
+/*
+ * Reads a consistent copy of a slot, or returns 0 if it is being written right now.
+ */
+static int mm_cache_read_slot(const struct mm_cache_slot_t *const slot, uint32_t *const tag, uint32_t *const rows, uint64_t *const instr)
+{
+	const uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1U)
+		return 0;
+	*tag = __atomic_load_n(&slot->tag, __ATOMIC_RELAXED);
+	for (int i = 0; i < MM_CACHE_ROWS; i++)
+		rows[i] = __atomic_load_n(&slot->rows[i], __ATOMIC_RELAXED);
+	*instr = __atomic_load_n(&slot->instr, __ATOMIC_RELAXED);
+	// Keep the reads of the fields before the second read of the sequence number
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/*
+ * Looks up a macro transition for the machine of the run, which is found if it was computed
+ * with the same base transitions, see above. Returns 1 and sets instr if found, and returns 0
+ * otherwise.
+ */
+int mm_cache_get(const struct mm_cache_t *const cache, const struct mm_run_t *const run, const state_t state, const dir_t dir, const sym_t msym, struct mm_instr_t *const instr)
+{
+	const uint32_t want = mm_cache_tag(run, state, dir, msym);
+	const uint64_t idx = mm_cache_index(cache, run, want, state, dir, msym);
+	for (uint64_t i = 0; i < MM_CACHE_PROBES; i++) {
+		const struct mm_cache_slot_t *const slot = cache->slots + ((idx + i) & cache->mask);
+		uint32_t tag, rows[MM_CACHE_ROWS];
+		uint64_t packed;
+		// A slot being written may hold our key afterwards, but we don't wait for it
+		if (!mm_cache_read_slot(slot, &tag, rows, &packed))
+			continue;
+		// Slots are never emptied, so the key can not be any further
+		if (tag == 0)
+			return 0;
+		if (tag == want && mm_cache_rows_match(run->def, rows)) {
+			*instr = mm_cache_unpack(packed);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Inserts a macro transition that the run computed using the given rows, into the first empty
+ * slot of its window, or else over the first slot of it. If another thread is writing that slot
+ * at the same time, or the transition used more than MM_CACHE_ROWS rows, we just leave it out.
+ * Returns 1 if the transition is in the cache afterwards, as far as we know.
+ */
+int mm_cache_put(struct mm_cache_t *const cache, const struct mm_run_t *const run, const state_t state, const dir_t dir, const sym_t msym, const struct mm_rows_t *const rows, const struct mm_instr_t instr)
+{
+	assert(instr.kind != MM_UNKNOWN);
+	if (rows->n_rows > MM_CACHE_ROWS)
+		return 0;
+
+	uint32_t new_rows[MM_CACHE_ROWS] = {0};
+	for (int i = 0; i < rows->n_rows; i++)
+		new_rows[i] = mm_cache_row(run->def, rows->states[i], rows->syms[i]);
+
+	const uint32_t want = mm_cache_tag(run, state, dir, msym);
+	const uint64_t idx = mm_cache_index(cache, run, want, state, dir, msym);
+	struct mm_cache_slot_t *victim = cache->slots + idx;
+	for (uint64_t i = 0; i < MM_CACHE_PROBES; i++) {
+		struct mm_cache_slot_t *const slot = cache->slots + ((idx + i) & cache->mask);
+		uint32_t tag, old_rows[MM_CACHE_ROWS];
+		uint64_t packed;
+		if (!mm_cache_read_slot(slot, &tag, old_rows, &packed))
+			continue;
+		// Some other run got here first, and gives the same transition for this machine
+		if (tag == want && mm_cache_rows_match(run->def, old_rows))
+			return 1;
+		if (tag == 0) {
+			victim = slot;
+			break;
+		}
+	}
+
+	uint32_t seq = __atomic_load_n(&victim->seq, __ATOMIC_RELAXED);
+	if ((seq & 1U) || !__atomic_compare_exchange_n(&victim->seq, &seq, seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return 0;
+	// We hold the slot now, so we see whatever another thread may have put there meanwhile
+	const uint32_t old_tag = __atomic_load_n(&victim->tag, __ATOMIC_RELAXED);
+	int same_key = old_tag == want;
+	for (int i = 0; i < MM_CACHE_ROWS && same_key; i++)
+		same_key = __atomic_load_n(&victim->rows[i], __ATOMIC_RELAXED) == new_rows[i];
+	if (old_tag != 0 && !same_key)
+		(void) __atomic_fetch_add(&cache->evictions, 1, __ATOMIC_RELAXED);
+
+	// NB. the acquire above keeps these stores after the sequence number is made odd
+	__atomic_store_n(&victim->tag, want, __ATOMIC_RELAXED);
+	for (int i = 0; i < MM_CACHE_ROWS; i++)
+		__atomic_store_n(&victim->rows[i], new_rows[i], __ATOMIC_RELAXED);
+	__atomic_store_n(&victim->instr, mm_cache_pack(instr), __ATOMIC_RELAXED);
+	__atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/*
+ * Returns the number of transitions overwritten by others so far, as the window of their key
+ * was full, or another thread wrote a transition with another key into the same empty slot.
+ */
+step_t mm_cache_evictions(const struct mm_cache_t *const cache)
+{
+	return __atomic_load_n(&cache->evictions, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,30 @@
+// Cache of macro transitions, shared between Macro Machine runs of any machines and threads
+#ifndef TM_MM_CACHE_H
+#define TM_MM_CACHE_H
+
+#include "mm_run.h"
+#include "tm_def.h"
+#include "util.h"
+
+// Most base transitions that a macro transition may use to be cached, see mm_cache.c
+#define MM_CACHE_ROWS 12
+
+/*
+ * The distinct rows (state, symbol) of the base machine that one macro transition used, in
+ * the order they were first used.
+ */
+struct mm_rows_t {
+	int n_rows;						// MM_CACHE_ROWS + 1 if there were more than fit
+	state_t states[MM_CACHE_ROWS];
+	sym_t syms[MM_CACHE_ROWS];
+};
+
+struct mm_cache_t;
+
+struct mm_cache_t *mm_cache_init(int log2_size);
+void mm_cache_free(struct mm_cache_t *cache);
+int mm_cache_get(const struct mm_cache_t *cache, const struct mm_run_t *run, state_t state, dir_t dir, sym_t msym, struct mm_instr_t *instr);
+int mm_cache_put(struct mm_cache_t *cache, const struct mm_run_t *run, state_t state, dir_t dir, sym_t msym, const struct mm_rows_t *rows, struct mm_instr_t instr);
+step_t mm_cache_evictions(const struct mm_cache_t *cache);
+
+#endif
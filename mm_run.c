@@ -0,0 +1,297 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_cache.h"
+#include "tape.h"
+#include "tape_rle.h"
+#include "tm_def.h"
+#include "tm_run.h"
+#include "util.h"
+
+#include "mm_run.h"
+
+/*
+ * The number of bits needed for one base symbol. NB. the largest symbol is n_syms - 1, so
+ * unlike the tapes we don't waste a bit when n_syms is a power of two, which lets us fit
+ * twice as many base symbols of a 2-symbol TM into one macro symbol.
+ */
+static unsigned mm_base_sym_bits(const struct tm_def_t *const def)
+{
+	const unsigned sym_bits = ceil_log2((unsigned) def->n_syms - 1U);
+	return sym_bits > 0 ? sym_bits : 1U;
+}
+
+/*
+ * The number of bits needed for one macro symbol, i.e. block_size base symbols.
+ */
+unsigned mm_sym_bits(const struct tm_def_t *const def, const int block_size)
+{
+	assert(block_size > 0);
+	return (unsigned) block_size * mm_base_sym_bits(def);
+}
+
+/*
+ * The largest block size for which the macro symbols fit in our symbol type.
+ */
+int mm_max_block_size(const struct tm_def_t *const def)
+{
+	return MAX_SYM_BITS / (int) mm_base_sym_bits(def);
+}
+
+/*
+ * Initializes a new Macro Machine run for the given base TM. The tape must be blank and
+ * use mm_sym_bits(def, block_size) bits per symbol. The macro symbol at the origin holds the
+ * base symbols at positions 0 to block_size - 1, so we start in state A at the left edge of
+ * a block, i.e. as if we entered it moving right.
+ */
+struct mm_run_t *mm_run_init(const struct tm_def_t *const def, const int block_size, struct tape_t *const tape)
+{
+	if (block_size <= 0 || mm_sym_bits(def, block_size) > MAX_SYM_BITS) {
+		ERROR("Invalid block size %d, macro symbols must fit in %d bits.\n", block_size, MAX_SYM_BITS);
+	}
+
+	const unsigned sym_bits = mm_base_sym_bits(def);
+	const int n_msyms = 1 << (unsigned) block_size * sym_bits;
+	const size_t tab_size = (size_t) def->n_states * 2 * (size_t) n_msyms;
+
+	struct mm_run_t *const run = malloc(sizeof *run + tab_size * sizeof *run->instr_tab);
+	run->def = def;
+	run->tape = tape;
+	run->block_size = block_size;
+	run->sym_bits = sym_bits;
+	run->n_msyms = n_msyms;
+	run->steps = 0;
+	run->macro_steps = 0;
+	run->state = 0;
+	run->dir = DIR_RIGHT;
+	run->looping = 0;
+	run->cache = NULL;
+	run->cache_hits = 0;
+	run->cache_misses = 0;
+	// NB. this sets all kinds to MM_UNKNOWN
+	memset(run->instr_tab, 0, tab_size * sizeof *run->instr_tab);
+	return run;
+}
+
+/*
+ * Frees a Macro Machine run. NOTE this does not free the base definition or the tape.
+ */
+void mm_run_free(struct mm_run_t *const run)
+{
+	free(run);
+}
+
+/*
+ * Makes the run look up the transitions it has not seen yet in the given cache before
+ * computing them, and add the ones it computes, see mm_cache.c. The cache may be shared with
+ * other runs, also of other machines and in other threads, which then find the transitions
+ * that only use the base transitions that they have in common. Passing NULL stops using a cache.
+ * NOTE this does not take ownership of the cache.
+ */
+void mm_run_set_cache(struct mm_run_t *const run, struct mm_cache_t *const cache)
+{
+	run->cache = cache;
+}
+
+/*
+ * Checks whether the base machine has halted.
+ */
+int mm_run_halted(const struct mm_run_t *const run)
+{
+	return run->state >= run->def->n_states;
+}
+
+/*
+ * Counts the nonzero base symbols of one run of macro symbols, for mm_run_count_nonzero().
+ */
+struct mm_count_t {
+	const struct mm_run_t *run;
+	int nonzero;
+};
+
+static void mm_count_run(void *const ctx, const sym_t msym, const int len)
+{
+	struct mm_count_t *const count = ctx;
+	const unsigned sym_mask = (1U << count->run->sym_bits) - 1U;
+	int nonzero = 0;
+	for (int i = 0; i < count->run->block_size; i++)
+		nonzero += ((msym >> ((unsigned) i * count->run->sym_bits)) & sym_mask) != 0;
+	count->nonzero += nonzero * len;
+}
+
+/*
+ * Counts the number of nonzero base symbols on the tape, see tape_count_nonzero().
+ */
+int mm_run_count_nonzero(const struct mm_run_t *const run)
+{
+	struct mm_count_t count = {run, 0};
+	int head;
+	(void) run->tape->runs(run->tape, mm_count_run, &count, &head);
+	return count.nonzero;
+}
+
+/*
+ * Adds a row of the base machine to the rows used by a macro transition, unless it is there.
+ */
+static void mm_rows_add(struct mm_rows_t *const rows, const state_t state, const sym_t sym)
+{
+	if (rows->n_rows > MM_CACHE_ROWS)
+		return;
+	for (int i = 0; i < rows->n_rows; i++) {
+		if (rows->states[i] == state && rows->syms[i] == sym)
+			return;
+	}
+	if (rows->n_rows < MM_CACHE_ROWS) {
+		rows->states[rows->n_rows] = state;
+		rows->syms[rows->n_rows] = sym;
+	}
+	rows->n_rows++;
+}
+
+/*
+ * Determines one macro transition by running the base machine on the block of symbols,
+ * starting at the left edge if we entered moving right and vice versa, until it leaves
+ * the block or halts. If it runs for longer than the number of distinct configurations
+ * within the block, it must be looping forever. If rows is not NULL, we store the rows of
+ * the base machine that we used there, for the cache.
+ */
+static struct mm_instr_t mm_determine_instr(
+		const struct mm_run_t *const run,
+		const state_t in_state,
+		const dir_t in_dir,
+		const sym_t in_msym,
+		struct mm_rows_t *const rows)
+{
+	const struct tm_def_t *const def = run->def;
+	const int block_size = run->block_size;
+	const unsigned sym_mask = (1U << run->sym_bits) - 1U;
+
+	// Unpack the macro symbol, base symbol i is stored at bits i * sym_bits and up
+	sym_t syms[MAX_SYM_BITS];
+	for (int i = 0; i < block_size; i++)
+		syms[i] = (sym_t) ((in_msym >> ((unsigned) i * run->sym_bits)) & sym_mask);
+
+	int pos = in_dir == DIR_RIGHT ? 0 : block_size - 1;
+	state_t state = in_state;
+	const step_t max_steps = (step_t) def->n_states * block_size * run->n_msyms;
+
+	struct mm_instr_t instr = {MM_LOOP, in_msym, in_state, in_dir, 0};
+	for (step_t steps = 1; steps <= max_steps; steps++) {
+		if (rows)
+			mm_rows_add(rows, state, syms[pos]);
+		const struct tm_instr_t base = tm_def_lookup(def, state, syms[pos]);
+		syms[pos] = base.sym;
+		pos += base.dir == DIR_LEFT ? -1 : 1;
+		state = base.state;
+
+		if (state >= def->n_states || pos < 0 || pos >= block_size) {
+			instr.kind = state >= def->n_states ? MM_HALT : MM_EXIT;
+			instr.state = state;
+			instr.dir = pos < 0 ? DIR_LEFT : DIR_RIGHT;
+			instr.steps = (int) steps;
+			break;
+		}
+	}
+
+	// Pack the (possibly modified) base symbols again
+	unsigned out_msym = 0;
+	for (int i = 0; i < block_size; i++)
+		out_msym |= (unsigned) syms[i] << ((unsigned) i * run->sym_bits);
+	instr.sym = (sym_t) out_msym;
+
+	return instr;
+}
+
+/*
+ * Looks up a macro transition, computing and caching it if we have not seen it before.
+ * With a shared cache, we look there first and add what we compute, see mm_run_set_cache().
+ */
+static struct mm_instr_t mm_lookup(struct mm_run_t *const run, const sym_t msym)
+{
+	const size_t idx = ((size_t) run->state * 2 + run->dir) * (size_t) run->n_msyms + msym;
+	struct mm_instr_t *const instr = run->instr_tab + idx;
+	if (instr->kind != MM_UNKNOWN)
+		return *instr;
+
+	if (!run->cache) {
+		*instr = mm_determine_instr(run, run->state, run->dir, msym, NULL);
+	} else if (mm_cache_get(run->cache, run, run->state, run->dir, msym, instr)) {
+		run->cache_hits++;
+	} else {
+		struct mm_rows_t rows;
+		rows.n_rows = 0;
+		*instr = mm_determine_instr(run, run->state, run->dir, msym, &rows);
+		if (mm_cache_put(run->cache, run, run->state, run->dir, msym, &rows, *instr))
+			run->cache_misses++;
+	}
+	return *instr;
+}
+
+/*
+ * Runs the Macro Machine until at least max_steps base steps have passed, the machine has
+ * halted or is known to loop, or the tape has reached its limit. As one macro step covers
+ * many base steps, we may overshoot max_steps by the length of the last macro step.
+ * The steps in the result are base steps, the same as for tm_run_steps().
+ * On a RLE tape we also skip through runs of macro symbols, see rle_tape_skip().
+ */
+struct tm_result_t mm_run_steps(struct mm_run_t *const run, const step_t max_steps)
+{
+	struct tape_t *const tape = run->tape;
+	struct tm_result_t res = {0, TM_BUDGET};
+
+	while (res.steps < max_steps) {
+		if (mm_run_halted(run)) {
+			res.stop = TM_HALTED;
+			return res;
+		}
+		if (run->looping) {
+			res.stop = TM_NONHALT;
+			return res;
+		}
+
+		const struct mm_instr_t instr = mm_lookup(run, tape->read(tape));
+		if (instr.kind == MM_LOOP) {
+			run->looping = 1;
+			continue;
+		}
+
+		const int delta = instr.dir == DIR_LEFT ? -1 : 1;
+		if (instr.kind == MM_EXIT && tape->can_move && !tape->can_move(tape, delta)) {
+			res.stop = TM_TAPE_LIMIT;
+			return res;
+		}
+
+		// If we leave the block the same way we entered it, we do the same for the entire run
+		// of macro symbols, so on a RLE tape we can skip through all of it at once
+		if (instr.kind == MM_EXIT && instr.state == run->state && instr.dir == run->dir
+				&& tape->move == rle_tape_move) {
+			const step_t max_len = (max_steps - res.steps + instr.steps - 1) / instr.steps;
+			const int skipped = rle_tape_skip(tape, instr.sym, delta, max_len);
+			if (skipped > 0) {
+				run->steps += (step_t) skipped * instr.steps;
+				run->macro_steps += skipped;
+				res.steps += (step_t) skipped * instr.steps;
+				continue;
+			}
+		}
+
+		tape->write(tape, instr.sym);
+		run->state = instr.state;
+		run->steps += instr.steps;
+		run->macro_steps++;
+		res.steps += instr.steps;
+
+		// NB. we don't move on halting, the position within the block is lost anyway
+		if (instr.kind == MM_EXIT) {
+			tape->move(tape, delta);
+			run->dir = instr.dir;
+		}
+	}
+
+	if (mm_run_halted(run))
+		res.stop = TM_HALTED;
+	return res;
+}
@@ -0,0 +1,68 @@
+// Macro Machine simulation, where one macro symbol packs a block of base symbols
+#ifndef TM_MM_RUN_H
+#define TM_MM_RUN_H
+
+#include "tape.h"
+#include "tm_def.h"
+#include "tm_run.h"
+#include "util.h"
+
+/*
+ * The kind of a macro transition, i.e. what the base machine did within the block.
+ */
+enum mm_kind_t {
+	MM_UNKNOWN = 0,	// not yet computed
+	MM_EXIT,		// left the block to the left or right
+	MM_HALT,		// halted within the block
+	MM_LOOP,		// never leaves the block nor halts
+};
+
+/*
+ * One transition of the macro machine, for a given (base state, entry direction, macro symbol).
+ */
+struct mm_instr_t {
+	unsigned char kind;	// one of enum mm_kind_t
+	sym_t sym;			// the macro symbol to write
+	state_t state;		// the base state when leaving the block
+	dir_t dir;			// the direction we left the block in
+	int steps;			// the number of base steps taken within the block
+};
+
+/*
+ * A run of the Macro Machine with a given block size for a base TM. The macro transition
+ * table is computed lazily, as we encounter each (state, direction, macro symbol) combination.
+ */
+struct mm_run_t {
+	// NOTE that the base transition table and the tape are references and not managed by this struct!
+	const struct tm_def_t *def;	// base transition table (reference)
+	struct tape_t *tape;		// tape of macro symbols, must have mm_sym_bits() bits per symbol (reference)
+
+	int block_size;				// number of base symbols per macro symbol
+	unsigned sym_bits;			// number of bits per base symbol
+	int n_msyms;				// number of macro symbols
+
+	step_t steps;				// the number of base steps performed
+	step_t macro_steps;			// the number of macro steps performed
+	state_t state;				// the current base state
+	dir_t dir;					// the direction we entered the current block in
+	int looping;				// set when the run is known to never halt
+
+	struct mm_cache_t *cache;	// shared cache of macro transitions, or NULL (reference)
+	step_t cache_hits;			// transitions found in the cache instead of computed
+	step_t cache_misses;		// transitions computed and added to the cache, see mm_cache_put()
+
+	struct mm_instr_t instr_tab[];	// cached macro transitions, index (state * 2 + dir) * n_msyms + msym
+};
+
+struct mm_cache_t;
+
+unsigned mm_sym_bits(const struct tm_def_t *def, int block_size);
+int mm_max_block_size(const struct tm_def_t *def);
+struct mm_run_t *mm_run_init(const struct tm_def_t *def, int block_size, struct tape_t *tape);
+void mm_run_free(struct mm_run_t *run);
+void mm_run_set_cache(struct mm_run_t *run, struct mm_cache_t *cache);
+int mm_run_halted(const struct mm_run_t *run);
+int mm_run_count_nonzero(const struct mm_run_t *run);
+struct tm_result_t mm_run_steps(struct mm_run_t *run, step_t max_steps);
+
+#endif
@@ -1,53 +1,88 @@
 #include <assert.h>
+#include <string.h>
 
 #include "tape.h"
+#include "tape_flat.h"
+#include "tape_rle.h"
+
+// Number of symbols of each tape that tape_cmp() reads at a time, on the stack
+#define TAPE_CMP_CHUNK 256
 
 /*
- * Pretty hacky method of comparing two tapes. Because we don't (yet) support random access,
- * we simply move along the tape for a few units in each direction and compare them, making
- * sure to move back to the original position after we're done.
- * NOTE: this may cause us to allocate more memory than the TM run actually would use.
- * Because this is just used for testing it *should* be fine, hopefully.
+ * Compares the window symbols in each direction of the heads of two tapes, which may be of
+ * different kinds. Returns 0 if they are the same and 1 otherwise. This reads both windows
+ * with read_range in chunks, so the tapes are not moved and never grow, and nothing is
+ * allocated however large the window is.
  */
-int tape_cmp(struct tape_t *t1, struct tape_t *t2, int window)
+int tape_cmp(const struct tape_t *const t1, const struct tape_t *const t2, const int window)
 {
 	assert(window >= 0);
 
-	int differ = 0;
-
-	// Compare starting position
-	if (t1->read(t1) != t2->read(t2))
-		differ = 1;
+	int min_pos, max_pos;
+	const int head1 = t1->bounds(t1, &min_pos, &max_pos);
+	const int head2 = t2->bounds(t2, &min_pos, &max_pos);
 
-	// Move to the right until we find a difference or reach the end of out window
-	int i = 0;
-	while (i < window && !differ) {
-		t1->move(t1, 1);
-		t2->move(t2, 1);
-		i++;
-		if (t1->read(t1) != t2->read(t2))
-			differ = 1;
-	}
-	// Move back the number of units that we actually moved (may be zero)
-	while (i-- > 0) {
-		t1->move(t1, -1);
-		t2->move(t2, -1);
+	sym_t buf1[TAPE_CMP_CHUNK], buf2[TAPE_CMP_CHUNK];
+	const int len = 2 * window + 1;
+	for (int done = 0; done < len; done += TAPE_CMP_CHUNK) {
+		const int n = len - done < TAPE_CMP_CHUNK ? len - done : TAPE_CMP_CHUNK;
+		t1->read_range(t1, head1 - window + done, n, buf1);
+		t2->read_range(t2, head2 - window + done, n, buf2);
+		if (memcmp(buf1, buf2, (size_t) n * sizeof *buf1) != 0)
+			return 1;
 	}
+	return 0;
+}
 
-	// Move to the left
-	i = 0;
-	while (i < window && !differ) {
-		t1->move(t1, -1);
-		t2->move(t2, -1);
-		i++;
-		if (t1->read(t1) != t2->read(t2))
-			differ = 1;
-	}
-	// Move back the correct number of units
-	while (i-- > 0) {
-		t1->move(t1, 1);
-		t2->move(t2, 1);
+/*
+ * Moves the head of the tape from position pos to position to, one cell at a time, and
+ * updates pos. Positions may be relative to any point, as long as pos is where the head is.
+ */
+void tape_move_to(struct tape_t *const tape, int *const pos, const int to)
+{
+	for (; *pos < to; (*pos)++)
+		tape->move(tape, 1);
+	for (; *pos > to; (*pos)--)
+		tape->move(tape, -1);
+}
+
+/*
+ * Writes a run of len copies of sym from position from onwards onto a tape that is blank
+ * there, with the head at pos as for tape_move_to(). Blank runs are thus left out, and
+ * otherwise the head ends up on the last cell of the run. Loading the runs of another tape,
+ * e.g. from its runs method, one after another copies its contents.
+ */
+void tape_load_run(struct tape_t *const tape, int *const pos, const int from, const sym_t sym, const int len)
+{
+	assert(len >= 0);
+	if (sym == 0)
+		return;
+	for (int i = 0; i < len; i++) {
+		tape_move_to(tape, pos, from + i);
+		tape->write(tape, sym);
 	}
+}
+
+static void tape_count_run(void *const ctx, const sym_t sym, const int len)
+{
+	int *const nonzero = ctx;
+	if (sym != 0)
+		*nonzero += len;
+}
+
+/*
+ * Counts the number of nonzero symbols on the tape, e.g. for the BB sigma function, in one
+ * pass over its runs. Flat and RLE tapes are counted directly, without the callbacks.
+ */
+int tape_count_nonzero(const struct tape_t *const tape)
+{
+	if (tape->move == flat_tape_move)
+		return flat_tape_count_nonzero(tape);
+	if (tape->move == rle_tape_move)
+		return rle_tape_count_nonzero(tape);
 
-	return differ;
+	int nonzero = 0;
+	int head;
+	(void) tape->runs(tape, tape_count_run, &nonzero, &head);
+	return nonzero;
 }
@@ -9,6 +9,9 @@ typedef unsigned char sym_t;
 // NB. max sym bits should always fit in an int.
 #define MAX_SYM_BITS ((int) (CHAR_BIT * sizeof (sym_t)))
 
+// Receives len copies of sym, the next run of a tape, see the runs method of tape_t
+typedef void (*tape_run_fn_t)(void *ctx, sym_t sym, int len);
+
 /*
  * Holds a tape data object together with function pointers to its mutating functions ("methods").
  */
@@ -18,8 +21,25 @@ struct tape_t {
 	sym_t (*read)(const struct tape_t *tape);
 	void (*write)(struct tape_t *tape, sym_t sym);
 	void (*move)(struct tape_t *tape, int delta);
+	// Checks whether the head can move by delta, or NULL if the tape is unbounded
+	int (*can_move)(const struct tape_t *tape, int delta);
+	// Makes the tape blank with the head at the origin again, keeping its memory for reuse
+	void (*reset)(struct tape_t *tape);
+	// Calls fn with the maximal runs of the tape from left to right, covering at least all
+	// non-blank cells, stores the head position in head and returns the position of the first
+	// cell, both relative to the origin
+	int (*runs)(const struct tape_t *tape, tape_run_fn_t fn, void *ctx, int *head);
+	// Copies the len symbols from position from onwards into buf, where cells that were never
+	// written are blank, without moving the head
+	void (*read_range)(const struct tape_t *tape, int from, int len, sym_t *buf);
+	// Stores the span of cells that may be non-blank in min_pos and max_pos, and returns the
+	// head position, again all relative to the origin
+	int (*bounds)(const struct tape_t *tape, int *min_pos, int *max_pos);
 };
 
-int tape_cmp(struct tape_t *t1, struct tape_t *t2, int window);
+int tape_cmp(const struct tape_t *t1, const struct tape_t *t2, int window);
+int tape_count_nonzero(const struct tape_t *tape);
+void tape_move_to(struct tape_t *tape, int *pos, int to);
+void tape_load_run(struct tape_t *tape, int *pos, int from, sym_t sym, int len);
 
 #endif
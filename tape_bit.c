@@ -4,23 +4,29 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "tape_bit.h"
+#include "tape.h"
+#include "tm_def.h"
 #include "util.h"
 
+#include "tape_bit.h"
+
 typedef unsigned long bit_block_t;
 
 #define BLOCK_BITS (CHAR_BIT * sizeof (bit_block_t))
 
 /*
  * Contains an array of "syms" each consisting of sym_bits bits. They are stored packed in
- * "units".
+ * "units". The array grows by whole blocks when we run off the edge, like the flat tape.
  */
 struct bit_tape_t {
 	int n_syms;				// number of symbols in the tape
+	unsigned n_blocks;		// number of allocated blocks, always at least n_blocks_for(n_syms, sym_bits)
 	unsigned sym_bits;		// number of bits per symbol
 	int rel_pos;			// relative position (0 = TM starting position)
 	int init_pos;			// initial position, to ensure mem_pos := rel_pos + init_pos is always within the array
-	bit_block_t blocks[];	// this should always point to an array of n_blocks_for(n_syms, sym_bits) blocks
+	unsigned cur_block;		// index of the block containing the current symbol
+	unsigned cur_shift;		// bit offset of the current symbol within that block
+	bit_block_t *blocks;	// array of n_blocks blocks
 };
 
 /*
@@ -29,34 +35,195 @@ struct bit_tape_t {
  */
 static unsigned n_blocks_for(const int n_syms, const unsigned sym_bits)
 {
-	// FIXME: adding BLOCK_BITS - 1 results in a buffer overflow, investigate
-	return ((unsigned) n_syms * sym_bits + BLOCK_BITS) / BLOCK_BITS;
+	return ((unsigned) n_syms * sym_bits + BLOCK_BITS - 1) / BLOCK_BITS;
+}
+
+/*
+ * Doubles the size of the tape, adding zeros on the side given by delta. Growing to the right
+ * just reallocates, while to the left the existing blocks are moved up. Then all symbols
+ * keep their offset within their blocks, which requires that the number of added bits is
+ * a multiple of sym_bits, so we add a multiple of sym_bits / gcd(sym_bits, BLOCK_BITS) blocks.
+ */
+static void bit_tape_grow(struct bit_tape_t *const data, const int delta)
+{
+	const unsigned old_blocks = data->n_blocks;
+	unsigned added_blocks = old_blocks;
+	if (delta < 0) {
+		// BLOCK_BITS is a power of two, so the gcd is the lowest set bit of sym_bits
+		const unsigned unit = data->sym_bits / (data->sym_bits & (~data->sym_bits + 1U));
+		added_blocks = (old_blocks + unit - 1) / unit * unit;
+	}
+	const unsigned new_blocks = old_blocks + added_blocks;
+	if (new_blocks > INT_MAX / BLOCK_BITS) {
+		ERROR("Bit tape of %u blocks can not grow any further.\n", old_blocks);
+	}
+
+	data->blocks = realloc(data->blocks, (size_t) new_blocks * sizeof *data->blocks);
+	if (delta > 0) {
+		memset(data->blocks + old_blocks, 0, (size_t) added_blocks * sizeof *data->blocks);
+	} else {
+		memmove(data->blocks + added_blocks, data->blocks, (size_t) old_blocks * sizeof *data->blocks);
+		memset(data->blocks, 0, (size_t) added_blocks * sizeof *data->blocks);
+		const int added_syms = (int) (added_blocks * BLOCK_BITS / data->sym_bits);
+		data->init_pos += added_syms;
+		data->cur_block += added_blocks;
+	}
+	data->n_blocks = new_blocks;
+	data->n_syms = (int) (new_blocks * BLOCK_BITS / data->sym_bits);
+}
+
+/*
+ * Recomputes the cursor (cur_block and cur_shift) from the current position.
+ */
+static void bit_cursor_sync(struct bit_tape_t *const data)
+{
+	const unsigned bit_from = (unsigned) (data->init_pos + data->rel_pos) * data->sym_bits;
+	data->cur_block = bit_from / BLOCK_BITS;
+	data->cur_shift = bit_from % BLOCK_BITS;
+}
+
+/*
+ * When sym_bits is a power of two no larger than a byte, it divides BLOCK_BITS, so a symbol
+ * never straddles two blocks. Reading and writing is then a single shift and mask at the
+ * cursor, and moving only steps the cursor. The width is passed as a constant by the
+ * functions generated below, so that the compiler can fold it.
+ */
+static inline sym_t bit_cursor_read(const struct bit_tape_t *const data, const unsigned width)
+{
+	assert(data->sym_bits == width);
+	const bit_block_t mask = (1UL << width) - 1UL;
+	return (sym_t) ((data->blocks[data->cur_block] >> data->cur_shift) & mask);
+}
+
+static inline void bit_cursor_write(struct bit_tape_t *const data, const unsigned width, const sym_t sym)
+{
+	assert(data->sym_bits == width);
+	assert((sym & ~bitmask(0, width)) == 0UL);
+	const bit_block_t mask = ((1UL << width) - 1UL) << data->cur_shift;
+	bit_block_t *const block = &data->blocks[data->cur_block];
+	*block = (*block & ~mask) | ((bit_block_t) sym << data->cur_shift);
+}
+
+static inline void bit_cursor_move(struct bit_tape_t *const data, const unsigned width, const int delta)
+{
+	assert(data->sym_bits == width);
+	assert(delta == -1 || delta == 1);
+	const int sym_idx = data->rel_pos + data->init_pos + delta;
+	if (!(0 <= sym_idx && sym_idx < data->n_syms))
+		bit_tape_grow(data, delta);
+	data->rel_pos += delta;
+
+	if (delta == 1) {
+		data->cur_shift += width;
+		if (data->cur_shift == BLOCK_BITS) {
+			data->cur_shift = 0;
+			data->cur_block++;
+		}
+	} else {
+		if (data->cur_shift == 0) {
+			data->cur_shift = BLOCK_BITS;
+			data->cur_block--;
+		}
+		data->cur_shift -= width;
+	}
+}
+
+// Defines the tape_t methods for a fixed symbol width
+#define BIT_TAPE_WIDTH_FNS(width) \
+	static sym_t bit_tape_read_##width(const struct tape_t *const tape) \
+	{ \
+		return bit_cursor_read(tape->data, width); \
+	} \
+	static void bit_tape_write_##width(struct tape_t *const tape, const sym_t sym) \
+	{ \
+		bit_cursor_write(tape->data, width, sym); \
+	} \
+	static void bit_tape_move_##width(struct tape_t *const tape, const int delta) \
+	{ \
+		bit_cursor_move(tape->data, width, delta); \
+	}
+
+BIT_TAPE_WIDTH_FNS(1)
+BIT_TAPE_WIDTH_FNS(2)
+BIT_TAPE_WIDTH_FNS(4)
+BIT_TAPE_WIDTH_FNS(8)
+
+/*
+ * Checks whether the tape uses our implementation, either the generic or a fixed width one.
+ */
+static int is_bit_tape(const struct tape_t *const tape)
+{
+	return tape->free == bit_tape_free;
 }
 
 struct tape_t *bit_tape_init(const unsigned sym_bits, const int n_syms, const int init_pos)
 {
-	// Allocate the data blocks together with the metadata struct and zero them out with a memset
-	const size_t n_blocks = (size_t) n_blocks_for(n_syms, sym_bits);
-	struct bit_tape_t *const data = malloc(sizeof *data + n_blocks * sizeof *data->blocks);
-	memset(data->blocks, 0, n_blocks * sizeof *data->blocks);
+	assert(0 <= init_pos && init_pos < n_syms);
+
+	struct bit_tape_t *const data = malloc(sizeof *data);
+	data->n_blocks = n_blocks_for(n_syms, sym_bits);
+	data->blocks = calloc(data->n_blocks, sizeof *data->blocks);
 	data->n_syms = n_syms;
 	data->sym_bits = sym_bits;
 	data->rel_pos = 0;
 	data->init_pos = init_pos;
+	bit_cursor_sync(data);
 
 	struct tape_t *const tape = malloc(sizeof *tape);
 	tape->data = data;
 	tape->free = bit_tape_free;
-	tape->write = bit_tape_write;
-	tape->read = bit_tape_read;
-	tape->move = bit_tape_move;
+	tape->can_move = NULL;
+	tape->reset = bit_tape_reset;
+	tape->runs = bit_tape_runs;
+	tape->read_range = bit_tape_read_range;
+	tape->bounds = bit_tape_bounds;
+	// Pick the fixed width implementation if there is one, they keep the cursor up to date
+	switch (sym_bits) {
+	case 1:
+		tape->read = bit_tape_read_1;
+		tape->write = bit_tape_write_1;
+		tape->move = bit_tape_move_1;
+		break;
+	case 2:
+		tape->read = bit_tape_read_2;
+		tape->write = bit_tape_write_2;
+		tape->move = bit_tape_move_2;
+		break;
+	case 4:
+		tape->read = bit_tape_read_4;
+		tape->write = bit_tape_write_4;
+		tape->move = bit_tape_move_4;
+		break;
+	case 8:
+		tape->read = bit_tape_read_8;
+		tape->write = bit_tape_write_8;
+		tape->move = bit_tape_move_8;
+		break;
+	default:
+		tape->read = bit_tape_read;
+		tape->write = bit_tape_write;
+		tape->move = bit_tape_move;
+		break;
+	}
 	return tape;
 }
 
+/*
+ * Clears the bit tape, keeping the blocks and the origin where they are.
+ */
+void bit_tape_reset(struct tape_t *const tape)
+{
+	struct bit_tape_t *const data = tape->data;
+	memset(data->blocks, 0, data->n_blocks * sizeof *data->blocks);
+	data->rel_pos = 0;
+	bit_cursor_sync(data);
+}
+
 void bit_tape_free(struct tape_t *const tape)
 {
 	struct bit_tape_t *const data = tape->data;
-    free(data);
+	free(data->blocks);
+	free(data);
 	free(tape);
 }
 
@@ -71,16 +238,16 @@ sym_t bit_tape_read(const struct tape_t *const tape)
 	const unsigned bit_from = (unsigned) sym_idx * data->sym_bits;
 	const unsigned bit_to = ((unsigned) sym_idx + 1) * data->sym_bits;
 	const unsigned unit_from = bit_from / BLOCK_BITS;
-	const unsigned unit_to = bit_to / BLOCK_BITS;
+	const unsigned unit_to = (bit_to - 1) / BLOCK_BITS;
 	// Check that we don't read outside out allocated memory
-	assert(0 <= unit_from && unit_to < n_blocks_for(data->n_syms, data->sym_bits));
+	assert(0 <= unit_from && unit_to < data->n_blocks);
 
 	const unsigned shift_low = bit_from % BLOCK_BITS;
     const unsigned shift_high = bit_to % BLOCK_BITS;
 
 	if (unit_from == unit_to) {
 		// Only required to read one unit
-		const bit_block_t mask = bitmask(shift_low, bit_to % BLOCK_BITS);
+		const bit_block_t mask = bitmask(shift_low, shift_low + data->sym_bits);
 		const bit_block_t unit = (data->blocks[unit_from] & mask) >> shift_low;
 		return (sym_t) unit;
 	}
@@ -93,6 +260,61 @@ sym_t bit_tape_read(const struct tape_t *const tape)
 	return (sym_t) (low_unit | high_unit);
 }
 
+/*
+ * Gives the runs of the whole allocated tape, see tape_t. We read each symbol with
+ * bit_tape_read() on a copy of the tape moved to it.
+ */
+int bit_tape_runs(const struct tape_t *const tape, const tape_run_fn_t fn, void *const ctx, int *const head)
+{
+	const struct bit_tape_t *const data = tape->data;
+	struct bit_tape_t at = *data;
+	const struct tape_t at_tape = {.data = &at};
+	const int first = -data->init_pos;
+	const int last = data->n_syms - data->init_pos - 1;
+	int pos = first;
+	while (pos <= last) {
+		at.rel_pos = pos;
+		const sym_t sym = bit_tape_read(&at_tape);
+		const int start = pos;
+		for (pos++; pos <= last; pos++) {
+			at.rel_pos = pos;
+			if (bit_tape_read(&at_tape) != sym)
+				break;
+		}
+		fn(ctx, sym, pos - start);
+	}
+	*head = data->rel_pos;
+	return first;
+}
+
+/*
+ * Copies a range of the tape into buf, see tape_t. Like bit_tape_runs() we read the symbols
+ * within the allocated tape on a moved copy, and the rest is blank.
+ */
+void bit_tape_read_range(const struct tape_t *const tape, const int from, const int len, sym_t *const buf)
+{
+	const struct bit_tape_t *const data = tape->data;
+	assert(len >= 0);
+	struct bit_tape_t at = *data;
+	const struct tape_t at_tape = {.data = &at};
+	for (int i = 0; i < len; i++) {
+		const int sym_idx = data->init_pos + from + i;
+		at.rel_pos = from + i;
+		buf[i] = 0 <= sym_idx && sym_idx < data->n_syms ? bit_tape_read(&at_tape) : 0;
+	}
+}
+
+/*
+ * Gives the whole allocated tape as the span and the head position, see tape_t.
+ */
+int bit_tape_bounds(const struct tape_t *const tape, int *const min_pos, int *const max_pos)
+{
+	const struct bit_tape_t *const data = tape->data;
+	*min_pos = -data->init_pos;
+	*max_pos = data->n_syms - data->init_pos - 1;
+	return data->rel_pos;
+}
+
 void bit_tape_write(struct tape_t *const tape, const sym_t sym)
 {
 	struct bit_tape_t *const data = tape->data;
@@ -107,16 +329,16 @@ void bit_tape_write(struct tape_t *const tape, const sym_t sym)
 	const unsigned bit_from = (unsigned) sym_idx * data->sym_bits;
 	const unsigned bit_to = ((unsigned) sym_idx + 1) * data->sym_bits;
 	const unsigned unit_from = bit_from / BLOCK_BITS;
-	const unsigned unit_to = bit_to / BLOCK_BITS;
+	const unsigned unit_to = (bit_to - 1) / BLOCK_BITS;
 	// Check that we don't write outside out allocated memory
-	assert(0 <= unit_from && unit_to < n_blocks_for(data->n_syms, data->sym_bits));
+	assert(0 <= unit_from && unit_to < data->n_blocks);
 
 	const unsigned shift_low = bit_from % BLOCK_BITS;
     const unsigned shift_high = bit_to % BLOCK_BITS;
 
 	if (unit_from == unit_to) {
 		// Only required to write one unit
-		const bit_block_t mask = bitmask(shift_low, bit_to % BLOCK_BITS);
+		const bit_block_t mask = bitmask(shift_low, shift_low + data->sym_bits);
 		const bit_block_t unit = (data->blocks[unit_from] & ~mask) | ((bit_block_t) sym << shift_low);
 		data->blocks[unit_from] = unit;
 		return;
@@ -132,16 +354,197 @@ void bit_tape_write(struct tape_t *const tape, const sym_t sym)
 	data->blocks[unit_to] = low_unit;
 }
 
+
 void bit_tape_move(struct tape_t *const tape, int delta)
 {
 	struct bit_tape_t *data = tape->data;
 
 	assert(delta == -1 || delta == 1);
 	// TODO refactor to make position handling in tm_run instead?
+	const int sym_idx = data->rel_pos + data->init_pos + delta;
+	if (!(0 <= sym_idx && sym_idx < data->n_syms))
+		bit_tape_grow(data, delta);
 	data->rel_pos += delta;
-	if (!(0 <= data->rel_pos + data->init_pos && data->rel_pos + data->init_pos < data->n_syms)) {
-		ERROR("Tried to move to %d but tape length is %d\n", data->rel_pos + data->init_pos, data->n_syms);
+	// Keep the cursor valid, so that the generic and fixed width functions can be mixed
+	bit_cursor_sync(data);
+}
+
+/*
+ * The loop of bit_tape_run() for a given symbol width, where width = 0 means the generic
+ * functions. Always called with a constant width, so that it is specialized when inlined.
+ */
+static inline step_t bit_tape_run_width(struct tape_t *const tape, const struct tm_def_t *const def, const tm_hot_t *const hot_tab, state_t *const state, const step_t max_steps, const unsigned width)
+{
+	struct bit_tape_t *const data = tape->data;
+	const int n_syms = def->n_syms;
+	const int halt_row = def->n_states * n_syms;
+
+	int row = *state * n_syms;
+	step_t steps = 0;
+	while (steps < max_steps && row < halt_row) {
+		const sym_t sym = width ? bit_cursor_read(data, width) : bit_tape_read(tape);
+		const tm_hot_t hot = hot_tab[row + sym];
+		const int delta = HOT_DELTA(hot);
+		if (width) {
+			bit_cursor_write(data, width, HOT_SYM(hot));
+			bit_cursor_move(data, width, delta);
+		} else {
+			bit_tape_write(tape, HOT_SYM(hot));
+			bit_tape_move(tape, delta);
+		}
+		row = HOT_ROW(hot);
+		steps++;
+	}
+
+	*state = (state_t) (row / n_syms);
+	return steps;
+}
+
+/*
+ * Runs the given TM directly on a bit tape for at most max_steps steps, calling the bit tape
+ * functions directly instead of through the struct tape_t function pointers. Returns the
+ * number of steps taken.
+ */
+step_t bit_tape_run(struct tape_t *const tape, const struct tm_def_t *const def, const tm_hot_t *const hot_tab, state_t *const state, const step_t max_steps)
+{
+	assert(is_bit_tape(tape));
+
+	const struct bit_tape_t *const data = tape->data;
+	switch (data->sym_bits) {
+	case 1:
+		return bit_tape_run_width(tape, def, hot_tab, state, max_steps, 1);
+	case 2:
+		return bit_tape_run_width(tape, def, hot_tab, state, max_steps, 2);
+	case 4:
+		return bit_tape_run_width(tape, def, hot_tab, state, max_steps, 4);
+	case 8:
+		return bit_tape_run_width(tape, def, hot_tab, state, max_steps, 8);
+	default:
+		return bit_tape_run_width(tape, def, hot_tab, state, max_steps, 0);
+	}
+}
+
+// The threaded runner jumps through label addresses, a GNU C extension
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wgnu-label-as-value"
+
+/*
+ * The handlers of the threaded bit runner for a given width, see bit_cursor_read(), where
+ * width 0 goes through the generic functions. The width is a constant in each of them so that
+ * the compiler can fold it, as in bit_tape_run_width().
+ */
+#define BIT_THREAD_READ(width) ((width) ? bit_cursor_read(data, (width)) : bit_tape_read(tape))
+#define BIT_THREAD_STEP(width, delta) \
+	if (width) { \
+		bit_cursor_write(data, (width), op->sym); \
+		bit_cursor_move(data, (width), (delta)); \
+	} else { \
+		bit_tape_write(tape, op->sym); \
+		bit_tape_move(tape, (delta)); \
+	}
+#define BIT_THREAD_HANDLERS(width) \
+op_left_##width: \
+	BIT_THREAD_STEP(width, -1) \
+	op = op->next + BIT_THREAD_READ(width); \
+	if (--budget == 0) \
+		goto out; \
+	goto *op->handler; \
+op_right_##width: \
+	BIT_THREAD_STEP(width, 1) \
+	op = op->next + BIT_THREAD_READ(width); \
+	if (--budget == 0) \
+		goto out; \
+	goto *op->handler; \
+op_left_halt_##width: \
+	BIT_THREAD_STEP(width, -1) \
+	halted = 1; \
+	budget--; \
+	goto out; \
+op_right_halt_##width: \
+	BIT_THREAD_STEP(width, 1) \
+	halted = 1; \
+	budget--; \
+	goto out;
+#define BIT_THREAD_LABELS(width) {&&op_left_##width, &&op_right_##width, &&op_left_halt_##width, &&op_right_halt_##width}
+
+/*
+ * Which of the handler sets of bit_thread_loop() a tape uses, by its symbol width.
+ */
+static int bit_thread_set(const unsigned sym_bits)
+{
+	switch (sym_bits) {
+	case 1:
+		return 1;
+	case 2:
+		return 2;
+	case 4:
+		return 3;
+	case 8:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * The threaded runner behind bit_tape_thread() and bit_tape_thread_handlers(), in the same way
+ * as for the flat tape, but with one set of handlers per symbol width, see bit_thread_set().
+ * If handlers is given we only store the set for sym_bits there.
+ */
+static step_t bit_thread_loop(struct tape_t *const tape, const struct tm_thread_op_t *const code, const int n_syms, state_t *const state, const step_t max_steps, const void *const **const handlers, const unsigned sym_bits)
+{
+	static const void *const labels[5][N_THREAD_HANDLERS] = {
+		BIT_THREAD_LABELS(0), BIT_THREAD_LABELS(1), BIT_THREAD_LABELS(2), BIT_THREAD_LABELS(4), BIT_THREAD_LABELS(8),
+	};
+	if (handlers) {
+		*handlers = labels[bit_thread_set(sym_bits)];
+		return 0;
 	}
+
+	struct bit_tape_t *const data = tape->data;
+	step_t budget = max_steps;
+	const struct tm_thread_op_t *op = code + *state * n_syms + bit_tape_read(tape);
+	state_t halted = 0;
+	if (budget <= 0)
+		goto out;
+	goto *op->handler;
+
+	BIT_THREAD_HANDLERS(0)
+	BIT_THREAD_HANDLERS(1)
+	BIT_THREAD_HANDLERS(2)
+	BIT_THREAD_HANDLERS(4)
+	BIT_THREAD_HANDLERS(8)
+
+out:
+	// Unless we halted, op is the next transition, in row next_state * n_syms
+	*state = halted ? op->state : (state_t) ((op - code) / n_syms);
+	return max_steps - budget;
+}
+
+#pragma clang diagnostic pop
+
+/*
+ * The handlers of bit_tape_thread() for the given tape, to build its code with tm_def_thread().
+ */
+const void *const *bit_tape_thread_handlers(const struct tape_t *const tape)
+{
+	assert(is_bit_tape(tape));
+	const struct bit_tape_t *const data = tape->data;
+	const void *const *handlers = NULL;
+	(void) bit_thread_loop(NULL, NULL, 0, NULL, 0, &handlers, data->sym_bits);
+	return handlers;
+}
+
+/*
+ * Runs threaded code built for bit_tape_thread_handlers() directly on a bit tape for at most
+ * max_steps steps, see flat_tape_thread(). Returns the number of steps taken.
+ */
+step_t bit_tape_thread(struct tape_t *const tape, const struct tm_def_t *const def, const struct tm_thread_op_t *const code, state_t *const state, const step_t max_steps)
+{
+	assert(is_bit_tape(tape));
+	assert(*state < def->n_states);
+	const struct bit_tape_t *const data = tape->data;
+	return bit_thread_loop(tape, code, def->n_syms, state, max_steps, NULL, data->sym_bits);
 }
 
 static void test_basic(void)
@@ -149,6 +552,8 @@ static void test_basic(void)
 	assert(BLOCK_BITS == 64);
 
 	assert(n_blocks_for(10, 7) == 2);
+	assert(n_blocks_for(64, 1) == 1);
+	assert(n_blocks_for(65, 1) == 2);
 
 	assert(bitmask(1, 4) == 14);
 }
@@ -172,20 +577,24 @@ static void test_write_and_read(void)
         struct tape_t *tape = bit_tape_init(sym_bits, n_syms, 0);
 
         for (int i = 0; i < n_syms; i++) {
-            bit_tape_write(tape, prng_sym(i, sym_bits));
+            tape->write(tape, prng_sym(i, sym_bits));
 			if (i < n_syms - 1) {
-				bit_tape_move(tape, 1);
+				tape->move(tape, 1);
 			}
         }
 
         for (int i = n_syms - 1; i >= 0; i--) {
             bit_block_t written = prng_sym(i, sym_bits);
-            bit_block_t read = bit_tape_read(tape);
+            // Both the generic and fixed width implementations must see the same symbols
+            bit_block_t read = tape->read(tape);
+			if (read != bit_tape_read(tape)) {
+				ERROR("Expected fixed width read %lu to match generic read %lu\n", read, (bit_block_t) bit_tape_read(tape));
+			}
 			if (read != written) {
 				ERROR("Expected read %lu to match written %lu\n", read, written);
 			}
 			if (i > 0) {
-				bit_tape_move(tape, -1);
+				tape->move(tape, -1);
 			}
         }
 
@@ -193,8 +602,54 @@ static void test_write_and_read(void)
     }
 }
 
+/*
+ * Starts from a single symbol and writes in both directions, so that the tape has to grow
+ * repeatedly on either side, then checks that every symbol kept its value.
+ */
+static void test_grow(void)
+{
+	const int n_syms = 1000;
+	for (unsigned sym_bits = 1; sym_bits <= MAX_SYM_BITS; sym_bits++) {
+		struct tape_t *tape = bit_tape_init(sym_bits, 1, 0);
+
+		for (int i = 0; i < n_syms; i++) {
+			tape->write(tape, prng_sym(i, sym_bits));
+			tape->move(tape, -1);
+		}
+		for (int i = 0; i < 2 * n_syms; i++)
+			tape->move(tape, 1);
+		for (int i = 0; i < n_syms; i++) {
+			tape->write(tape, prng_sym(n_syms + i, sym_bits));
+			tape->move(tape, -1);
+		}
+
+		// Now the head is at the origin, with symbol i at -i and symbol 2 * n_syms - i at i
+		for (int i = 0; i < n_syms; i++) {
+			const bit_block_t written = prng_sym(i, sym_bits);
+			const bit_block_t read = tape->read(tape);
+			if (read != written) {
+				ERROR("Expected read %lu to match written %lu after growing left\n", read, written);
+			}
+			tape->move(tape, -1);
+		}
+		for (int i = 0; i < n_syms; i++)
+			tape->move(tape, 1);
+		for (int i = 1; i <= n_syms; i++) {
+			tape->move(tape, 1);
+			const bit_block_t written = prng_sym(2 * n_syms - i, sym_bits);
+			const bit_block_t read = tape->read(tape);
+			if (read != written) {
+				ERROR("Expected read %lu to match written %lu after growing right\n", read, written);
+			}
+		}
+
+		bit_tape_free(tape);
+	}
+}
+
 void bit_tape_test(void)
 {
 	test_basic();
     test_write_and_read();
+	test_grow();
 }
@@ -1,9 +1,10 @@
-// Packed bit-field tape. Does NOT automatically grow, instead crashes with error
-// Intended to be used where the programmer checks the bounds manually
+// Packed bit-field tape. Automatically grows by whole blocks, like the flat tape
 #ifndef TM_BIT_TAPE_H
 #define TM_BIT_TAPE_H
 
 #include "tape.h"
+#include "tm_def.h"
+#include "util.h"
 
 struct tape_t *bit_tape_init(unsigned sym_bits, int n_syms, int init_pos);
 
@@ -11,6 +12,14 @@ void bit_tape_free(struct tape_t *tape);
 sym_t bit_tape_read(const struct tape_t *tape);
 void bit_tape_write(struct tape_t *tape, sym_t sym);
 void bit_tape_move(struct tape_t *tape, int delta);
+void bit_tape_reset(struct tape_t *tape);
+int bit_tape_runs(const struct tape_t *tape, tape_run_fn_t fn, void *ctx, int *head);
+void bit_tape_read_range(const struct tape_t *tape, int from, int len, sym_t *buf);
+int bit_tape_bounds(const struct tape_t *tape, int *min_pos, int *max_pos);
+
+step_t bit_tape_run(struct tape_t *tape, const struct tm_def_t *def, const tm_hot_t *hot_tab, state_t *state, step_t max_steps);
+const void *const *bit_tape_thread_handlers(const struct tape_t *tape);
+step_t bit_tape_thread(struct tape_t *tape, const struct tm_def_t *def, const struct tm_thread_op_t *code, state_t *state, step_t max_steps);
 
 // Temporary, remove later
 void bit_tape_test(void);
@@ -1,3 +1,6 @@
+// Needed for MAP_ANONYMOUS, MAP_NORESERVE and madvise() with -std=c99
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
 #include <limits.h>
 #include <stddef.h>
@@ -5,21 +8,30 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/mman.h>
+
 #include "tape.h"
+#include "tm_def.h"
 #include "util.h"
 
 #include "tape_flat.h"
 
 /*
- * A flat tape that automatically expands (by doubling the size) if we run off the edge.
+ * A flat tape that automatically expands (by doubling the size) if we run off the edge,
+ * or that is backed by a fixed virtual memory reservation, see enum flat_backing_t.
  */
 struct flat_tape_t {
 	sym_t *syms;		// symbol memory array
 	int len;			// length of the full tape
 	int rel_pos;		// relative position (0 = TM starting position)
 	int init_pos;		// initial position, to ensure mem_pos := rel_pos + init_pos is always within the array
+	int min_pos;		// leftmost relative position visited so far
+	int max_pos;		// rightmost relative position visited so far
 	unsigned sym_bits;	// the width of one symbol in bits (must be <= MAX_SYM_BITS)
-	// invariants: 0 <= rel_pos + init_pos < len
+	int backing;		// how the symbol memory is allocated, one of enum flat_backing_t
+	struct flat_stats_t stats;	// only counted with -DTM_STATS
+	// invariants: 0 <= min_pos + init_pos <= rel_pos + init_pos <= max_pos + init_pos < len
+	// and all symbols outside of [min_pos, max_pos] are zero
 };
 
 /*
@@ -28,26 +40,68 @@ struct flat_tape_t {
 void flat_tape_free(struct tape_t *const tape)
 {
 	struct flat_tape_t *const data = tape->data;
-	free(data->syms);
+	if (data->backing == FLAT_HEAP)
+		free(data->syms);
+	else
+		munmap(data->syms, (size_t) data->len * sizeof *data->syms);
 	free(data);
 	free(tape);
 }
 
+/*
+ * Reserves virtual memory for len symbols. The pages are only backed by physical memory once
+ * they are written to, and reading untouched pages gives zeros, so unused tape is free.
+ */
+static sym_t *flat_tape_reserve(const int len, const int huge)
+{
+	int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+	// Don't count the whole reservation against the overcommit limit
+	map_flags |= MAP_NORESERVE;
+#endif
+	const size_t size = (size_t) len * sizeof (sym_t);
+	void *const mem = mmap(NULL, size, PROT_READ | PROT_WRITE, map_flags, -1, 0);
+	if (mem == MAP_FAILED) {
+		ERROR("Could not reserve %zu bytes for flat tape.\n", size);
+	}
+
+	if (huge) {
+#ifdef MADV_HUGEPAGE
+		// Fewer TLB misses for machines that sweep across a wide part of the tape
+		if (madvise(mem, size, MADV_HUGEPAGE) != 0)
+			WARN("Could not enable huge pages for flat tape.\n");
+#else
+		WARN("Huge pages are not supported on this platform.\n");
+#endif
+	}
+	return mem;
+}
+
 /*
  * Creates a flat tape of the specified initial size filled with zeros.
- * The absolute position is initialized to zero.
+ * The absolute position is initialized to zero. With FLAT_HEAP the tape grows as needed,
+ * while with FLAT_MMAP or FLAT_MMAP_HUGE the full len symbols are reserved up front,
+ * and the tape can not move outside of them (reported through the can_move method).
  */
-struct tape_t *flat_tape_init( const unsigned sym_bits, const int len, const int init_pos)
+struct tape_t *flat_tape_init(const unsigned sym_bits, const int len, const int init_pos, const enum flat_backing_t backing)
 {
 	assert(0 <= init_pos && init_pos < len);			// This ensures that our intial position is within the syms array
 	assert(1 <= sym_bits && sym_bits <= MAX_SYM_BITS);
 
 	struct flat_tape_t *const data = malloc(sizeof *data);
-	data->syms = calloc((size_t) len, sizeof *data->syms);
+	if (backing == FLAT_HEAP)
+		data->syms = calloc((size_t) len, sizeof *data->syms);
+	else
+		data->syms = flat_tape_reserve(len, backing == FLAT_MMAP_HUGE);
+	data->backing = backing;
 	data->len = len;
 	data->rel_pos = 0;
 	data->init_pos = init_pos;
+	data->min_pos = 0;
+	data->max_pos = 0;
 	data->sym_bits = sym_bits;
+	data->stats.grows = 0;
+	data->stats.bytes_copied = 0;
 
 	struct tape_t *const tape = malloc(sizeof *tape);
 	tape->data = data;
@@ -55,10 +109,25 @@ struct tape_t *flat_tape_init( const unsigned sym_bits, const int len, const int
 	tape->write = flat_tape_write;
 	tape->read = flat_tape_read;
 	tape->move = flat_tape_move;
+	// Only reserved tapes have a limit, growing tapes are unbounded
+	tape->can_move = backing == FLAT_HEAP ? NULL : flat_tape_can_move;
+	tape->reset = flat_tape_reset;
+	tape->runs = flat_tape_runs;
+	tape->read_range = flat_tape_read_range;
+	tape->bounds = flat_tape_bounds;
 
 	return tape;
 }
 
+/*
+ * Creates a flat tape for running many TMs one after another, see FLAT_REUSE_LEN, with the
+ * widest symbols so that it can be used for any TM.
+ */
+struct tape_t *flat_tape_init_any(void)
+{
+	return flat_tape_init(MAX_SYM_BITS, FLAT_REUSE_LEN, FLAT_REUSE_LEN / 2, FLAT_HEAP);
+}
+
 /*
  * Prints an excerpt of the flat tape with a given ctx number of symbols
  * on either side of the head.
@@ -102,11 +171,94 @@ void flat_tape_print(const struct flat_tape_t *const tape, const int ctx, const
 }
 
 /*
- * Moves left or right in the flat tape, reallocating tape as required if we move outside.
- * NOTE: it is not very efficient to allocate 100% more memory just because we went outside
- * on one side by one symbol. Perhaps we should be later change to only add 50% more on the
- * side we actually went outside. Depends on the statistical properties of TMs, e.g.
- * "bouncers" (allocate both sides is good) vs "translated cycles" (allocate one side is good), etc.
+ * Doubles the length of the tape, adding all of the new space on the side we ran out of, since
+ * e.g. translated cyclers keep going in one direction. Growing to the right is a realloc(),
+ * which for large tapes can usually remap the memory instead of copying it. Growing to the
+ * left has to shift the contents, but we only need to copy the visited span, as the rest of
+ * the tape is known to be zero.
+ */
+static void flat_tape_grow(struct flat_tape_t *const data, const int delta)
+{
+	if (data->backing != FLAT_HEAP) {
+		ERROR("Moved outside of reserved flat tape of %d symbols.\n", data->len);
+	}
+
+	const int old_len = data->len;
+	if (old_len > INT_MAX / 2) {
+		ERROR("Flat tape can not grow beyond %d symbols.\n", old_len);
+	}
+	const int new_len = old_len * 2;
+
+	if (delta == 1) {
+		data->syms = realloc(data->syms, (size_t) new_len * sizeof *data->syms);
+		memset(data->syms + (ptrdiff_t) old_len, 0, (size_t) (new_len - old_len) * sizeof *data->syms);
+		STAT(data->stats.bytes_copied += (step_t) old_len * (step_t) sizeof *data->syms);
+	} else {
+		const int offset = new_len - old_len;
+		const int from = data->min_pos + data->init_pos;
+		const int to = data->max_pos + data->init_pos;
+		sym_t *const new_syms = calloc((size_t) new_len, sizeof *new_syms);
+		memcpy(new_syms + (ptrdiff_t) (offset + from), data->syms + (ptrdiff_t) from, (size_t) (to - from + 1) * sizeof *new_syms);
+		STAT(data->stats.bytes_copied += (step_t) (to - from + 1) * (step_t) sizeof *new_syms);
+		free(data->syms);
+		data->syms = new_syms;
+		data->init_pos += offset;
+	}
+	data->len = new_len;
+	STAT(data->stats.grows++);
+}
+
+/*
+ * Clears the flat tape, only the visited span can be nonzero so we don't touch the rest.
+ * Keeps the memory and the origin where they are, so a reused tape doesn't have to grow again.
+ */
+void flat_tape_reset(struct tape_t *const tape)
+{
+	struct flat_tape_t *const data = tape->data;
+	const int from = data->min_pos + data->init_pos;
+	const int to = data->max_pos + data->init_pos;
+	memset(data->syms + from, 0, (size_t) (to - from + 1) * sizeof *data->syms);
+	data->rel_pos = 0;
+	data->min_pos = 0;
+	data->max_pos = 0;
+	data->stats.grows = 0;
+	data->stats.bytes_copied = 0;
+}
+
+/*
+ * Copies the counts of how the tape grew since the last reset into stats, which are all zero
+ * unless built with -DTM_STATS.
+ */
+void flat_tape_stats(const struct tape_t *const tape, struct flat_stats_t *const stats)
+{
+	assert(tape->move == flat_tape_move);
+	const struct flat_tape_t *const data = tape->data;
+	*stats = data->stats;
+}
+
+/*
+ * Prints the counts of flat_tape_stats() on one line.
+ */
+void flat_tape_print_stats(const struct tape_t *const tape)
+{
+	struct flat_stats_t stats;
+	flat_tape_stats(tape, &stats);
+	printf("flat grows: %lld, bytes copied: %lld\n", stats.grows, stats.bytes_copied);
+}
+
+/*
+ * Checks whether we can move by delta, which is always possible unless we have a fixed reservation.
+ */
+int flat_tape_can_move(const struct tape_t *const tape, const int delta)
+{
+	const struct flat_tape_t *const data = tape->data;
+	const int mem_pos = data->rel_pos + data->init_pos + delta;
+	return data->backing == FLAT_HEAP || (0 <= mem_pos && mem_pos < data->len);
+}
+
+/*
+ * Moves left or right in the flat tape, growing the tape as required if we move outside,
+ * see flat_tape_grow().
  */
 void flat_tape_move(struct tape_t *const tape, int delta)
 {
@@ -122,28 +274,14 @@ void flat_tape_move(struct tape_t *const tape, int delta)
 	const int mem_pos = data->rel_pos + data->init_pos;
 	if (mem_pos + delta < 0 || mem_pos + delta >= data->len) {
 		// Ran out of tape, allocate more
-		const int old_len = data->len;
-		const int new_len = old_len * 2;
-		sym_t *const new_syms = malloc(sizeof *new_syms * (size_t) new_len);
-
-		/* Place data in the "middle" of the tape, growing it by about 50% on both sides
-		 * We need to increment the offset by half of the old length, which may be one unit
-		 * "too little" if the old_len was not divisible by two, but as long as we copy
-		 * everything correctly, this does not matter, as next time the tape will move by
-		 * exactly half of new_len.
-		 */
-		const int offset = old_len / 2;
-		memset(new_syms, 0, (size_t) offset * sizeof *new_syms);
-		memcpy(new_syms + (ptrdiff_t) offset, data->syms, (size_t) old_len * sizeof *new_syms);
-		memset(new_syms + (ptrdiff_t) (offset + old_len), 0, (size_t) (new_len - old_len - offset) * sizeof *new_syms);
-
-		data->len = new_len;
-		free(data->syms);
-		data->syms = new_syms;
-		data->init_pos += offset;
+		flat_tape_grow(data, delta);
 	}
 
 	data->rel_pos += delta;
+	if (data->rel_pos < data->min_pos)
+		data->min_pos = data->rel_pos;
+	if (data->rel_pos > data->max_pos)
+		data->max_pos = data->rel_pos;
 	assert(0 <= data->rel_pos + data->init_pos && data->rel_pos + data->init_pos < data->len);
 }
 
@@ -156,6 +294,65 @@ void flat_tape_write(struct tape_t *const tape, const sym_t sym)
 	data->syms[data->rel_pos + data->init_pos] = sym;
 }
 
+/*
+ * Gives read access to the visited part of the tape, e.g. for deciders. Returns a pointer p
+ * such that p[i] is the symbol at relative position i, for min_pos <= i <= max_pos. The
+ * pointer is only valid until the tape is written or moved.
+ */
+const sym_t *flat_tape_span(const struct tape_t *const tape, int *const pos, int *const min_pos, int *const max_pos)
+{
+	assert(tape->move == flat_tape_move);
+	const struct flat_tape_t *const data = tape->data;
+	*pos = data->rel_pos;
+	*min_pos = data->min_pos;
+	*max_pos = data->max_pos;
+	return data->syms + data->init_pos;
+}
+
+/*
+ * Gives the runs of the visited span of the tape, see tape_t.
+ */
+int flat_tape_runs(const struct tape_t *const tape, const tape_run_fn_t fn, void *const ctx, int *const head)
+{
+	const struct flat_tape_t *const data = tape->data;
+	const sym_t *const syms = data->syms + data->init_pos;
+	int pos = data->min_pos;
+	while (pos <= data->max_pos) {
+		const int start = pos;
+		while (pos <= data->max_pos && syms[pos] == syms[start])
+			pos++;
+		fn(ctx, syms[start], pos - start);
+	}
+	*head = data->rel_pos;
+	return data->min_pos;
+}
+
+/*
+ * Copies a range of the tape into buf, see tape_t. Only the visited span can be nonzero, so
+ * we copy the part of the range within it and clear the rest.
+ */
+void flat_tape_read_range(const struct tape_t *const tape, const int from, const int len, sym_t *const buf)
+{
+	const struct flat_tape_t *const data = tape->data;
+	assert(len >= 0);
+	memset(buf, 0, (size_t) len * sizeof *buf);
+	const int lo = maximum(from, data->min_pos);
+	const int hi = (long long) from + len - 1 < data->max_pos ? from + len - 1 : data->max_pos;
+	if (lo <= hi)
+		memcpy(buf + (lo - from), data->syms + data->init_pos + lo, (size_t) (hi - lo + 1) * sizeof *buf);
+}
+
+/*
+ * Gives the visited span and the head position, see tape_t.
+ */
+int flat_tape_bounds(const struct tape_t *const tape, int *const min_pos, int *const max_pos)
+{
+	const struct flat_tape_t *const data = tape->data;
+	*min_pos = data->min_pos;
+	*max_pos = data->max_pos;
+	return data->rel_pos;
+}
+
 /*
  * Reads a symbol from the tape.
  */
@@ -165,15 +362,198 @@ sym_t flat_tape_read(const struct tape_t *const tape)
 	return data->syms[data->rel_pos + data->init_pos];
 }
 
+/*
+ * Runs the given TM directly on a flat tape for at most max_steps steps, bypassing the
+ * struct tape_t function pointers, using hot_tab, the hot encoding of def from tm_def_hot().
+ * The head position and state are kept in locals and written back before returning, and we
+ * only call flat_tape_grow() when we are about to run off the edge of the allocated memory.
+ * Returns the number of steps taken, which is less than
+ * max_steps if we halted or would have moved outside of a reserved tape (and in that case
+ * the step is not taken).
+ */
+step_t flat_tape_run(struct tape_t *const tape, const struct tm_def_t *const def, const tm_hot_t *const hot_tab, state_t *const state, const step_t max_steps)
+{
+	struct flat_tape_t *const data = tape->data;
+	assert(tape->move == flat_tape_move);
+
+	const int n_syms = def->n_syms;
+	const int halt_row = def->n_states * n_syms;
+
+	sym_t *syms = data->syms;
+	int len = data->len;
+	int mem_pos = data->rel_pos + data->init_pos;
+	int min_pos = data->min_pos + data->init_pos;
+	int max_pos = data->max_pos + data->init_pos;
+	int row = *state * n_syms;
+
+	step_t steps = 0;
+	while (steps < max_steps && row < halt_row) {
+		const tm_hot_t hot = hot_tab[row + syms[mem_pos]];
+		const int delta = HOT_DELTA(hot);
+
+		if (mem_pos + delta < 0 || mem_pos + delta >= len) {
+			if (data->backing != FLAT_HEAP)
+				break;
+			// Grow the tape, then reload our locals
+			data->rel_pos = mem_pos - data->init_pos;
+			data->min_pos = min_pos - data->init_pos;
+			data->max_pos = max_pos - data->init_pos;
+			flat_tape_grow(data, delta);
+			syms = data->syms;
+			len = data->len;
+			mem_pos = data->rel_pos + data->init_pos;
+			min_pos = data->min_pos + data->init_pos;
+			max_pos = data->max_pos + data->init_pos;
+		}
+
+		syms[mem_pos] = HOT_SYM(hot);
+		mem_pos += delta;
+		if (mem_pos < min_pos)
+			min_pos = mem_pos;
+		if (mem_pos > max_pos)
+			max_pos = mem_pos;
+		row = HOT_ROW(hot);
+		steps++;
+	}
+
+	data->rel_pos = mem_pos - data->init_pos;
+	data->min_pos = min_pos - data->init_pos;
+	data->max_pos = max_pos - data->init_pos;
+	*state = (state_t) (row / n_syms);
+	return steps;
+}
+
+/*
+ * Running off the edge of the tape is rare, so the threaded handlers spill their locals, grow
+ * the tape like flat_tape_move() would and reload them. A reserved tape stops before the step.
+ */
+#define FLAT_THREAD_EDGE(delta) \
+	if (mem_pos + (delta) < 0 || mem_pos + (delta) >= data->len) { \
+		if (data->backing != FLAT_HEAP) \
+			goto out; \
+		data->rel_pos = mem_pos - data->init_pos; \
+		data->min_pos = min_pos - data->init_pos; \
+		data->max_pos = max_pos - data->init_pos; \
+		flat_tape_grow(data, (delta)); \
+		syms = data->syms; \
+		mem_pos = data->rel_pos + data->init_pos; \
+		min_pos = data->min_pos + data->init_pos; \
+		max_pos = data->max_pos + data->init_pos; \
+	}
+
+// The threaded runner jumps through label addresses, a GNU C extension
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wgnu-label-as-value"
+
+/*
+ * The threaded runner behind flat_tape_thread() and flat_tape_thread_handlers(). If handlers
+ * is given we only store the addresses of our handlers there, as they can not be taken from
+ * outside of this function. Each handler writes, moves, counts down the budget and then
+ * jumps to the handler for the symbol under the head, see struct tm_thread_op_t.
+ */
+static step_t flat_thread_loop(struct tape_t *const tape, const struct tm_thread_op_t *const code, const int n_syms, state_t *const state, const step_t max_steps, const void *const **const handlers)
+{
+	static const void *const labels[N_THREAD_HANDLERS] = {&&op_left, &&op_right, &&op_left_halt, &&op_right_halt};
+	if (handlers) {
+		*handlers = labels;
+		return 0;
+	}
+
+	struct flat_tape_t *const data = tape->data;
+	sym_t *syms = data->syms;
+	int mem_pos = data->rel_pos + data->init_pos;
+	int min_pos = data->min_pos + data->init_pos;
+	int max_pos = data->max_pos + data->init_pos;
+	step_t budget = max_steps;
+	const struct tm_thread_op_t *op = code + *state * n_syms + syms[mem_pos];
+	state_t halted = 0;
+	if (budget <= 0)
+		goto out;
+	goto *op->handler;
+
+op_left:
+	FLAT_THREAD_EDGE(-1)
+	syms[mem_pos--] = op->sym;
+	if (mem_pos < min_pos)
+		min_pos = mem_pos;
+	op = op->next + syms[mem_pos];
+	if (--budget == 0)
+		goto out;
+	goto *op->handler;
+
+op_right:
+	FLAT_THREAD_EDGE(1)
+	syms[mem_pos++] = op->sym;
+	if (mem_pos > max_pos)
+		max_pos = mem_pos;
+	op = op->next + syms[mem_pos];
+	if (--budget == 0)
+		goto out;
+	goto *op->handler;
+
+op_left_halt:
+	FLAT_THREAD_EDGE(-1)
+	syms[mem_pos--] = op->sym;
+	if (mem_pos < min_pos)
+		min_pos = mem_pos;
+	halted = 1;
+	budget--;
+	goto out;
+
+op_right_halt:
+	FLAT_THREAD_EDGE(1)
+	syms[mem_pos++] = op->sym;
+	if (mem_pos > max_pos)
+		max_pos = mem_pos;
+	halted = 1;
+	budget--;
+	goto out;
+
+out:
+	data->rel_pos = mem_pos - data->init_pos;
+	data->min_pos = min_pos - data->init_pos;
+	data->max_pos = max_pos - data->init_pos;
+	// Unless we halted, op is the next transition, in row next_state * n_syms
+	*state = halted ? op->state : (state_t) ((op - code) / n_syms);
+	return max_steps - budget;
+}
+
+#pragma clang diagnostic pop
+
+/*
+ * The handlers of flat_tape_thread(), to build its code with tm_def_thread().
+ */
+const void *const *flat_tape_thread_handlers(void)
+{
+	const void *const *handlers = NULL;
+	(void) flat_thread_loop(NULL, NULL, 0, NULL, 0, &handlers);
+	return handlers;
+}
+
+/*
+ * Runs threaded code (see struct tm_thread_op_t) built for flat_tape_thread_handlers() directly
+ * on a flat tape for at most max_steps steps. Unlike flat_tape_run() each step is one indirect
+ * jump to the handler of the transition, with no loop or decoding in between. The machine must
+ * not have halted yet. Returns the number of steps taken.
+ */
+step_t flat_tape_thread(struct tape_t *const tape, const struct tm_def_t *const def, const struct tm_thread_op_t *const code, state_t *const state, const step_t max_steps)
+{
+	assert(tape->move == flat_tape_move);
+	assert(*state < def->n_states);
+	return flat_thread_loop(tape, code, def->n_syms, state, max_steps, NULL);
+}
+
 /*
  * Counts the number of nonzero symbols in a flat tape, for use in e.g. the BB sigma function.
- * This requires a full scan of the tape. We could perhapst add variables for the leftmost and
- * rightmost position visited, but this is probably really fast.
+ * Only the visited span of the tape can contain nonzero symbols, so we only scan that.
  */
-static int flat_tape_count_nonzero(const struct flat_tape_t *const tape) {
+int flat_tape_count_nonzero(const struct tape_t *const tape)
+{
+	assert(tape->move == flat_tape_move);
+	const struct flat_tape_t *const data = tape->data;
 	int nonzero = 0;
-	for (int i = 0; i < tape->len; i++) {
-		if (tape->syms[i] != 0)
+	for (int i = data->min_pos + data->init_pos; i <= data->max_pos + data->init_pos; i++) {
+		if (data->syms[i] != 0)
 			nonzero++;
 	}
 	return nonzero;
@@ -3,14 +3,50 @@
 #define TM_TAPE_FLAT_H
 
 #include "tape.h"
+#include "tm_def.h"
 #include "util.h"
 
-struct tape_t *flat_tape_init(unsigned sym_bits, int len, int init_pos);
+/*
+ * How the memory of a flat tape is allocated.
+ */
+enum flat_backing_t {
+	FLAT_HEAP = 0,		// allocated with malloc() and grown when we run off the edge
+	FLAT_MMAP,			// a fixed virtual memory reservation of len symbols, which never grows
+	FLAT_MMAP_HUGE,		// same as FLAT_MMAP, but asks for transparent huge pages
+};
+
+/*
+ * Counts of how a flat tape grew, which are only kept with -DTM_STATS.
+ */
+struct flat_stats_t {
+	step_t grows;			// number of times the tape was reallocated
+	step_t bytes_copied;	// bytes moved by those reallocations (at most, for realloc())
+};
+
+// Initial length of a flat tape that is reused for many TMs, e.g. by each worker of a batch,
+// which grows as needed and keeps its memory when reset
+#define FLAT_REUSE_LEN 1024
+
+struct tape_t *flat_tape_init(unsigned sym_bits, int len, int init_pos, enum flat_backing_t backing);
+struct tape_t *flat_tape_init_any(void);
 
 void flat_tape_free(struct tape_t *tape);
 sym_t flat_tape_read(const struct tape_t *tape);
 void flat_tape_write(struct tape_t *tape, sym_t sym);
 void flat_tape_move(struct tape_t *tape, int delta);
+int flat_tape_can_move(const struct tape_t *tape, int delta);
+void flat_tape_reset(struct tape_t *tape);
+int flat_tape_runs(const struct tape_t *tape, tape_run_fn_t fn, void *ctx, int *head);
+void flat_tape_read_range(const struct tape_t *tape, int from, int len, sym_t *buf);
+int flat_tape_bounds(const struct tape_t *tape, int *min_pos, int *max_pos);
+void flat_tape_stats(const struct tape_t *tape, struct flat_stats_t *stats);
+void flat_tape_print_stats(const struct tape_t *tape);
+const sym_t *flat_tape_span(const struct tape_t *tape, int *pos, int *min_pos, int *max_pos);
+int flat_tape_count_nonzero(const struct tape_t *tape);
+
+step_t flat_tape_run(struct tape_t *tape, const struct tm_def_t *def, const tm_hot_t *hot_tab, state_t *state, step_t max_steps);
+const void *const *flat_tape_thread_handlers(void);
+step_t flat_tape_thread(struct tape_t *tape, const struct tm_def_t *def, const struct tm_thread_op_t *code, state_t *state, step_t max_steps);
 
 struct flat_tape_t;
 void flat_tape_print(const struct flat_tape_t *tape, int ctx, state_t state, int directed);
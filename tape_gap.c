@@ -0,0 +1,411 @@
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tape.h"
+#include "tm_def.h"
+#include "util.h"
+
+#include "tape_gap.h"
+
+// Initial number of runs that fit in the gap buffer
+#define GAP_INIT_CAP 64
+
+/*
+ * A run of repeating symbols, stored by value in the gap buffer.
+ */
+struct gap_run_t {
+	sym_t sym;	// the symbol
+	int len;	// length of the run, always positive
+};
+
+/*
+ * A run-length encoding based tape representation, like the RLE tape, but where the runs
+ * are stored in one contiguous array with a "gap" at the head. The runs to the left of the
+ * current run are stored at the start of the array, with the nearest one last, and the runs
+ * to the right are stored at the end of the array, with the nearest one first. Moving
+ * between runs then just moves one run across the gap, and no pointers are chased.
+ */
+struct gap_tape_t {
+	struct gap_run_t *runs;		// the gap buffer
+	int cap;					// capacity of the gap buffer
+	int n_left;					// number of runs left of the current run, in runs[0 .. n_left - 1]
+	int n_right;				// number of runs right of the current run, in runs[cap - n_right .. cap - 1]
+	struct gap_run_t curr;		// the current run, which is not stored in the buffer
+	int rle_pos;				// position within the current run
+	int rel_pos;				// relative position (0 = starting)
+	int min_pos;				// relative position of the leftmost cell of the runs
+	int max_pos;				// relative position of the rightmost cell of the runs
+	unsigned sym_bits;			// the width of one symbol in bits (must be <= MAX_SYM_BITS)
+	// invariants: n_left + n_right <= cap, 0 <= rle_pos < curr.len
+};
+
+/*
+ * Frees a gap tape together with its buffer.
+ */
+void gap_tape_free(struct tape_t *const tape)
+{
+	struct gap_tape_t *const data = tape->data;
+	free(data->runs);
+	free(data);
+	free(tape);
+}
+
+/*
+ * Constructs a new blank tape using a gap buffer RLE representation, for
+ * a given symbol width.
+ */
+struct tape_t *gap_tape_init(const unsigned sym_bits)
+{
+	assert(1 <= sym_bits && sym_bits <= MAX_SYM_BITS);
+
+	struct gap_tape_t *const data = malloc(sizeof *data);
+	data->runs = malloc(GAP_INIT_CAP * sizeof *data->runs);
+	data->cap = GAP_INIT_CAP;
+	data->n_left = 0;
+	data->n_right = 0;
+	data->curr.sym = 0;
+	data->curr.len = 1;
+	data->rle_pos = 0;
+	data->rel_pos = 0;
+	data->min_pos = 0;
+	data->max_pos = 0;
+	data->sym_bits = sym_bits;
+
+	struct tape_t *const tape = malloc(sizeof *tape);
+	tape->data = data;
+	tape->free = gap_tape_free;
+	tape->read = gap_tape_read;
+	tape->write = gap_tape_write;
+	tape->move = gap_tape_move;
+	tape->can_move = NULL;
+	tape->reset = gap_tape_reset;
+	tape->runs = gap_tape_runs;
+	tape->read_range = gap_tape_read_range;
+	tape->bounds = gap_tape_bounds;
+	return tape;
+}
+
+/*
+ * Clears the gap tape, keeping the buffer.
+ */
+void gap_tape_reset(struct tape_t *const tape)
+{
+	struct gap_tape_t *const data = tape->data;
+	data->n_left = 0;
+	data->n_right = 0;
+	data->curr.sym = 0;
+	data->curr.len = 1;
+	data->rle_pos = 0;
+	data->rel_pos = 0;
+	data->min_pos = 0;
+	data->max_pos = 0;
+}
+
+/*
+ * Gives all runs of the tape, see tape_t.
+ */
+int gap_tape_runs(const struct tape_t *const tape, const tape_run_fn_t fn, void *const ctx, int *const head)
+{
+	const struct gap_tape_t *const data = tape->data;
+	int first = data->rel_pos - data->rle_pos;
+	for (int i = 0; i < data->n_left; i++) {
+		first -= data->runs[i].len;
+		fn(ctx, data->runs[i].sym, data->runs[i].len);
+	}
+	fn(ctx, data->curr.sym, data->curr.len);
+	for (int i = data->cap - data->n_right; i < data->cap; i++)
+		fn(ctx, data->runs[i].sym, data->runs[i].len);
+	*head = data->rel_pos;
+	return first;
+}
+
+/*
+ * The k-th run of the tape from the left, where the current run is number n_left.
+ */
+static const struct gap_run_t *gap_run_at(const struct gap_tape_t *const data, const int k)
+{
+	if (k < data->n_left)
+		return data->runs + k;
+	if (k == data->n_left)
+		return &data->curr;
+	return data->runs + (data->cap - data->n_right + k - data->n_left - 1);
+}
+
+/*
+ * Copies a range of the tape into buf, see tape_t. We step back from the current run to the
+ * first one overlapping the range, and then fill in each run until the end of the range.
+ */
+void gap_tape_read_range(const struct tape_t *const tape, const int from, const int len, sym_t *const buf)
+{
+	const struct gap_tape_t *const data = tape->data;
+	assert(len >= 0);
+	memset(buf, 0, (size_t) len * sizeof *buf);
+
+	int k = data->n_left;
+	long long start = data->rel_pos - data->rle_pos;
+	while (start > from && k > 0)
+		start -= gap_run_at(data, --k)->len;
+	const long long end = (long long) from + len;
+	for (; k <= data->n_left + data->n_right && start < end; k++) {
+		const struct gap_run_t *const run = gap_run_at(data, k);
+		const long long lo = start > from ? start : from;
+		const long long hi = start + run->len < end ? start + run->len : end;
+		if (run->sym != 0 && lo < hi)
+			memset(buf + (lo - from), run->sym, (size_t) (hi - lo) * sizeof *buf);
+		start += run->len;
+	}
+}
+
+/*
+ * Gives the span covered by the runs and the head position, see tape_t.
+ */
+int gap_tape_bounds(const struct tape_t *const tape, int *const min_pos, int *const max_pos)
+{
+	const struct gap_tape_t *const data = tape->data;
+	*min_pos = data->min_pos;
+	*max_pos = data->max_pos;
+	return data->rel_pos;
+}
+
+/*
+ * Makes sure that there is room for at least n more runs in the gap, doubling the
+ * buffer as required. The runs to the right are moved to the new end of the buffer.
+ */
+static void gap_reserve(struct gap_tape_t *const data, const int n)
+{
+	if (data->n_left + data->n_right + n <= data->cap)
+		return;
+
+	const int old_cap = data->cap;
+	const int new_cap = old_cap * 2;
+	assert(data->n_left + data->n_right + n <= new_cap);
+	data->runs = realloc(data->runs, (size_t) new_cap * sizeof *data->runs);
+	memmove(data->runs + (ptrdiff_t) (new_cap - data->n_right),
+		data->runs + (ptrdiff_t) (old_cap - data->n_right),
+		(size_t) data->n_right * sizeof *data->runs);
+	data->cap = new_cap;
+}
+
+// The nearest runs on either side of the current run, only valid if n_left or n_right > 0
+#define GAP_LEFT(data) ((data)->runs[(data)->n_left - 1])
+#define GAP_RIGHT(data) ((data)->runs[(data)->cap - (data)->n_right])
+
+static void gap_push_left(struct gap_tape_t *const data, const struct gap_run_t run)
+{
+	assert(data->n_left + data->n_right < data->cap);
+	data->runs[data->n_left++] = run;
+}
+
+static void gap_push_right(struct gap_tape_t *const data, const struct gap_run_t run)
+{
+	assert(data->n_left + data->n_right < data->cap);
+	data->n_right++;
+	GAP_RIGHT(data) = run;
+}
+
+/*
+ * Prints an entire gap tape, in the same format as rle_tape_print().
+ */
+void gap_tape_print(const struct gap_tape_t *const tape, const state_t state, const int directed)
+{
+	printf("... ");
+	for (int i = 0; i < tape->n_left; i++) {
+		sym_bin_print(tape->runs[i].sym, tape->sym_bits);
+		printf("^%d ", tape->runs[i].len);
+	}
+
+	// Print tape head within the current run
+	// NB here we use '_' instead of ' ' for separators
+	const int left_len = tape->rle_pos;
+	const int right_len = tape->curr.len - tape->rle_pos - 1;
+	if (left_len > 0) {
+		sym_bin_print(tape->curr.sym, tape->sym_bits);
+		printf("^%d_", left_len);
+	}
+	print_state_and_sym(state, tape->curr.sym, tape->sym_bits, directed);
+	printf("%c", right_len > 0 ? '_' : ' ');
+	if (right_len > 0) {
+		sym_bin_print(tape->curr.sym, tape->sym_bits);
+		printf("^%d ", right_len);
+	}
+
+	for (int i = tape->cap - tape->n_right; i < tape->cap; i++) {
+		sym_bin_print(tape->runs[i].sym, tape->sym_bits);
+		printf("^%d ", tape->runs[i].len);
+	}
+	printf("...\n");
+}
+
+/*
+ * Writes to the current run, merging with or splitting it as appropriate,
+ * in the same way as rle_tape_write().
+ */
+void gap_tape_write(struct tape_t *const tape, const sym_t sym)
+{
+	struct gap_tape_t *const data = tape->data;
+
+	if (data->curr.sym == sym) {
+		// Nothing to do
+		return;
+	}
+
+	if (data->curr.len == 1) {
+		// Replace the symbol, and merge with the neighbors if they now match
+		data->curr.sym = sym;
+		if (data->n_left > 0 && GAP_LEFT(data).sym == sym) {
+			data->rle_pos = GAP_LEFT(data).len;
+			data->curr.len += GAP_LEFT(data).len;
+			data->n_left--;
+		}
+		if (data->n_right > 0 && GAP_RIGHT(data).sym == sym) {
+			data->curr.len += GAP_RIGHT(data).len;
+			data->n_right--;
+		}
+		return;
+	}
+
+	gap_reserve(data, 2);
+
+	if (data->rle_pos == 0 && data->n_left > 0 && GAP_LEFT(data).sym == sym) {
+		// Extend left neighbor and make it the current run
+		data->curr.len--;
+		gap_push_right(data, data->curr);
+		data->curr = GAP_LEFT(data);
+		data->n_left--;
+		data->curr.len++;
+		data->rle_pos = data->curr.len - 1;
+		return;
+	}
+
+	if (data->rle_pos == data->curr.len - 1 && data->n_right > 0 && GAP_RIGHT(data).sym == sym) {
+		// Extend right neighbor and make it the current run
+		data->curr.len--;
+		gap_push_left(data, data->curr);
+		data->curr = GAP_RIGHT(data);
+		data->n_right--;
+		data->curr.len++;
+		data->rle_pos = 0;
+		return;
+	}
+
+	// Split into left / new middle / right
+	const int left_len = data->rle_pos;
+	const int right_len = data->curr.len - data->rle_pos - 1;
+	if (left_len > 0) {
+		const struct gap_run_t left = {data->curr.sym, left_len};
+		gap_push_left(data, left);
+	}
+	if (right_len > 0) {
+		const struct gap_run_t right = {data->curr.sym, right_len};
+		gap_push_right(data, right);
+	}
+	data->curr.sym = sym;
+	data->curr.len = 1;
+	data->rle_pos = 0;
+}
+
+/*
+ * Reads a symbol from the gap tape.
+ */
+sym_t gap_tape_read(const struct tape_t *const tape)
+{
+	const struct gap_tape_t *const data = tape->data;
+	return data->curr.sym;
+}
+
+/*
+ * Moves within the current run, or moves the current run across the gap and makes its
+ * neighbor the current run. At the edges of the tape we extend a run of zeros or
+ * create a new one, in the same way as rle_tape_move().
+ */
+void gap_tape_move(struct tape_t *const tape, const int delta)
+{
+	struct gap_tape_t *const data = tape->data;
+
+	// This defines the min/max allowed tape head positions, namely INT_MIN+1 and INT_MAX-1
+	assert(delta == -1 || delta == 1);
+	if (delta == -1)
+		assert(INT_MIN + 2 < data->rel_pos && data->rel_pos < INT_MAX - 1);
+	else
+		assert(INT_MIN + 1 < data->rel_pos && data->rel_pos < INT_MAX - 2);
+
+	data->rel_pos += delta;
+
+	const int new_pos = data->rle_pos + delta;
+	if (0 <= new_pos && new_pos < data->curr.len) {
+		// Simply move within the run
+		data->rle_pos = new_pos;
+		return;
+	}
+
+	if (delta == -1) {
+		if (data->n_left == 0 && data->curr.sym == 0) {
+			// Extend the current run of zeros by one
+			data->curr.len++;
+			data->min_pos = data->rel_pos;
+			return;
+		}
+		gap_reserve(data, 1);
+		gap_push_right(data, data->curr);
+		if (data->n_left > 0) {
+			data->curr = GAP_LEFT(data);
+			data->n_left--;
+		} else {
+			// End of tape, create a new zero
+			data->curr.sym = 0;
+			data->curr.len = 1;
+			data->min_pos = data->rel_pos;
+		}
+		data->rle_pos = data->curr.len - 1;
+	} else {
+		if (data->n_right == 0 && data->curr.sym == 0) {
+			// Extend the current run of zeros by one
+			data->curr.len++;
+			data->rle_pos++;
+			data->max_pos = data->rel_pos;
+			return;
+		}
+		gap_reserve(data, 1);
+		gap_push_left(data, data->curr);
+		if (data->n_right > 0) {
+			data->curr = GAP_RIGHT(data);
+			data->n_right--;
+		} else {
+			// End of tape, create a new zero
+			data->curr.sym = 0;
+			data->curr.len = 1;
+			data->max_pos = data->rel_pos;
+		}
+		data->rle_pos = 0;
+	}
+}
+
+/*
+ * Runs the given TM directly on a gap tape for at most max_steps steps, calling the gap tape
+ * functions directly instead of through the struct tape_t function pointers. Returns the
+ * number of steps taken.
+ */
+step_t gap_tape_run(struct tape_t *const tape, const struct tm_def_t *const def, const tm_hot_t *const hot_tab, state_t *const state, const step_t max_steps)
+{
+	assert(tape->move == gap_tape_move);
+
+	const int n_syms = def->n_syms;
+	const int halt_row = def->n_states * n_syms;
+
+	int row = *state * n_syms;
+	step_t steps = 0;
+	while (steps < max_steps && row < halt_row) {
+		const tm_hot_t hot = hot_tab[row + gap_tape_read(tape)];
+		gap_tape_write(tape, HOT_SYM(hot));
+		gap_tape_move(tape, HOT_DELTA(hot));
+		row = HOT_ROW(hot);
+		steps++;
+	}
+
+	*state = (state_t) (row / n_syms);
+	return steps;
+}
@@ -0,0 +1,25 @@
+// Run Length Encoding tape stored in a gap buffer
+#ifndef TM_TAPE_GAP_H
+#define TM_TAPE_GAP_H
+
+#include "tape.h"
+#include "tm_def.h"
+#include "util.h"
+
+struct tape_t *gap_tape_init(unsigned sym_bits);
+
+void gap_tape_free(struct tape_t *tape);
+sym_t gap_tape_read(const struct tape_t *tape);
+void gap_tape_write(struct tape_t *tape, sym_t sym);
+void gap_tape_move(struct tape_t *tape, int delta);
+void gap_tape_reset(struct tape_t *tape);
+int gap_tape_runs(const struct tape_t *tape, tape_run_fn_t fn, void *ctx, int *head);
+void gap_tape_read_range(const struct tape_t *tape, int from, int len, sym_t *buf);
+int gap_tape_bounds(const struct tape_t *tape, int *min_pos, int *max_pos);
+
+step_t gap_tape_run(struct tape_t *tape, const struct tm_def_t *def, const tm_hot_t *hot_tab, state_t *state, step_t max_steps);
+
+struct gap_tape_t;
+void gap_tape_print(const struct gap_tape_t *tape, state_t state, int directed);
+
+#endif
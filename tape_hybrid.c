@@ -0,0 +1,260 @@
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tape.h"
+#include "tape_flat.h"
+#include "tape_rle.h"
+#include "tm_def.h"
+#include "util.h"
+
+#include "tape_hybrid.h"
+
+// Tapes with fewer cells than this stay flat, as they fit in the cache anyway
+#define HYBRID_MIN_CELLS 1024
+// Switch from flat to RLE once the runs are at least this long on average
+#define HYBRID_RLE_RUN_LEN 16
+// Switch from RLE back to flat once the runs are shorter than this on average
+#define HYBRID_FLAT_RUN_LEN 4
+// Least number of moves between two looks at the shape of the tape
+#define HYBRID_MIN_INTERVAL (1 << 16)
+// Look at the shape of the tape again after this many moves per cell, so that looking (and
+// switching, which is linear in the number of cells as well) costs at most one part in this
+#define HYBRID_INTERVAL_FACTOR 4
+
+/*
+ * A tape that holds both a flat and an RLE tape, of which only the current one has the
+ * contents. Every so often we look at the average run length, and when the other tape would be
+ * cheaper we copy the contents over and continue on that one, e.g. when a machine starts out
+ * with a dense tape and later sweeps over long uniform runs. The thresholds for switching
+ * back and forth are far apart, so that we don't keep switching for the same shape.
+ */
+struct hybrid_tape_t {
+	struct tape_t *flat;		// the flat tape, stale unless current
+	struct tape_t *rle;			// the RLE tape, stale unless current
+	struct tape_t *curr;		// either flat or rle
+	step_t until_check;			// moves left before we look at the shape of the tape again
+	step_t switches;			// number of times we switched since the last reset
+};
+
+/*
+ * The number of cells and runs of a tape, counted through its runs method.
+ */
+struct hybrid_shape_t {
+	step_t cells;
+	step_t runs;
+};
+
+/*
+ * Where we are when copying the contents of one tape to another through the runs method.
+ */
+struct hybrid_copy_t {
+	struct tape_t *tape;	// the tape we copy to
+	int pos;				// the position of the head of that tape
+	int next;				// the position of the next cell to copy
+};
+
+void hybrid_tape_free(struct tape_t *const tape)
+{
+	struct hybrid_tape_t *const data = tape->data;
+	data->flat->free(data->flat);
+	data->rle->free(data->rle);
+	free(data);
+	free(tape);
+}
+
+/*
+ * Constructs a new blank hybrid tape for a given symbol width, which starts out flat.
+ */
+struct tape_t *hybrid_tape_init(const unsigned sym_bits)
+{
+	assert(1 <= sym_bits && sym_bits <= MAX_SYM_BITS);
+
+	struct hybrid_tape_t *const data = malloc(sizeof *data);
+	data->flat = flat_tape_init(sym_bits, 16, 8, FLAT_HEAP);
+	data->rle = rle_tape_init(sym_bits);
+	data->curr = data->flat;
+	data->until_check = HYBRID_MIN_INTERVAL;
+	data->switches = 0;
+
+	struct tape_t *const tape = malloc(sizeof *tape);
+	tape->data = data;
+	tape->free = hybrid_tape_free;
+	tape->read = hybrid_tape_read;
+	tape->write = hybrid_tape_write;
+	tape->move = hybrid_tape_move;
+	tape->can_move = NULL;
+	tape->reset = hybrid_tape_reset;
+	tape->runs = hybrid_tape_runs;
+	tape->read_range = hybrid_tape_read_range;
+	tape->bounds = hybrid_tape_bounds;
+	return tape;
+}
+
+/*
+ * Clears the tape, which starts out flat again.
+ */
+void hybrid_tape_reset(struct tape_t *const tape)
+{
+	struct hybrid_tape_t *const data = tape->data;
+	data->curr->reset(data->curr);
+	if (data->curr != data->flat) {
+		data->flat->reset(data->flat);
+		data->curr = data->flat;
+	}
+	data->until_check = HYBRID_MIN_INTERVAL;
+	data->switches = 0;
+}
+
+static void hybrid_count_run(void *const ctx, const sym_t sym, const int len)
+{
+	struct hybrid_shape_t *const shape = ctx;
+	(void) sym;
+	shape->runs++;
+	shape->cells += len;
+}
+
+static void hybrid_copy_run(void *const ctx, const sym_t sym, const int len)
+{
+	struct hybrid_copy_t *const copy = ctx;
+	tape_load_run(copy->tape, &copy->pos, copy->next, sym, len);
+	copy->next += len;
+}
+
+/*
+ * Copies the contents and head position of the current tape to the other one, which becomes
+ * the current tape. The runs are given to us before the runs method returns where they start,
+ * so the caller has to pass that in first.
+ */
+static void hybrid_tape_switch(struct hybrid_tape_t *const data, const int first)
+{
+	struct tape_t *const from = data->curr;
+	struct tape_t *const to = from == data->flat ? data->rle : data->flat;
+	to->reset(to);
+
+	struct hybrid_copy_t copy = {to, 0, first};
+	int head;
+	(void) from->runs(from, hybrid_copy_run, &copy, &head);
+	tape_move_to(to, &copy.pos, head);
+
+	data->curr = to;
+	data->switches++;
+}
+
+/*
+ * Looks at the average run length of the current tape, and switches to the other one if it
+ * would be cheaper. Then decides when to look again, see HYBRID_INTERVAL_FACTOR.
+ */
+static void hybrid_tape_check(struct hybrid_tape_t *const data)
+{
+	struct hybrid_shape_t shape = {0, 0};
+	int head;
+	const int first = data->curr->runs(data->curr, hybrid_count_run, &shape, &head);
+
+	if (data->curr == data->flat) {
+		if (shape.cells >= HYBRID_MIN_CELLS && shape.cells >= HYBRID_RLE_RUN_LEN * shape.runs)
+			hybrid_tape_switch(data, first);
+	} else {
+		if (shape.cells < HYBRID_MIN_CELLS / 2 || shape.cells < HYBRID_FLAT_RUN_LEN * shape.runs)
+			hybrid_tape_switch(data, first);
+	}
+	const step_t interval = HYBRID_INTERVAL_FACTOR * shape.cells;
+	data->until_check = interval > HYBRID_MIN_INTERVAL ? interval : HYBRID_MIN_INTERVAL;
+}
+
+sym_t hybrid_tape_read(const struct tape_t *const tape)
+{
+	const struct hybrid_tape_t *const data = tape->data;
+	return data->curr->read(data->curr);
+}
+
+void hybrid_tape_write(struct tape_t *const tape, const sym_t sym)
+{
+	struct hybrid_tape_t *const data = tape->data;
+	data->curr->write(data->curr, sym);
+}
+
+/*
+ * Moves on the current tape, and counts down to the next look at the shape of the tape.
+ */
+void hybrid_tape_move(struct tape_t *const tape, const int delta)
+{
+	struct hybrid_tape_t *const data = tape->data;
+	data->curr->move(data->curr, delta);
+	if (--data->until_check <= 0)
+		hybrid_tape_check(data);
+}
+
+/*
+ * Gives the runs of the current tape, see tape_t.
+ */
+int hybrid_tape_runs(const struct tape_t *const tape, const tape_run_fn_t fn, void *const ctx, int *const head)
+{
+	const struct hybrid_tape_t *const data = tape->data;
+	return data->curr->runs(data->curr, fn, ctx, head);
+}
+
+/*
+ * Copies a range of the current tape into buf, see tape_t.
+ */
+void hybrid_tape_read_range(const struct tape_t *const tape, const int from, const int len, sym_t *const buf)
+{
+	const struct hybrid_tape_t *const data = tape->data;
+	data->curr->read_range(data->curr, from, len, buf);
+}
+
+/*
+ * Gives the span and head position of the current tape, see tape_t.
+ */
+int hybrid_tape_bounds(const struct tape_t *const tape, int *const min_pos, int *const max_pos)
+{
+	const struct hybrid_tape_t *const data = tape->data;
+	return data->curr->bounds(data->curr, min_pos, max_pos);
+}
+
+/*
+ * Returns 1 if the tape currently uses the RLE representation, and 0 if it is flat.
+ */
+int hybrid_tape_is_rle(const struct tape_t *const tape)
+{
+	assert(tape->move == hybrid_tape_move);
+	const struct hybrid_tape_t *const data = tape->data;
+	return data->curr == data->rle;
+}
+
+/*
+ * Returns the number of times the tape switched representation since the last reset.
+ */
+step_t hybrid_tape_switches(const struct tape_t *const tape)
+{
+	assert(tape->move == hybrid_tape_move);
+	const struct hybrid_tape_t *const data = tape->data;
+	return data->switches;
+}
+
+/*
+ * Runs the given TM directly on a hybrid tape for at most max_steps steps, with the
+ * specialized loop of the current tape up to the next look at its shape. Every step moves
+ * once, so we count down by the number of steps. Returns the number of steps taken.
+ */
+step_t hybrid_tape_run(struct tape_t *const tape, const struct tm_def_t *const def, const tm_hot_t *const hot_tab, state_t *const state, const step_t max_steps)
+{
+	struct hybrid_tape_t *const data = tape->data;
+	step_t steps = 0;
+	while (steps < max_steps) {
+		const step_t chunk = max_steps - steps < data->until_check ? max_steps - steps : data->until_check;
+		const step_t taken = data->curr == data->flat
+			? flat_tape_run(data->curr, def, hot_tab, state, chunk)
+			: rle_tape_run(data->curr, def, hot_tab, state, chunk, 0);
+		steps += taken;
+		data->until_check -= taken;
+		// The specialized loops only stop early when the machine halted
+		if (taken < chunk)
+			break;
+		if (data->until_check <= 0)
+			hybrid_tape_check(data);
+	}
+	return steps;
+}
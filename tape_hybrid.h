@@ -0,0 +1,25 @@
+// Tape that switches between the flat and RLE representations as the machine runs
+#ifndef TM_TAPE_HYBRID_H
+#define TM_TAPE_HYBRID_H
+
+#include "tape.h"
+#include "tm_def.h"
+#include "util.h"
+
+struct tape_t *hybrid_tape_init(unsigned sym_bits);
+
+void hybrid_tape_free(struct tape_t *tape);
+sym_t hybrid_tape_read(const struct tape_t *tape);
+void hybrid_tape_write(struct tape_t *tape, sym_t sym);
+void hybrid_tape_move(struct tape_t *tape, int delta);
+void hybrid_tape_reset(struct tape_t *tape);
+int hybrid_tape_runs(const struct tape_t *tape, tape_run_fn_t fn, void *ctx, int *head);
+void hybrid_tape_read_range(const struct tape_t *tape, int from, int len, sym_t *buf);
+int hybrid_tape_bounds(const struct tape_t *tape, int *min_pos, int *max_pos);
+
+int hybrid_tape_is_rle(const struct tape_t *tape);
+step_t hybrid_tape_switches(const struct tape_t *tape);
+
+step_t hybrid_tape_run(struct tape_t *tape, const struct tm_def_t *def, const tm_hot_t *hot_tab, state_t *state, step_t max_steps);
+
+#endif
@@ -3,8 +3,10 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "tape.h"
+#include "tm_def.h"
 #include "util.h"
 
 #include "tape_rle.h"
@@ -20,13 +22,97 @@ struct rle_elem_t {
 	int len;					// length of the run, always positive
 };
 
+// Number of elements allocated at once by a RLE element pool
+#define RLE_SLAB_LEN 1024
+
+/*
+ * A block of RLE elements that are allocated together. Slabs are linked so that
+ * they can all be released when the tape is freed.
+ */
+struct rle_slab_t {
+	struct rle_slab_t *next;					// the previously allocated slab (may be NULL)
+	struct rle_elem_t elems[RLE_SLAB_LEN];		// the elements of this slab
+};
+
+/*
+ * An arena for the elements of one RLE tape, so that writes and moves don't need to call
+ * malloc() and free(), and the elements end up close together in memory. Released elements
+ * are kept in a free list, linked by their right pointers, and are reused first.
+ */
+struct rle_pool_t {
+	struct rle_slab_t *slabs;		// the most recently allocated slab (may be NULL)
+	int slab_used;					// number of elements taken from the most recent slab
+	struct rle_elem_t *free_list;	// released elements (may be NULL)
+};
+
+/*
+ * Takes an element from the pool, allocating a new slab if needed.
+ */
+static struct rle_elem_t *rle_pool_take(struct rle_pool_t *const pool)
+{
+	struct rle_elem_t *elem = pool->free_list;
+	if (elem) {
+		pool->free_list = elem->right;
+		return elem;
+	}
+
+	if (!pool->slabs || pool->slab_used == RLE_SLAB_LEN) {
+		struct rle_slab_t *const slab = malloc(sizeof *slab);
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+		pool->slab_used = 0;
+	}
+	return pool->slabs->elems + pool->slab_used++;
+}
+
+/*
+ * Returns an element to the pool so that it can be reused.
+ */
+static void rle_pool_release(struct rle_pool_t *const pool, struct rle_elem_t *const elem)
+{
+	elem->right = pool->free_list;
+	pool->free_list = elem;
+}
+
+/*
+ * Frees all slabs of the pool at once, and with them every element ever taken from it.
+ */
+static void rle_pool_free(struct rle_pool_t *const pool)
+{
+	struct rle_slab_t *slab = pool->slabs;
+	while (slab) {
+		struct rle_slab_t *const next = slab->next;
+		free(slab);
+		slab = next;
+	}
+	pool->slabs = NULL;
+	pool->slab_used = 0;
+	pool->free_list = NULL;
+}
+
+/*
+ * Forgets all elements taken from the pool, keeping only the most recent slab for reuse.
+ */
+static void rle_pool_reset(struct rle_pool_t *const pool)
+{
+	if (pool->slabs) {
+		struct rle_slab_t *const keep = pool->slabs;
+		pool->slabs = keep->next;
+		rle_pool_free(pool);
+		keep->next = NULL;
+		pool->slabs = keep;
+	}
+	pool->slab_used = 0;
+	pool->free_list = NULL;
+}
+
 /*
  * Constructs an "initial" RLE element, which has no left or right
  * neighbor, with the given symbol and length.
  */
-static struct rle_elem_t *rle_elem_init(const sym_t sym, const int len)
+static struct rle_elem_t *rle_elem_init(struct rle_pool_t *const pool, const sym_t sym, const int len)
 {
-	struct rle_elem_t *elem = malloc(sizeof *elem);
+	struct rle_elem_t *elem = rle_pool_take(pool);
 	elem->left = NULL;
 	elem->right = NULL;
 	elem->sym = sym;
@@ -37,9 +123,9 @@ static struct rle_elem_t *rle_elem_init(const sym_t sym, const int len)
 /*
  * Shrinks the given element by one symbol. If the length
  * is zero it is removed from the tape and its neighbors
- * are linked instead. The element's memory is then freed.
+ * are linked instead. The element is then returned to the pool.
  */
-static void rle_elem_shrink(struct rle_elem_t *const elem)
+static void rle_elem_shrink(struct rle_pool_t *const pool, struct rle_elem_t *const elem)
 {
 	elem->len--;
 	if (elem->len <= 0) {
@@ -47,7 +133,7 @@ static void rle_elem_shrink(struct rle_elem_t *const elem)
 			elem->left->right = elem->right;
 		if (elem->right)
 			elem->right->left = elem->left;
-		free(elem);
+		rle_pool_release(pool, elem);
 	}
 }
 
@@ -63,17 +149,39 @@ static void rle_elem_link(struct rle_elem_t *const left, struct rle_elem_t *cons
 		right->left = left;
 }
 
+/*
+ * Merges right into left if both have the same symbol, so that the runs stay maximal after
+ * an element between them was removed. The right element is then returned to the pool.
+ * Returns 1 if they were merged. NULLs are allowed as inputs.
+ */
+static int rle_elem_join(struct rle_pool_t *const pool, struct rle_elem_t *const left, struct rle_elem_t *const right)
+{
+	if (!left || !right || left->sym != right->sym)
+		return 0;
+	left->len += right->len;
+	rle_elem_link(left, right->right);
+	rle_pool_release(pool, right);
+	return 1;
+}
+
 /*
  * A run-length encoding based tape representation as
- * a linked list of runs of repeating symbols.
+ * a linked list of runs of repeating symbols, where
+ * neighboring runs always have different symbols.
  */
 struct rle_tape_t {
 	struct rle_elem_t *curr;	// current element
 	int rle_pos; 				// position within the RLE
 	int rel_pos;				// relative position (0 = starting)
+	int min_pos;				// relative position of the leftmost cell of the elements
+	int max_pos;				// relative position of the rightmost cell of the elements
 	unsigned sym_bits; 			// the width of one symbol in bits (must be <= MAX_SYM_BITS)
+	struct rle_pool_t pool;		// the memory for all elements
+	struct rle_stats_t stats;	// only counted with -DTM_STATS
 };
 
+static const struct rle_stats_t rle_stats_zero = {0, 0, 0, 0, 0, 0};
+
 
 /*
  * Frees a RLE tape together with all its elements.
@@ -81,15 +189,8 @@ struct rle_tape_t {
 void rle_tape_free(struct tape_t *const tape)
 {
 	struct rle_tape_t *data = tape->data;
-	struct rle_elem_t *elem = data->curr;
-	// Move to the leftmost elem
-	while (elem->left) elem = elem->left;
-	// Free each element
-	while (elem) {
-		struct rle_elem_t *next = elem->right;
-		free(elem);
-		elem = next;
-	}
+	// All elements live in the pool, so there is no need to walk the list
+	rle_pool_free(&data->pool);
 	// Free data container struct
 	free(data);
 	// Free outer container struct
@@ -105,10 +206,16 @@ struct tape_t *rle_tape_init(const unsigned sym_bits)
 	assert(1 <= sym_bits && sym_bits <= MAX_SYM_BITS);
 
 	struct rle_tape_t *data = malloc(sizeof *data);
-	data->curr = rle_elem_init(0, 1);
+	data->pool.slabs = NULL;
+	data->pool.slab_used = 0;
+	data->pool.free_list = NULL;
+	data->curr = rle_elem_init(&data->pool, 0, 1);
 	data->rle_pos = 0;
 	data->rel_pos = 0;
+	data->min_pos = 0;
+	data->max_pos = 0;
 	data->sym_bits = sym_bits;
+	data->stats = rle_stats_zero;
 
 	struct tape_t *tape = malloc(sizeof *tape);
 	tape->data = data;
@@ -116,9 +223,140 @@ struct tape_t *rle_tape_init(const unsigned sym_bits)
 	tape->read = rle_tape_read;
 	tape->write = rle_tape_write;
 	tape->move = rle_tape_move;
+	tape->can_move = NULL;
+	tape->reset = rle_tape_reset;
+	tape->runs = rle_tape_runs;
+	tape->read_range = rle_tape_read_range;
+	tape->bounds = rle_tape_bounds;
 	return tape;
 }
 
+/*
+ * Clears the RLE tape, returning all elements to the pool at once.
+ */
+void rle_tape_reset(struct tape_t *const tape)
+{
+	struct rle_tape_t *const data = tape->data;
+	rle_pool_reset(&data->pool);
+	data->curr = rle_elem_init(&data->pool, 0, 1);
+	data->rle_pos = 0;
+	data->rel_pos = 0;
+	data->min_pos = 0;
+	data->max_pos = 0;
+	data->stats = rle_stats_zero;
+}
+
+/*
+ * Copies the counts of what the writes and moves did since the last reset into stats, which
+ * are all zero unless built with -DTM_STATS.
+ */
+void rle_tape_stats(const struct tape_t *const tape, struct rle_stats_t *const stats)
+{
+	assert(tape->move == rle_tape_move);
+	const struct rle_tape_t *const data = tape->data;
+	*stats = data->stats;
+}
+
+/*
+ * Prints the counts of rle_tape_stats() on one line.
+ */
+void rle_tape_print_stats(const struct tape_t *const tape)
+{
+	struct rle_stats_t stats;
+	rle_tape_stats(tape, &stats);
+	printf("rle writes: %lld noop %lld merge %lld split, moves: %lld within %lld across %lld extend\n",
+			stats.write_noops, stats.write_merges, stats.write_splits,
+			stats.move_within, stats.move_across, stats.move_extends);
+}
+
+/*
+ * Copies a range of the tape into buf, see tape_t. We walk from the current element to the
+ * first one overlapping the range, and then fill in each element until the end of the range.
+ */
+void rle_tape_read_range(const struct tape_t *const tape, const int from, const int len, sym_t *const buf)
+{
+	const struct rle_tape_t *const data = tape->data;
+	assert(len >= 0);
+	memset(buf, 0, (size_t) len * sizeof *buf);
+
+	const struct rle_elem_t *elem = data->curr;
+	long long start = data->rel_pos - data->rle_pos;
+	while (start > from && elem->left) {
+		elem = elem->left;
+		start -= elem->len;
+	}
+	const long long end = (long long) from + len;
+	for (; elem && start < end; start += elem->len, elem = elem->right) {
+		if (elem->sym == 0)
+			continue;
+		const long long lo = start > from ? start : from;
+		const long long hi = start + elem->len < end ? start + elem->len : end;
+		if (lo < hi)
+			memset(buf + (lo - from), elem->sym, (size_t) (hi - lo) * sizeof *buf);
+	}
+}
+
+/*
+ * Gives the span covered by the elements and the head position, see tape_t.
+ */
+int rle_tape_bounds(const struct tape_t *const tape, int *const min_pos, int *const max_pos)
+{
+	const struct rle_tape_t *const data = tape->data;
+	*min_pos = data->min_pos;
+	*max_pos = data->max_pos;
+	return data->rel_pos;
+}
+
+/*
+ * The head position relative to the origin.
+ */
+int rle_tape_pos(const struct tape_t *const tape)
+{
+	assert(tape->move == rle_tape_move);
+	const struct rle_tape_t *const data = tape->data;
+	return data->rel_pos;
+}
+
+/*
+ * Copies the runs of the tape from left to right into syms and lens, e.g. for deciders, which
+ * have room for max_runs runs. Returns the number of runs, or -1 if there are more than that.
+ */
+int rle_tape_copy_runs(const struct tape_t *const tape, sym_t *const syms, int *const lens, const int max_runs)
+{
+	assert(tape->move == rle_tape_move);
+	const struct rle_tape_t *const data = tape->data;
+
+	const struct rle_elem_t *elem = data->curr;
+	while (elem->left)
+		elem = elem->left;
+	int n_runs = 0;
+	for (; elem; elem = elem->right) {
+		if (n_runs == max_runs)
+			return -1;
+		syms[n_runs] = elem->sym;
+		lens[n_runs++] = elem->len;
+	}
+	return n_runs;
+}
+
+/*
+ * Gives all runs of the tape, see tape_t.
+ */
+int rle_tape_runs(const struct tape_t *const tape, const tape_run_fn_t fn, void *const ctx, int *const head)
+{
+	const struct rle_tape_t *const data = tape->data;
+	int first = data->rel_pos - data->rle_pos;
+	const struct rle_elem_t *elem = data->curr;
+	while (elem->left) {
+		elem = elem->left;
+		first -= elem->len;
+	}
+	for (; elem; elem = elem->right)
+		fn(ctx, elem->sym, elem->len);
+	*head = data->rel_pos;
+	return first;
+}
+
 /*
  * Prints an entire RLE tape.
  */
@@ -172,6 +410,7 @@ void rle_tape_write(struct tape_t *const tape, const sym_t sym)
 	struct rle_elem_t *const orig = data->curr;
 	if (orig->sym == sym) {
 		// Nothing to do
+		STAT(data->stats.write_noops++);
 		return;
 	}
 
@@ -181,27 +420,38 @@ void rle_tape_write(struct tape_t *const tape, const sym_t sym)
 		data->curr->len++;
 		data->rle_pos = data->curr->len - 1;
 
-		rle_elem_shrink(orig);
+		rle_elem_shrink(&data->pool, orig);
+		// If orig is gone, the right neighbor may have the same symbol too
+		(void) rle_elem_join(&data->pool, data->curr, data->curr->right);
+		STAT(data->stats.write_merges++);
 		return;
 	}
 
-	if (data->rle_pos == orig->len && orig->right && orig->right->sym == sym) {
+	if (data->rle_pos == orig->len - 1 && orig->right && orig->right->sym == sym) {
 		// Extend right neighbor
 		data->curr = orig->right;
 		data->curr->len++;
 		data->rle_pos = 0;
 
-		rle_elem_shrink(orig);
+		rle_elem_shrink(&data->pool, orig);
+		// Likewise for the left neighbor, which the head then moves into
+		struct rle_elem_t *const left = data->curr->left;
+		const int left_len = left ? left->len : 0;
+		if (rle_elem_join(&data->pool, left, data->curr)) {
+			data->curr = left;
+			data->rle_pos = left_len;
+		}
+		STAT(data->stats.write_merges++);
 		return;
 	}
 
 	// Create new in middle / left / right
-	struct rle_elem_t *const new_mid = rle_elem_init(sym, 1);
+	struct rle_elem_t *const new_mid = rle_elem_init(&data->pool, sym, 1);
 
 	const int left_len = data->rle_pos;
 	if (left_len > 0) {
 		// We have "leftover" symbols to the left
-		struct rle_elem_t *const new_left = rle_elem_init(orig->sym, left_len);
+		struct rle_elem_t *const new_left = rle_elem_init(&data->pool, orig->sym, left_len);
 		rle_elem_link(orig->left, new_left);
 		rle_elem_link(new_left, new_mid);
 	} else {
@@ -211,7 +461,7 @@ void rle_tape_write(struct tape_t *const tape, const sym_t sym)
 	const int right_len = orig->len - data->rle_pos - 1;
 	if (right_len > 0) {
 		// We have "leftover" symbols to the left
-		struct rle_elem_t *const new_right = rle_elem_init(orig->sym, right_len);
+		struct rle_elem_t *const new_right = rle_elem_init(&data->pool, orig->sym, right_len);
 		rle_elem_link(new_right, orig->right);
 		rle_elem_link(new_mid, new_right);
 	} else {
@@ -228,7 +478,8 @@ void rle_tape_write(struct tape_t *const tape, const sym_t sym)
 	// Update tape pointers and free removed element
 	data->curr = new_mid;
 	data->rle_pos = 0;
-	free(orig);
+	rle_pool_release(&data->pool, orig);
+	STAT(data->stats.write_splits++);
 }
 
 /*
@@ -274,15 +525,18 @@ void rle_tape_move(struct tape_t *const tape, int delta)
 				assert(data->rle_pos == 0); // by assumption
 			} else {
 				// Create a new zero to the left and move into it
-				struct rle_elem_t *const new_left = rle_elem_init(0, 1);
+				struct rle_elem_t *const new_left = rle_elem_init(&data->pool, 0, 1);
 				rle_elem_link(new_left, orig);
 				data->curr = orig->left;
 				data->rle_pos = data->curr->len - 1;
 			}
+			data->min_pos = data->rel_pos;
+			STAT(data->stats.move_extends++);
 		} else {
 			// Move into the existing left element
 			data->curr = orig->left;
 			data->rle_pos = data->curr->len - 1;
+			STAT(data->stats.move_across++);
 		}
 		return;
 	}
@@ -297,31 +551,114 @@ void rle_tape_move(struct tape_t *const tape, int delta)
 				assert(data->rle_pos == orig->len - 1); // by assumption
 			} else {
 				// Create a new zero to the right and move into it
-				struct rle_elem_t *const new_right = rle_elem_init(0, 1);
+				struct rle_elem_t *const new_right = rle_elem_init(&data->pool, 0, 1);
 				rle_elem_link(orig, new_right);
 				data->curr = orig->right;
 				data->rle_pos = data->curr->len - 1;
 			}
+			data->max_pos = data->rel_pos;
+			STAT(data->stats.move_extends++);
 		} else {
 			// Move into the existing right element
 			data->curr = orig->right;
 			data->rle_pos = 0;
+			STAT(data->stats.move_across++);
 		}
 		return;
 	}
 
 	// Simply move within the element
 	data->rle_pos += delta;
+	STAT(data->stats.move_within++);
 	assert(0 <= data->rle_pos && data->rle_pos < data->curr->len); // check invariants
 }
 
+/*
+ * Skips through the entire current run, writing sym to every symbol in it and leaving the
+ * head just outside it, as if we had written and moved by delta once per symbol. This is only
+ * done if the head is at the edge of the run facing into it, and the run is longer than one but
+ * at most max_len symbols. Returns the number of symbols skipped (i.e. moves made), or 0 if
+ * nothing was done. Note that the caller must check that the machine would actually keep going
+ * in the same direction through the whole run, i.e. (state, run symbol) -> (sym, delta, state).
+ */
+int rle_tape_skip(struct tape_t *const tape, const sym_t sym, const int delta, const step_t max_len)
+{
+	struct rle_tape_t *const data = tape->data;
+	struct rle_elem_t *elem = data->curr;
+
+	assert(delta == -1 || delta == 1);
+	const int at_edge = delta == 1 ? data->rle_pos == 0 : data->rle_pos == elem->len - 1;
+	if (!at_edge || elem->len <= 1 || elem->len > max_len)
+		return 0;
+
+	// Place the head at the far end of the run, then rewrite the whole run
+	const int len = elem->len;
+	assert(delta == 1 ? data->rel_pos < INT_MAX - len : data->rel_pos > INT_MIN + len);
+	data->rel_pos += delta * (len - 1);
+	data->rle_pos = delta == 1 ? len - 1 : 0;
+	elem->sym = sym;
+
+	// Merge with neighbors of the same symbol, keeping the head on the same symbol
+	struct rle_elem_t *const left = elem->left;
+	const int left_len = left ? left->len : 0;
+	if (rle_elem_join(&data->pool, left, elem)) {
+		data->rle_pos += left_len;
+		elem = left;
+	}
+	(void) rle_elem_join(&data->pool, elem, elem->right);
+	data->curr = elem;
+	assert(0 <= data->rle_pos && data->rle_pos < elem->len);
+
+	// The final move takes us out of the run
+	rle_tape_move(tape, delta);
+	return len;
+}
+
+/*
+ * Runs the given TM directly on a RLE tape for at most max_steps steps. We call the RLE
+ * functions directly (so they can be inlined) instead of through the struct tape_t function
+ * pointers, and keep the state in a local. Returns the number of steps taken.
+ * If skip is set, we use rle_tape_skip() to go through an entire run in one go whenever the
+ * machine would just keep moving through it in the same state, as it does in e.g. bouncers.
+ */
+step_t rle_tape_run(struct tape_t *const tape, const struct tm_def_t *const def, const tm_hot_t *const hot_tab, state_t *const state, const step_t max_steps, const int skip)
+{
+	assert(tape->move == rle_tape_move);
+
+	const int n_syms = def->n_syms;
+	const int halt_row = def->n_states * n_syms;
+
+	int row = *state * n_syms;
+	step_t steps = 0;
+	while (steps < max_steps && row < halt_row) {
+		const tm_hot_t hot = hot_tab[row + rle_tape_read(tape)];
+		const int delta = HOT_DELTA(hot);
+		if (skip && HOT_ROW(hot) == row) {
+			const int skipped = rle_tape_skip(tape, HOT_SYM(hot), delta, max_steps - steps);
+			if (skipped > 0) {
+				steps += skipped;
+				continue;
+			}
+		}
+		rle_tape_write(tape, HOT_SYM(hot));
+		rle_tape_move(tape, delta);
+		row = HOT_ROW(hot);
+		steps++;
+	}
+
+	*state = (state_t) (row / n_syms);
+	return steps;
+}
+
 /*
  * Counts the total number of nonzero symbols in the tape
  * by doing a full scan of the entire tape
  */
-static int rle_count_nonzero(const struct rle_tape_t *const tape)
+int rle_tape_count_nonzero(const struct tape_t *const tape)
 {
-	const struct rle_elem_t *elem = tape->curr;
+	assert(tape->move == rle_tape_move);
+	const struct rle_tape_t *const data = tape->data;
+	const struct rle_elem_t *elem = data->curr;
 	int nonzero = 0;
 
 	// Count current and to the left
@@ -332,8 +669,8 @@ static int rle_count_nonzero(const struct rle_tape_t *const tape)
 	}
 
 	// Count (strictly) to the right of current
-	assert(tape->curr != NULL); // to make linter happy
-	elem = tape->curr->right; // already counted tape->curr
+	assert(data->curr != NULL); // to make linter happy
+	elem = data->curr->right; // already counted data->curr
 	while (elem) {
 		if (elem->sym != 0)
 			nonzero += elem->len;
@@ -3,14 +3,39 @@
 #define TM_TAPE_RLE_H
 
 #include "tape.h"
+#include "tm_def.h"
 #include "util.h"
 
+/*
+ * Counts of what the RLE writes and moves did, which are only kept with -DTM_STATS.
+ */
+struct rle_stats_t {
+	step_t write_noops;		// writes of the symbol that was already there
+	step_t write_merges;	// writes that extended a neighboring run
+	step_t write_splits;	// writes that split a run (or replaced a run of length one)
+	step_t move_within;		// moves within the current run
+	step_t move_across;		// moves into a neighboring run
+	step_t move_extends;	// moves past the edge of the tape, into the blank part
+};
+
 struct tape_t *rle_tape_init(unsigned sym_bits);
 
 void rle_tape_free(struct tape_t *tape);
 sym_t rle_tape_read(const struct tape_t *tape);
 void rle_tape_write(struct tape_t *tape, sym_t sym);
 void rle_tape_move(struct tape_t *tape, int delta);
+void rle_tape_reset(struct tape_t *tape);
+int rle_tape_runs(const struct tape_t *tape, tape_run_fn_t fn, void *ctx, int *head);
+void rle_tape_read_range(const struct tape_t *tape, int from, int len, sym_t *buf);
+int rle_tape_bounds(const struct tape_t *tape, int *min_pos, int *max_pos);
+
+int rle_tape_pos(const struct tape_t *tape);
+int rle_tape_copy_runs(const struct tape_t *tape, sym_t *syms, int *lens, int max_runs);
+int rle_tape_count_nonzero(const struct tape_t *tape);
+void rle_tape_stats(const struct tape_t *tape, struct rle_stats_t *stats);
+void rle_tape_print_stats(const struct tape_t *tape);
+int rle_tape_skip(struct tape_t *tape, sym_t sym, int delta, step_t max_len);
+step_t rle_tape_run(struct tape_t *tape, const struct tm_def_t *def, const tm_hot_t *hot_tab, state_t *state, step_t max_steps, int skip);
 
 struct rle_tape_t;
 void rle_tape_print(const struct rle_tape_t *tape, state_t state, int directed);
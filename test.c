@@ -7,18 +7,35 @@
 #include "tape.h"
 #include "tape_flat.h"
 #include "tape_rle.h"
+#include "tape_gap.h"
+#include "tape_hybrid.h"
 #include "tape_bit.h"
+#include "mm_cache.h"
+#include "mm_run.h"
 #include "test_case.h"
+#include "tm_batch.h"
+#include "tm_ckpt.h"
+#include "tm_decide.h"
 #include "tm_def.h"
 #include "tm_run.h"
 #include "util.h"
 
 // Upper limit on number of steps. NB not a hard limit, may be exceeded by up to BATCH_STEPS - 1.
-static const int MAX_STEPS = (INT_MAX >> 4);
-// Number of steps before we perform some consistency checks
-static const int BATCH_STEPS = 100;
+static const step_t MAX_STEPS = (step_t) 1 << 40;
+// Number of matching records in a row before we suspect a bouncer
+static const int BOUNCER_THRESHOLD = 8;
+// Number of steps before we perform some consistency checks. Without checks we run unbatched.
+static const step_t BATCH_STEPS = 100;
+// Number of symbols reserved for flat tapes with -v, only touched pages use physical memory
+static const int FLAT_RESERVE_LEN = 1 << 30;
 // Number of symbols in each direction of the head that we compare. 0 means comparing only head
 static const int COMPARE_WINDOW = 100;
+// Number of slots of the transition cache with -x, as a power of two
+static const int MACRO_CACHE_LOG2_SIZE = 16;
+// Number of threads that run each test case again with -x, sharing the transition cache
+#define MACRO_CACHE_THREADS 4
+// Where -k writes its checkpoints
+static const char *const CKPT_PATH = "tmp/test_ckpt.bin";
 
 struct flags_t {
 	unsigned quiet : 1;
@@ -26,9 +43,103 @@ struct flags_t {
 	unsigned tape_rle : 1;
 	unsigned tape_flat : 1;
 	unsigned tape_bit : 1;
+	unsigned tape_gap : 1;
+	unsigned tape_hybrid : 1;
+	unsigned reserve : 1;
+	unsigned fast : 1;
+	unsigned skip : 1;
+	unsigned thread : 1;
+	unsigned macro : 1;
+	unsigned decide : 1;
+	unsigned ckpt : 1;
+	unsigned stats : 1;
+	unsigned cache : 1;
 };
 
-static double verify_test_case(const struct test_case_t *const tcase, const struct flags_t flags)
+// Steps a run for a batch of steps, either tm_run_steps() or one of the specialized loops
+typedef struct tm_result_t (*run_fn_t)(struct tm_run_t *run, step_t max_steps);
+
+/*
+ * Chains the deciders that work with the given tapes, the cycler for a flat tape and the
+ * bouncer for an RLE tape.
+ */
+static struct tm_decider_t *decider_chain(const int flat, const int rle)
+{
+	struct tm_decider_t *const cycler = flat ? tm_cycler_init() : NULL;
+	struct tm_decider_t *const bouncer = rle ? tm_bouncer_init(BOUNCER_THRESHOLD) : NULL;
+	if (cycler) {
+		cycler->next = bouncer;
+		return cycler;
+	}
+	return bouncer;
+}
+
+static void decider_chain_free(struct tm_decider_t *decider)
+{
+	while (decider) {
+		struct tm_decider_t *const next = decider->next;
+		decider->free(decider);
+		decider = next;
+	}
+}
+
+/*
+ * The previous run given by the runs method of a tape, see runs_maximal().
+ */
+struct runs_check_t {
+	int n_runs;
+	sym_t sym;
+	int maximal;	// cleared if two neighboring runs have the same symbol
+};
+
+static void runs_check_run(void *const ctx, const sym_t sym, const int len)
+{
+	struct runs_check_t *const check = ctx;
+	if (len <= 0 || (check->n_runs > 0 && check->sym == sym))
+		check->maximal = 0;
+	check->n_runs++;
+	check->sym = sym;
+}
+
+/*
+ * Returns 1 if the runs method of the tape only gives maximal runs, as it should.
+ */
+static int runs_maximal(const struct tape_t *const tape)
+{
+	struct runs_check_t check = {0, 0, 1};
+	int head;
+	(void) tape->runs(tape, runs_check_run, &check, &head);
+	return check.maximal;
+}
+
+/*
+ * Checks the statistics counted with -DTM_STATS after a run of the given steps, and prints
+ * them unless quiet. Every step writes and moves each tape once, and the dispatched engine
+ * counts each step in the transition histogram, except that skipping bypasses the writes.
+ */
+static void verify_stats(const struct tm_run_t *const run, const step_t steps, const struct flags_t flags)
+{
+	if (!flags.quiet)
+		tm_run_print_stats(run);
+
+	if (!flags.fast) {
+		step_t hist_steps = 0;
+		for (int i = 0; i < run->def->n_states * run->def->n_syms; i++)
+			hist_steps += run->hist[i];
+		assert(hist_steps == steps);
+	}
+	for (int i = 0; i < MAX_TAPES; i++) {
+		const struct tape_t *const tape = run->tapes[i];
+		if (!tape || tape->move != rle_tape_move || flags.skip)
+			continue;
+		struct rle_stats_t stats;
+		rle_tape_stats(tape, &stats);
+		assert(stats.write_noops + stats.write_merges + stats.write_splits == steps);
+		assert(stats.move_within + stats.move_across + stats.move_extends == steps);
+	}
+}
+
+static double verify_test_case(const struct test_case_t *const tcase, const struct flags_t flags, double *const tot_steps)
 {
 	clock_t t = clock();
 	struct tm_def_t *const def = tm_def_parse(tcase->txt);
@@ -42,63 +153,327 @@ static double verify_test_case(const struct test_case_t *const tcase, const stru
 	t = clock();
 	const unsigned sym_bits = ceil_log2((unsigned) def->n_syms);
 
-	struct tape_t *const rle_tape = flags.tape_rle ? rle_tape_init(sym_bits) : 0;
-
-	const int flat_tape_len = 16;
-	const int flat_tape_origin = flat_tape_len / 2;
-	struct tape_t *const flat_tape = flags.tape_flat ? flat_tape_init(sym_bits, flat_tape_len, flat_tape_origin) : 0;
-
-	const int bit_tape_len = 50000; // More than enough for our test cases
-	const int bit_tape_origin = bit_tape_len / 2;
-	struct tape_t *const bit_tape = flags.tape_bit ? bit_tape_init(sym_bits, bit_tape_len, bit_tape_origin) : 0;
+	/* With the dispatched engine we have one run stepping all tapes. With the specialized
+	 * engine, each tape gets its own run, and we check that the runs agree after each batch.
+	 */
+	struct tape_t *tapes[MAX_TAPES] = {0};
+	const char *tape_names[MAX_TAPES] = {0};
+	run_fn_t fast_fns[MAX_TAPES] = {0};
+	int n_tapes = 0;
+	if (flags.tape_rle) {
+		tapes[n_tapes] = rle_tape_init(sym_bits);
+		tape_names[n_tapes] = "RLE";
+		fast_fns[n_tapes++] = flags.skip ? tm_run_skip_rle : tm_run_fast_rle;
+	}
+	if (flags.tape_flat) {
+		// A reserved tape has room for any reasonable run, a heap tape starts small and grows
+		const int flat_tape_len = flags.reserve ? FLAT_RESERVE_LEN : 16;
+		const int flat_tape_origin = flat_tape_len / 2;
+		tapes[n_tapes] = flat_tape_init(sym_bits, flat_tape_len, flat_tape_origin, flags.reserve ? FLAT_MMAP_HUGE : FLAT_HEAP);
+		tape_names[n_tapes] = "Flat";
+		fast_fns[n_tapes++] = flags.thread ? tm_run_fast_thread : tm_run_fast_flat;
+	}
+	if (flags.tape_gap) {
+		tapes[n_tapes] = gap_tape_init(sym_bits);
+		tape_names[n_tapes] = "Gap";
+		fast_fns[n_tapes++] = tm_run_fast_gap;
+	}
+	if (flags.tape_hybrid) {
+		tapes[n_tapes] = hybrid_tape_init(sym_bits);
+		tape_names[n_tapes] = "Hybrid";
+		fast_fns[n_tapes++] = tm_run_fast_hybrid;
+	}
+	if (flags.tape_bit) {
+		const int bit_tape_len = 16;
+		const int bit_tape_origin = bit_tape_len / 2;
+		tapes[n_tapes] = bit_tape_init(sym_bits, bit_tape_len, bit_tape_origin);
+		tape_names[n_tapes] = "Bit";
+		fast_fns[n_tapes++] = flags.thread ? tm_run_fast_thread : tm_run_fast_bit;
+	}
 
-	struct tm_run_t *const run = tm_run_init(def, rle_tape, flat_tape, bit_tape);
+	struct tm_run_t *runs[MAX_TAPES] = {0};
+	run_fn_t run_fns[MAX_TAPES] = {0};
+	int n_runs = 0;
+	if (flags.fast) {
+		for (int i = 0; i < n_tapes; i++) {
+			runs[n_runs] = tm_run_init(def, 1, tapes + i);
+			run_fns[n_runs++] = fast_fns[i];
+		}
+	} else {
+		runs[n_runs] = tm_run_init(def, n_tapes, tapes);
+		run_fns[n_runs++] = tm_run_steps;
+	}
+	struct tm_run_t *const run = runs[0];
+	// The deciders must never claim that a halting machine does not halt
+	if (flags.decide)
+		run->decider = decider_chain(flags.tape_flat, flags.tape_rle);
 	if (!flags.quiet) printf("Initialized in %fs\n", seconds(clock(), t));
 
 	t = clock();
+	const step_t batch_steps = flags.compare ? BATCH_STEPS : MAX_STEPS;
+	enum tm_stop_t stop = TM_RUNNING;
 	while (1) {
-		tm_run_steps(run, BATCH_STEPS);
+		for (int i = 0; i < n_runs; i++)
+			stop = run_fns[i](runs[i], batch_steps).stop;
+
+		for (int i = 1; i < n_runs; i++) {
+			assert(runs[i]->steps == run->steps);
+			assert(runs[i]->state == run->state);
+		}
 
 		if (flags.compare) {
-			if (flat_tape && rle_tape) {
-				const int cmp = tape_cmp(flat_tape, bit_tape, COMPARE_WINDOW);
+			for (int i = 1; i < n_tapes; i++) {
+				const int cmp = tape_cmp(tapes[0], tapes[i], COMPARE_WINDOW);
 				assert(!cmp);
-				printf("Flat and RLE comparison %s!\n", cmp ? "FAILED": "OK");
-			}
-			if (rle_tape && bit_tape) {
-				const int cmp = tape_cmp(rle_tape, bit_tape, COMPARE_WINDOW);
-				assert(!cmp);
-				printf("RLE and bit comparison %s!\n", cmp ? "FAILED" : "OK");
-			}
-			if (bit_tape && flat_tape) {
-				const int cmp = tape_cmp(bit_tape, flat_tape, COMPARE_WINDOW);
-				assert(!cmp);
-				printf("Bit and flat comparison %s!\n", cmp ? "FAILED" : "OK");
+				printf("%s and %s comparison %s!\n", tape_names[0], tape_names[i], cmp ? "FAILED" : "OK");
 			}
 		}
 
-		if (tm_run_halted(run))
+		if (stop != TM_BUDGET)
 			break;
 		if (run->steps >= MAX_STEPS)
 			break;
 	}
 	const double runtime = seconds(clock(), t);
-	if (!flags.quiet) printf("Ran %d steps in %fs\n", run->steps, runtime);
+	if (!flags.quiet) printf("Ran %lld steps in %fs\n", run->steps, runtime);
+	for (int i = 0; i < n_tapes && !flags.quiet; i++) {
+		if (tapes[i]->move == hybrid_tape_move)
+			printf("Hybrid tape switched %lld times, ending %s\n", hybrid_tape_switches(tapes[i]), hybrid_tape_is_rle(tapes[i]) ? "RLE" : "flat");
+	}
+	if (stop == TM_TAPE_LIMIT) {
+		ERROR("Ran out of tape after %lld steps.\n", run->steps);
+	}
 
 	assert(tm_run_halted(run));
 
 	assert(run->steps == tcase->steps);
+	for (int i = 0; i < n_tapes; i++)
+		assert(tape_count_nonzero(tapes[i]) == tcase->nonzero);
+	// Going over all runs takes too long to do with every comparison above
+	for (int i = 0; i < n_tapes && flags.compare; i++)
+		assert(runs_maximal(tapes[i]));
+	if (flags.stats) {
+		for (int i = 0; i < n_runs; i++)
+			verify_stats(runs[i], run->steps, flags);
+	}
+	if (!flags.quiet) printf("Test case is OK!\n");
+	*tot_steps += (double) run->steps;
+
+	decider_chain_free(run->decider);
+	for (int i = 0; i < n_runs; i++)
+		tm_run_free(runs[i]);
+	tm_def_free(def);
+	for (int i = 0; i < n_tapes; i++)
+		tapes[i]->free(tapes[i]);
+
+	return runtime;
+}
+
+static struct tape_t *macro_tape_init(const struct flags_t flags, const unsigned sym_bits)
+{
+	if (flags.tape_flat)
+		return flags.reserve
+			? flat_tape_init(sym_bits, FLAT_RESERVE_LEN, FLAT_RESERVE_LEN / 2, FLAT_MMAP_HUGE)
+			: flat_tape_init(sym_bits, 16, 8, FLAT_HEAP);
+	if (flags.tape_bit)
+		return bit_tape_init(sym_bits, 16, 8);
+	return rle_tape_init(sym_bits);
+}
+
+/*
+ * Runs a Macro Machine until it halts, and checks that it took the steps of the test case.
+ */
+static void macro_run_halt(struct mm_run_t *const run, const struct test_case_t *const tcase)
+{
+	struct tm_result_t res = {0, TM_BUDGET};
+	while (res.stop == TM_BUDGET && run->steps < MAX_STEPS)
+		res = mm_run_steps(run, MAX_STEPS);
+	if (res.stop != TM_HALTED) {
+		ERROR("Macro machine stopped without halting after %lld steps.\n", run->steps);
+	}
+	assert(run->steps == tcase->steps);
+	assert(mm_run_count_nonzero(run) == tcase->nonzero);
+}
+
+/*
+ * The context of the runs of a test case that share a transition cache with -x.
+ */
+struct macro_cache_ctx_t {
+	const struct test_case_t *tcase;
+	struct flags_t flags;
+	struct mm_cache_t *cache;
+	step_t misses[MACRO_CACHE_THREADS];
+};
+
+/*
+ * Runs a test case once more on a machine of its own, but with the shared cache.
+ */
+static void macro_cache_run(void *const ctx, const int worker, const int item)
+{
+	(void) worker;
+	struct macro_cache_ctx_t *const cache_ctx = ctx;
+	struct tm_def_t *const def = tm_def_parse(cache_ctx->tcase->txt);
+	const int block_size = mm_max_block_size(def);
+	struct tape_t *const tape = macro_tape_init(cache_ctx->flags, mm_sym_bits(def, block_size));
+	struct mm_run_t *const run = mm_run_init(def, block_size, tape);
+	mm_run_set_cache(run, cache_ctx->cache);
+
+	macro_run_halt(run, cache_ctx->tcase);
+	cache_ctx->misses[item] = run->cache_misses;
+
+	mm_run_free(run);
+	tape->free(tape);
+	tm_def_free(def);
+}
+
+/*
+ * Runs a test case with the Macro Machine engine instead, on a single tape (RLE by default).
+ * We use the largest block size that fits in our symbol type. With a cache, we then run it
+ * again on a few threads at once, which must find all transitions in the cache, unless some
+ * were evicted.
+ */
+static double verify_macro_case(const struct test_case_t *const tcase, const struct flags_t flags, struct mm_cache_t *const cache, double *const tot_steps)
+{
+	struct tm_def_t *const def = tm_def_parse(tcase->txt);
+	const int block_size = mm_max_block_size(def);
+	struct tape_t *const tape = macro_tape_init(flags, mm_sym_bits(def, block_size));
+	struct mm_run_t *const run = mm_run_init(def, block_size, tape);
+	if (cache)
+		mm_run_set_cache(run, cache);
+
+	const clock_t t = clock();
+	macro_run_halt(run, tcase);
+	const double runtime = seconds(clock(), t);
+	if (!flags.quiet) {
+		printf("%s\n", tcase->txt);
+		printf("Ran %lld steps (%lld macro steps of %d symbols) in %fs\n",
+			run->steps, run->macro_steps, block_size, runtime);
+	}
+
+	if (cache) {
+		const step_t evictions = mm_cache_evictions(cache);
+		struct macro_cache_ctx_t cache_ctx = {tcase, flags, cache, {0}};
+		tm_batch_for(MACRO_CACHE_THREADS, MACRO_CACHE_THREADS, macro_cache_run, &cache_ctx);
+		for (int i = 0; i < MACRO_CACHE_THREADS; i++)
+			assert(cache_ctx.misses[i] == 0 || mm_cache_evictions(cache) > evictions);
+		if (!flags.quiet) {
+			printf("Cached %lld transitions, found %lld from other machines, and by %d more runs\n", run->cache_misses, run->cache_hits, MACRO_CACHE_THREADS);
+		}
+	}
+
+	if (!flags.quiet) printf("Test case is OK!\n");
+	*tot_steps += (double) run->steps;
+
+	mm_run_free(run);
+	tape->free(tape);
+	tm_def_free(def);
+
+	return runtime;
+}
+
+/*
+ * Runs a non-halting test case on a flat and an RLE tape with all deciders, and checks that
+ * it is stopped with the expected verdict. Bouncers are only suspected, not decided.
+ */
+static void verify_nonhalt_case(const struct nonhalt_case_t *const ncase, const struct flags_t flags)
+{
+	struct tm_def_t *const def = tm_def_parse(ncase->txt);
+	const unsigned sym_bits = ceil_log2((unsigned) def->n_syms);
+	struct tape_t *tapes[2] = {flat_tape_init(sym_bits, 16, 8, FLAT_HEAP), rle_tape_init(sym_bits)};
+	struct tm_run_t *const run = tm_run_init(def, 2, tapes);
+	run->decider = decider_chain(1, 1);
+
+	const struct tm_result_t res = tm_run_steps(run, MAX_STEPS);
+	const struct tm_decider_t *decider = run->decider;
+	while (decider->next && decider->verdict == TM_UNDECIDED)
+		decider = decider->next;
+	if (!flags.quiet) {
+		printf("%s\n", ncase->txt);
+		printf("Decided after %lld steps, verdict %d with period %lld\n",
+			run->steps, decider->verdict, decider->period);
+	}
+	const enum tm_stop_t expected = ncase->verdict == TM_BOUNCER ? TM_SUSPECT : TM_NONHALT;
+	if (res.stop != expected || decider->verdict != ncase->verdict) {
+		ERROR("Non-halting case %s stopped with %d after %lld steps, verdict %d, expected %d.\n",
+			ncase->txt, res.stop, run->steps, decider->verdict, ncase->verdict);
+	}
 	if (!flags.quiet) printf("Test case is OK!\n");
 
+	decider_chain_free(run->decider);
 	tm_run_free(run);
+	for (int i = 0; i < 2; i++)
+		tapes[i]->free(tapes[i]);
 	tm_def_free(def);
-	if (rle_tape)
-		rle_tape->free(rle_tape);
-	if (flat_tape)
-		flat_tape->free(flat_tape);
-	if (bit_tape)
-		bit_tape->free(bit_tape);
+}
+
+/*
+ * Runs a test case halfway on the last of the given tapes, writing checkpoints with a forked
+ * writer after every batch of steps. Then resumes the last checkpoint on each of the tapes in
+ * turn, and checks that it halts after the right number of steps.
+ */
+static double verify_ckpt_case(const struct test_case_t *const tcase, const struct flags_t flags, double *const tot_steps)
+{
+	struct tm_def_t *const def = tm_def_parse(tcase->txt);
+	const unsigned sym_bits = ceil_log2((unsigned) def->n_syms);
+	struct tape_t *tapes[MAX_TAPES] = {0};
+	run_fn_t fast_fns[MAX_TAPES] = {0};
+	int n_tapes = 0;
+	if (flags.tape_flat) {
+		tapes[n_tapes] = flat_tape_init(sym_bits, 16, 8, FLAT_HEAP);
+		fast_fns[n_tapes++] = tm_run_fast_flat;
+	}
+	if (flags.tape_rle) {
+		tapes[n_tapes] = rle_tape_init(sym_bits);
+		fast_fns[n_tapes++] = tm_run_fast_rle;
+	}
+	if (flags.tape_gap) {
+		tapes[n_tapes] = gap_tape_init(sym_bits);
+		fast_fns[n_tapes++] = tm_run_fast_gap;
+	}
+	if (flags.tape_hybrid) {
+		tapes[n_tapes] = hybrid_tape_init(sym_bits);
+		fast_fns[n_tapes++] = tm_run_fast_hybrid;
+	}
+	if (flags.tape_bit) {
+		tapes[n_tapes] = bit_tape_init(sym_bits, 16, 8);
+		fast_fns[n_tapes++] = tm_run_fast_bit;
+	}
+
+	const clock_t t = clock();
+	struct tm_run_t *run = tm_run_init(def, 1, tapes + n_tapes - 1);
+	struct tm_ckpt_t *const ckpt = tm_ckpt_init(CKPT_PATH, 0.0);
+	const step_t batch_steps = tcase->steps / 16 + 1;
+	while (run->steps < tcase->steps / 2) {
+		fast_fns[n_tapes - 1](run, batch_steps);
+		tm_ckpt_poll(ckpt, run);
+	}
+	tm_ckpt_free(ckpt);
+	tm_run_free(run);
+	if (!flags.quiet) printf("%s\n", tcase->txt);
+
+	for (int i = 0; i < n_tapes; i++) {
+		run = tm_run_init(def, 1, tapes + i);
+		if (tm_ckpt_read(run, CKPT_PATH) != 0) {
+			ERROR("No checkpoint was written to %s.\n", CKPT_PATH);
+		}
+		const step_t resumed = run->steps;
+		enum tm_stop_t stop = TM_BUDGET;
+		while (stop == TM_BUDGET && run->steps < MAX_STEPS)
+			stop = fast_fns[i](run, MAX_STEPS).stop;
+		if (!flags.quiet) printf("Resumed at step %lld and halted after %lld steps\n", resumed, run->steps);
+		if (stop != TM_HALTED || run->steps != tcase->steps) {
+			ERROR("Resumed run stopped with %d after %lld steps, expected %lld.\n", stop, run->steps, tcase->steps);
+		}
+		assert(tape_count_nonzero(tapes[i]) == tcase->nonzero);
+		tm_run_free(run);
+	}
+	const double runtime = seconds(clock(), t);
+	if (!flags.quiet) printf("Test case is OK!\n");
+	*tot_steps += (double) tcase->steps;
 
+	for (int i = 0; i < n_tapes; i++)
+		tapes[i]->free(tapes[i]);
+	tm_def_free(def);
 	return runtime;
 }
 
@@ -107,6 +482,15 @@ static void unknown_argument(const char *arg0, const char *arg)
 	(void) fprintf(stderr, "Unknown argument '%s'.\n", arg);
 	(void) fprintf(stderr, "Usage: %s [-q]\n", arg0);
 	(void) fprintf(stderr, "\t-q\tQuiet, print no output.\n");
+	(void) fprintf(stderr, "\t-s\tSpecialized, run each tape with its own single-tape loop.\n");
+	(void) fprintf(stderr, "\t-d\tDirect threaded, like -s but with the threaded runner on flat and bit tapes.\n");
+	(void) fprintf(stderr, "\t-a\tAccelerate, like -s but skip through entire runs on the RLE tape.\n");
+	(void) fprintf(stderr, "\t-v\tVirtual memory, reserve the flat tape up front with huge pages.\n");
+	(void) fprintf(stderr, "\t-m\tMacro machine, run on a single (RLE by default) tape of blocks.\n");
+	(void) fprintf(stderr, "\t-k\tCheckpoint, run halfway on the last tape and resume on each tape.\n");
+	(void) fprintf(stderr, "\t-t\tStatistics, print and check the counters of a build with -DTM_STATS.\n");
+	(void) fprintf(stderr, "\t-x\tCache, with -m share macro transitions between runs and threads.\n");
+	(void) fprintf(stderr, "\t-y\tDecide, run the cycler on a flat tape and the bouncer on an RLE tape, and non-halting cases.\n");
 }
 
 int main(int argc, char **argv)
@@ -128,31 +512,117 @@ int main(int argc, char **argv)
 		case 'f':
 			flags.tape_flat = 1;
 			break;
+		case 'g':
+			flags.tape_gap = 1;
+			break;
+		case 'h':
+			flags.tape_hybrid = 1;
+			break;
+		case 'v':
+			flags.reserve = 1;
+			break;
 		case 'r':
 			flags.tape_rle = 1;
 			break;
 		case 'q':
 			flags.quiet = 1;
 			break;
+		case 's':
+			flags.fast = 1;
+			break;
+		case 'a':
+			flags.fast = 1;
+			flags.skip = 1;
+			break;
+		case 'd':
+			flags.fast = 1;
+			flags.thread = 1;
+			break;
+		case 'm':
+			flags.macro = 1;
+			break;
+		case 'y':
+			flags.decide = 1;
+			break;
+		case 'k':
+			flags.ckpt = 1;
+			break;
+		case 't':
+			flags.stats = 1;
+			break;
+		case 'x':
+			flags.cache = 1;
+			break;
 		default:
 			unknown_argument(argv[0], argv[i]);
 			return 1;
 		}
 	}
 
-	if (flags.compare && (flags.tape_flat + flags.tape_rle + flags.tape_bit < 2)) {
+	const int n_tapes = flags.tape_flat + flags.tape_rle + flags.tape_gap + flags.tape_hybrid + flags.tape_bit;
+	if (n_tapes > MAX_TAPES) {
+		ERROR("Can use at most %d tapes at once!\n", MAX_TAPES);
+	}
+
+	if (flags.macro && (flags.compare || flags.fast || flags.tape_gap || flags.tape_hybrid || n_tapes > 1)) {
+		ERROR("The macro machine runs on a single tape and can not be combined with -c or -s!\n");
+	}
+
+	if (flags.decide && (flags.macro || flags.fast || flags.tape_gap || flags.tape_hybrid || flags.tape_bit || n_tapes < 1)) {
+		ERROR("The deciders need the dispatched engine on flat and/or RLE tapes!\n");
+	}
+
+	if (flags.ckpt && (flags.macro || flags.fast || flags.decide || flags.compare || n_tapes < 1)) {
+		ERROR("Checkpointing runs on its own, with at least one tape!\n");
+	}
+
+#ifndef TM_STATS
+	if (flags.stats) {
+		ERROR("Statistics are only counted in a build with -DTM_STATS, e.g. bin/sts_test!\n");
+	}
+#endif
+
+	if (flags.stats && (flags.macro || flags.ckpt)) {
+		ERROR("Statistics are only checked for the dispatched and specialized engines!\n");
+	}
+
+	if (flags.cache && !flags.macro) {
+		ERROR("The transition cache is only used by the macro machine, with -m!\n");
+	}
+
+	if (flags.compare && n_tapes < 2) {
 		ERROR("Must use at least two tapes to enable comparison!\n");
 	}
 
 	// Temporary, delete later
 	bit_tape_test();
 
+	// One cache for all test cases, which share the transitions that use the same base transitions
+	struct mm_cache_t *const cache = flags.cache ? mm_cache_init(MACRO_CACHE_LOG2_SIZE) : NULL;
+
 	// Run test cases 10 times for benchmarking
 	double tot_runtime = 0.0;
+	double tot_steps = 0.0;
 	if (!flags.quiet) printf("Verifying test cases...\n");
 	for (int i = 0; i < N_TEST_CASES; i++) {
-		tot_runtime += verify_test_case(TEST_CASES + i, flags);
+		if (flags.macro)
+			tot_runtime += verify_macro_case(TEST_CASES + i, flags, cache, &tot_steps);
+		else if (flags.ckpt)
+			tot_runtime += verify_ckpt_case(TEST_CASES + i, flags, &tot_steps);
+		else
+			tot_runtime += verify_test_case(TEST_CASES + i, flags, &tot_steps);
 	}
-	printf("Total runtime: %fs Using tapes: %s%s%s\n", tot_runtime, flags.tape_flat ? "flat, " : "", flags.tape_rle ? "RLE, " : "", flags.tape_bit ? "bitarray, " : "");
+	if (flags.decide) {
+		for (int i = 0; i < N_NONHALT_CASES; i++)
+			verify_nonhalt_case(NONHALT_CASES + i, flags);
+	}
+	if (cache)
+		mm_cache_free(cache);
+
+	// The macro machine uses the RLE tape unless another is given
+	const int uses_rle = flags.tape_rle || (flags.macro && !flags.tape_flat && !flags.tape_bit);
+	printf("Total runtime: %fs (%.0f steps/s) Engine: %s Using tapes: %s%s%s%s%s\n",
+		tot_runtime, tot_steps / tot_runtime, flags.cache ? "cached macro" : flags.macro ? "macro" : flags.ckpt ? "checkpointed" : flags.skip ? "skipping" : flags.thread ? "threaded" : flags.fast ? "specialized" : "dispatched",
+		flags.tape_flat ? "flat, " : "", uses_rle ? "RLE, " : "", flags.tape_gap ? "gap RLE, " : "", flags.tape_hybrid ? "hybrid, " : "", flags.tape_bit ? "bitarray, " : "");
 	return 0;
 }
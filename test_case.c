@@ -95,3 +95,21 @@ const struct test_case_t TEST_CASES[] = {
 };
 
 const int N_TEST_CASES = sizeof TEST_CASES / sizeof *TEST_CASES;
+
+/*
+ * Non-halting machines, found among random small machines and checked by simulation.
+ */
+const struct nonhalt_case_t NONHALT_CASES[] = {
+	{"1RB0RB_0LC0RB_1RB1LA", TM_CYCLER},
+	{"1LB1LA_0RC0LB_1RA0RB", TM_CYCLER},
+	{"1RB0RA_0LB0LC_1RA0RA", TM_CYCLER},
+	{"1RC0LC_1LA1RB_1LB0RB", TM_TRANSLATED_CYCLER},
+	{"1LB0RB_1RA0LC_1RA0RC", TM_TRANSLATED_CYCLER},
+	{"1LB1LA2LB_2RB1RA0RB", TM_TRANSLATED_CYCLER},
+	{"1LB1LC_1RB1RA_0LA0LB", TM_TRANSLATED_CYCLER},
+	{"1RB1LA_1LA1RB", TM_BOUNCER},
+	{"0RB1LA_1LA1RB", TM_BOUNCER},
+	{"1LB1RA_0RA1LB", TM_BOUNCER},
+};
+
+const int N_NONHALT_CASES = sizeof NONHALT_CASES / sizeof *NONHALT_CASES;
@@ -1,13 +1,26 @@
 #ifndef TM_TEST_CASE_H
 #define TM_TEST_CASE_H
 
+#include "tm_run.h"
+#include "util.h"
+
 struct test_case_t {
 	char *txt;
-	int steps;
+	step_t steps;
 	int nonzero;
 };
 
+/*
+ * A machine that never halts, and the verdict a decider should reach about it.
+ */
+struct nonhalt_case_t {
+	char *txt;
+	enum tm_verdict_t verdict;
+};
+
 extern const struct test_case_t TEST_CASES[];
 extern const int N_TEST_CASES;
+extern const struct nonhalt_case_t NONHALT_CASES[];
+extern const int N_NONHALT_CASES;
 
 #endif
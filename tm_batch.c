@@ -0,0 +1,444 @@
+// Needed for sysconf(_SC_NPROCESSORS_ONLN) with -std=c99
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tape.h"
+#include "tape_flat.h"
+#include "tm_db.h"
+#include "tm_decide.h"
+#include "tm_lanes.h"
+#include "tm_def.h"
+#include "tm_run.h"
+#include "tm_sink.h"
+#include "util.h"
+
+#include "tm_batch.h"
+
+/*
+ * This file contains a parallel for loop with work stealing, and a batch runner built on it.
+ *
+ * Each worker owns a range [lo, hi) of items, packed into one 64-bit word so that it can be
+ * updated with a single compare-and-swap. The owner takes items one at a time from lo, and
+ * when its range is empty it steals the upper half of the range of some other worker. Since
+ * run times of TMs vary wildly, this keeps all workers busy until the very end, without any
+ * locks. We use the GCC/clang __atomic builtins, as C11 atomics are not available in C99.
+ */
+
+#define RANGE(lo, hi) (((uint64_t) (uint32_t) (lo) << 32) | (uint64_t) (uint32_t) (hi))
+#define RANGE_LO(range) ((int) ((range) >> 32))
+#define RANGE_HI(range) ((int) ((range) & 0xFFFFFFFFU))
+
+// Assumed cache line size, so that the ranges of different workers don't share lines
+#define CACHE_LINE 64
+
+/*
+ * The range of items owned by one worker, alone on its cache line.
+ */
+struct batch_slot_t {
+	uint64_t range;		// packed [lo, hi), only changed with __atomic builtins
+	char pad[CACHE_LINE - sizeof (uint64_t)];
+};
+
+/*
+ * The shared state of one tm_batch_for() call.
+ */
+struct batch_t {
+	struct batch_slot_t *slots;		// one per worker
+	int n_threads;
+	tm_batch_fn_t fn;
+	void *ctx;
+};
+
+/*
+ * The argument of one worker thread.
+ */
+struct batch_worker_t {
+	struct batch_t *batch;
+	int idx;
+};
+
+/*
+ * Takes the next item from the front of the given range, returns 0 if it is empty.
+ */
+static int batch_take(struct batch_slot_t *const slot, int *const item)
+{
+	uint64_t range = __atomic_load_n(&slot->range, __ATOMIC_ACQUIRE);
+	while (RANGE_LO(range) < RANGE_HI(range)) {
+		const uint64_t next = RANGE(RANGE_LO(range) + 1, RANGE_HI(range));
+		if (__atomic_compare_exchange_n(&slot->range, &range, next, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*item = RANGE_LO(range);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Steals the upper half of the range of the first other worker that has any items left,
+ * and makes it the range of worker self, whose range must be empty. Returns 0 if all ranges
+ * were empty, in which case there is no work left for us. Items that another thief has taken
+ * but not yet stored in its own range are fine to miss, as that thief will run them.
+ */
+static int batch_steal(struct batch_t *const batch, const int self)
+{
+	for (int i = 1; i < batch->n_threads; i++) {
+		struct batch_slot_t *const victim = batch->slots + (self + i) % batch->n_threads;
+		uint64_t range = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+		while (RANGE_LO(range) < RANGE_HI(range)) {
+			const int lo = RANGE_LO(range);
+			const int hi = RANGE_HI(range);
+			const int keep = (hi - lo) / 2;
+			const uint64_t next = RANGE(lo, lo + keep);
+			if (__atomic_compare_exchange_n(&victim->range, &range, next, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				__atomic_store_n(&batch->slots[self].range, RANGE(lo + keep, hi), __ATOMIC_RELEASE);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void *batch_worker(void *const arg)
+{
+	const struct batch_worker_t *const worker = arg;
+	struct batch_t *const batch = worker->batch;
+	struct batch_slot_t *const slot = batch->slots + worker->idx;
+	do {
+		int item;
+		while (batch_take(slot, &item))
+			batch->fn(batch->ctx, worker->idx, item);
+	} while (batch_steal(batch, worker->idx));
+	return NULL;
+}
+
+/*
+ * The number of online CPUs, which is a good default for the number of threads.
+ */
+int tm_batch_default_threads(void)
+{
+	const long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return n_cpus > 0 ? (int) n_cpus : 1;
+}
+
+/*
+ * Calls fn(ctx, worker, item) once for each item in 0 .. n_items - 1, spread over n_threads
+ * threads with work stealing. The calling thread is worker 0. Each worker only ever runs one
+ * item at a time, so fn can use per-worker state indexed by worker without locking.
+ */
+void tm_batch_for(const int n_items, const int n_threads, const tm_batch_fn_t fn, void *const ctx)
+{
+	assert(n_items >= 0 && n_threads >= 1);
+
+	struct batch_t batch;
+	batch.slots = malloc((size_t) n_threads * sizeof *batch.slots);
+	batch.n_threads = n_threads;
+	batch.fn = fn;
+	batch.ctx = ctx;
+	// Start from an even split, stealing takes care of the imbalance
+	for (int i = 0; i < n_threads; i++) {
+		const int lo = (int) ((long long) n_items * i / n_threads);
+		const int hi = (int) ((long long) n_items * (i + 1) / n_threads);
+		batch.slots[i].range = RANGE(lo, hi);
+	}
+
+	struct batch_worker_t *const workers = malloc((size_t) n_threads * sizeof *workers);
+	pthread_t *const threads = malloc((size_t) n_threads * sizeof *threads);
+	for (int i = 0; i < n_threads; i++) {
+		workers[i].batch = &batch;
+		workers[i].idx = i;
+	}
+	for (int i = 1; i < n_threads; i++) {
+		if (pthread_create(threads + i, NULL, batch_worker, workers + i) != 0) {
+			ERROR("Could not create batch worker thread %d.\n", i);
+		}
+	}
+	batch_worker(workers);
+	for (int i = 1; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	free(workers);
+	free(batch.slots);
+}
+
+/*
+ * The context of tm_batch_run(), with one reusable run and tape per worker.
+ */
+struct batch_run_t {
+	const struct tm_def_t *const *defs;
+	step_t max_steps;
+	struct tm_result_t *results;
+	struct tm_run_t **runs;
+};
+
+static void batch_run_item(void *const ctx, const int worker, const int item)
+{
+	const struct batch_run_t *const batch = ctx;
+	struct tm_run_t *const run = batch->runs[worker];
+	tm_run_reset(run, batch->defs[item]);
+	// Each result has its own slot, so no synchronization is needed
+	batch->results[item] = tm_run_fast_flat(run, batch->max_steps);
+}
+
+/*
+ * Runs each of the n_defs TMs for at most max_steps steps on a flat tape, using n_threads
+ * threads, and stores the result of defs[i] in results[i].
+ */
+void tm_batch_run(const struct tm_def_t *const *const defs, const int n_defs, const step_t max_steps, const int n_threads, struct tm_result_t *const results)
+{
+	struct batch_run_t batch;
+	batch.defs = defs;
+	batch.max_steps = max_steps;
+	batch.results = results;
+	batch.runs = malloc((size_t) n_threads * sizeof *batch.runs);
+	for (int i = 0; i < n_threads; i++) {
+		struct tape_t *tape = flat_tape_init_any();
+		batch.runs[i] = tm_run_init(n_defs > 0 ? defs[0] : NULL, 1, &tape);
+	}
+
+	tm_batch_for(n_defs, n_threads, batch_run_item, &batch);
+
+	for (int i = 0; i < n_threads; i++) {
+		struct tape_t *const tape = batch.runs[i]->tapes[0];
+		tape->free(tape);
+		tm_run_free(batch.runs[i]);
+	}
+	free(batch.runs);
+}
+
+// Number of TMs that each worker takes at a time with tm_batch_run_lanes()
+#define BATCH_LANES_BLOCK 256
+
+/*
+ * The context of tm_batch_run_lanes(), with one lockstep runner per worker.
+ */
+struct batch_run_lanes_t {
+	const struct tm_def_t *const *defs;
+	int n_defs;
+	step_t max_steps;
+	struct tm_result_t *results;
+	struct tm_lanes_t **lanes;
+};
+
+static void batch_run_lanes_block(void *const ctx, const int worker, const int block)
+{
+	const struct batch_run_lanes_t *const batch = ctx;
+	const int first = block * BATCH_LANES_BLOCK;
+	const int n = batch->n_defs - first < BATCH_LANES_BLOCK ? batch->n_defs - first : BATCH_LANES_BLOCK;
+	tm_lanes_run(batch->lanes[worker], batch->defs + first, n, batch->max_steps, batch->results + first);
+}
+
+/*
+ * Same as tm_batch_run(), but each worker runs its TMs in lockstep lanes, see tm_lanes.c,
+ * which is faster when most of them only run for a short while.
+ */
+void tm_batch_run_lanes(const struct tm_def_t *const *const defs, const int n_defs, const step_t max_steps, const int n_threads, struct tm_result_t *const results)
+{
+	struct batch_run_lanes_t batch;
+	batch.defs = defs;
+	batch.n_defs = n_defs;
+	batch.max_steps = max_steps;
+	batch.results = results;
+	batch.lanes = malloc((size_t) n_threads * sizeof *batch.lanes);
+	for (int i = 0; i < n_threads; i++)
+		batch.lanes[i] = tm_lanes_init();
+
+	const int n_blocks = (n_defs + BATCH_LANES_BLOCK - 1) / BATCH_LANES_BLOCK;
+	tm_batch_for(n_blocks, n_threads, batch_run_lanes_block, &batch);
+
+	for (int i = 0; i < n_threads; i++)
+		tm_lanes_free(batch.lanes[i]);
+	free(batch.lanes);
+}
+
+/*
+ * The context of tm_batch_run_db(), with a definition buffer per worker to decode into.
+ */
+struct batch_run_db_t {
+	const struct tm_db_t *db;
+	int first;
+	int decide;
+	step_t max_steps;
+	struct tm_result_t *results;
+	struct tm_run_t **runs;
+	struct tm_def_t **defs;
+	struct tm_sink_t *sink;
+};
+
+/*
+ * Adds the record of one machine to the sink, with the metrics of the tape it ended on.
+ */
+static void batch_sink_put(const struct batch_run_db_t *const batch, const int worker, const int item, const struct tm_run_t *const run, const step_t wall_ns)
+{
+	struct tm_sink_rec_t rec = {0};
+	rec.machine = batch->first + item;
+	rec.stop = (unsigned char) batch->results[item].stop;
+	rec.engine = batch->decide ? TM_ENGINE_DISPATCHED : TM_ENGINE_SPECIALIZED;
+	rec.steps = batch->results[item].steps;
+	rec.wall_ns = wall_ns;
+	if (run) {
+		for (const struct tm_decider_t *decider = run->decider; decider && rec.verdict == TM_UNDECIDED; decider = decider->next)
+			rec.verdict = (unsigned char) decider->verdict;
+		const struct tape_t *const tape = run->tapes[0];
+		int min_pos, max_pos;
+		(void) tape->bounds(tape, &min_pos, &max_pos);
+		rec.sigma = tape_count_nonzero(tape);
+		rec.span = max_pos - min_pos + 1;
+	}
+	tm_sink_put(batch->sink, worker, &rec);
+}
+
+static void batch_run_db_item(void *const ctx, const int worker, const int item)
+{
+	const struct batch_run_db_t *const batch = ctx;
+	struct tm_def_t *const def = batch->defs[worker];
+	const step_t t = batch->sink ? wall_ns() : 0;
+	if (tm_db_decode(batch->db, batch->first + item, def) != 0) {
+		// Not a TM we can run, which is distinct from any real result
+		batch->results[item].steps = 0;
+		batch->results[item].stop = TM_RUNNING;
+		if (batch->sink)
+			batch_sink_put(batch, worker, item, NULL, wall_ns() - t);
+		return;
+	}
+	struct tm_run_t *const run = batch->runs[worker];
+	tm_run_reset(run, def);
+	// Only the dispatched loop calls the decider
+	batch->results[item] = batch->decide ? tm_run_steps(run, batch->max_steps) : tm_run_fast_flat(run, batch->max_steps);
+	if (batch->sink)
+		batch_sink_put(batch, worker, item, run, wall_ns() - t);
+}
+
+/*
+ * Like tm_batch_run(), but for the n_defs TMs starting at number first of db, which are
+ * decoded by the workers as they go. This way the definitions never all exist at once.
+ * Malformed TMs get a result with stop TM_RUNNING. If decide is set, runs have a cycler
+ * decider, and cyclers get a result with stop TM_NONHALT. If sink is not NULL, which must have
+ * at least n_threads workers, we also add a record with the metrics of every TM to it.
+ */
+void tm_batch_run_db(const struct tm_db_t *const db, const int first, const int n_defs, const step_t max_steps, const int n_threads, const int decide, struct tm_result_t *const results, struct tm_sink_t *const sink)
+{
+	assert(first >= 0 && n_defs >= 0 && first + n_defs <= tm_db_count(db));
+	struct batch_run_db_t batch;
+	batch.db = db;
+	batch.first = first;
+	batch.decide = decide;
+	batch.max_steps = max_steps;
+	batch.results = results;
+	batch.sink = sink;
+	batch.runs = malloc((size_t) n_threads * sizeof *batch.runs);
+	batch.defs = malloc((size_t) n_threads * sizeof *batch.defs);
+	for (int i = 0; i < n_threads; i++) {
+		batch.defs[i] = malloc(tm_db_def_size(db));
+		struct tape_t *tape = flat_tape_init_any();
+		batch.runs[i] = tm_run_init(NULL, 1, &tape);
+		if (decide)
+			batch.runs[i]->decider = tm_cycler_init();
+	}
+
+	tm_batch_for(n_defs, n_threads, batch_run_db_item, &batch);
+
+	for (int i = 0; i < n_threads; i++) {
+		struct tape_t *const tape = batch.runs[i]->tapes[0];
+		tape->free(tape);
+		if (batch.runs[i]->decider)
+			batch.runs[i]->decider->free(batch.runs[i]->decider);
+		tm_run_free(batch.runs[i]);
+		free(batch.defs[i]);
+	}
+	free(batch.defs);
+	free(batch.runs);
+}
+
+/*
+ * The per-worker state of tm_batch_run_db_lanes(), with room to decode one block of TMs.
+ */
+struct batch_lanes_worker_t {
+	struct tm_lanes_t *lanes;
+	unsigned char *defs_mem;		// BATCH_LANES_BLOCK definitions of def_stride bytes each
+	const struct tm_def_t **defs;	// the valid definitions of the block
+	int *items;						// the index in the block of each valid definition
+	struct tm_result_t *results;	// the result of each valid definition
+};
+
+/*
+ * The context of tm_batch_run_db_lanes().
+ */
+struct batch_run_db_lanes_t {
+	const struct tm_db_t *db;
+	int first;
+	int n_defs;
+	size_t def_stride;
+	step_t max_steps;
+	struct tm_result_t *results;
+	struct batch_lanes_worker_t *workers;
+};
+
+static void batch_run_db_lanes_block(void *const ctx, const int worker, const int block)
+{
+	const struct batch_run_db_lanes_t *const batch = ctx;
+	const struct batch_lanes_worker_t *const w = batch->workers + worker;
+	const int first = block * BATCH_LANES_BLOCK;
+	const int n = batch->n_defs - first < BATCH_LANES_BLOCK ? batch->n_defs - first : BATCH_LANES_BLOCK;
+
+	int n_valid = 0;
+	for (int i = 0; i < n; i++) {
+		struct tm_def_t *const def = (struct tm_def_t *) (void *) (w->defs_mem + (size_t) i * batch->def_stride);
+		if (tm_db_decode(batch->db, batch->first + first + i, def) != 0) {
+			batch->results[first + i].steps = 0;
+			batch->results[first + i].stop = TM_RUNNING;
+			continue;
+		}
+		w->defs[n_valid] = def;
+		w->items[n_valid++] = i;
+	}
+	tm_lanes_run(w->lanes, w->defs, n_valid, batch->max_steps, w->results);
+	for (int i = 0; i < n_valid; i++)
+		batch->results[first + w->items[i]] = w->results[i];
+}
+
+/*
+ * Same as tm_batch_run_db(), but each worker decodes blocks of TMs and runs them in lockstep
+ * lanes, see tm_lanes.c.
+ */
+void tm_batch_run_db_lanes(const struct tm_db_t *const db, const int first, const int n_defs, const step_t max_steps, const int n_threads, struct tm_result_t *const results)
+{
+	assert(first >= 0 && n_defs >= 0 && first + n_defs <= tm_db_count(db));
+	struct batch_run_db_lanes_t batch;
+	batch.db = db;
+	batch.first = first;
+	batch.n_defs = n_defs;
+	// Keep every definition aligned, as they are packed into one buffer
+	batch.def_stride = (tm_db_def_size(db) + sizeof (long long) - 1) / sizeof (long long) * sizeof (long long);
+	batch.max_steps = max_steps;
+	batch.results = results;
+	batch.workers = malloc((size_t) n_threads * sizeof *batch.workers);
+	for (int i = 0; i < n_threads; i++) {
+		struct batch_lanes_worker_t *const w = batch.workers + i;
+		w->lanes = tm_lanes_init();
+		w->defs_mem = malloc(BATCH_LANES_BLOCK * batch.def_stride);
+		w->defs = malloc(BATCH_LANES_BLOCK * sizeof *w->defs);
+		w->items = malloc(BATCH_LANES_BLOCK * sizeof *w->items);
+		w->results = malloc(BATCH_LANES_BLOCK * sizeof *w->results);
+	}
+
+	const int n_blocks = (n_defs + BATCH_LANES_BLOCK - 1) / BATCH_LANES_BLOCK;
+	tm_batch_for(n_blocks, n_threads, batch_run_db_lanes_block, &batch);
+
+	for (int i = 0; i < n_threads; i++) {
+		struct batch_lanes_worker_t *const w = batch.workers + i;
+		tm_lanes_free(w->lanes);
+		free(w->defs_mem);
+		free(w->defs);
+		free(w->items);
+		free(w->results);
+	}
+	free(batch.workers);
+}
@@ -0,0 +1,24 @@
+// Running many independent TMs in parallel
+#ifndef TM_BATCH_H
+#define TM_BATCH_H
+
+#include "tm_def.h"
+#include "tm_run.h"
+#include "util.h"
+
+/*
+ * The work done for one item, fn(ctx, worker, item) with 0 <= worker < n_threads.
+ */
+typedef void (*tm_batch_fn_t)(void *ctx, int worker, int item);
+
+int tm_batch_default_threads(void);
+void tm_batch_for(int n_items, int n_threads, tm_batch_fn_t fn, void *ctx);
+void tm_batch_run(const struct tm_def_t *const *defs, int n_defs, step_t max_steps, int n_threads, struct tm_result_t *results);
+void tm_batch_run_lanes(const struct tm_def_t *const *defs, int n_defs, step_t max_steps, int n_threads, struct tm_result_t *results);
+
+struct tm_db_t;
+struct tm_sink_t;
+void tm_batch_run_db(const struct tm_db_t *db, int first, int n_defs, step_t max_steps, int n_threads, int decide, struct tm_result_t *results, struct tm_sink_t *sink);
+void tm_batch_run_db_lanes(const struct tm_db_t *db, int first, int n_defs, step_t max_steps, int n_threads, struct tm_result_t *results);
+
+#endif
@@ -0,0 +1,381 @@
+// Needed for fork() and fsync() with -std=c99
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tape.h"
+#include "tm_def.h"
+#include "tm_run.h"
+#include "util.h"
+
+#include "tm_ckpt.h"
+
+/*
+ * This file saves runs to checkpoint files, so that a long run that is killed can be resumed
+ * from its last checkpoint instead of from the start.
+ *
+ * A checkpoint holds the machine, the state, the step count and the tape, but not the tape
+ * representation: the tape is stored as runs of equal symbols, see the runs method of tape_t,
+ * and resuming writes it to whatever tapes the new run has. All numbers are unsigned LEB128
+ * varints, with signed ones zigzag encoded, except for the step count, which is 8 bytes
+ * little-endian. The layout is:
+ *
+ *   "TMCK" CKPT_VERSION n_syms n_states
+ *   n_states * n_syms transitions of 3 bytes: symbol, direction and next state
+ *   state steps first head n_runs
+ *   n_runs runs of a symbol byte and a length
+ *
+ * where first and head are the positions of the first cell of the runs and of the head,
+ * relative to the origin. Files are written to a temporary file which is then renamed, so
+ * that a crash while writing leaves the previous checkpoint intact.
+ *
+ * Writing a checkpoint walks the whole tape, so tm_ckpt_poll() does it in a forked process,
+ * which gets a copy-on-write snapshot of the run for free, and the run continues right away.
+ */
+
+#define CKPT_VERSION 1
+
+/*
+ * A growable byte buffer that a checkpoint is encoded into.
+ */
+struct ckpt_buf_t {
+	unsigned char *mem;
+	size_t len;
+	size_t cap;
+};
+
+/*
+ * Collects the runs of a tape, merging neighbours with the same symbol.
+ */
+struct ckpt_runs_t {
+	struct ckpt_buf_t buf;		// the runs written so far
+	unsigned long long n_runs;	// the number of runs in buf
+};
+
+static void ckpt_put(struct ckpt_buf_t *const buf, const unsigned char byte)
+{
+	if (buf->len == buf->cap) {
+		buf->cap = buf->cap ? 2 * buf->cap : 256;
+		buf->mem = realloc(buf->mem, buf->cap);
+	}
+	buf->mem[buf->len++] = byte;
+}
+
+static void ckpt_put_uvar(struct ckpt_buf_t *const buf, unsigned long long val)
+{
+	while (val >= 0x80) {
+		ckpt_put(buf, (unsigned char) (val | 0x80));
+		val >>= 7;
+	}
+	ckpt_put(buf, (unsigned char) val);
+}
+
+static void ckpt_put_svar(struct ckpt_buf_t *const buf, const long long val)
+{
+	ckpt_put_uvar(buf, val < 0 ? 2 * (unsigned long long) -(val + 1) + 1 : 2 * (unsigned long long) val);
+}
+
+static void ckpt_add_run(void *const ctx, const sym_t sym, const int len)
+{
+	struct ckpt_runs_t *const runs = ctx;
+	assert(len > 0);
+	ckpt_put(&runs->buf, sym);
+	ckpt_put_uvar(&runs->buf, (unsigned long long) len);
+	runs->n_runs++;
+}
+
+/*
+ * Writes a checkpoint of the run to path, see above. All tapes of a run have the same
+ * contents, so we save the first one. Returns 0 on success, or -1 if the file could not
+ * be written, which is not fatal, as the run itself is fine.
+ */
+int tm_ckpt_write(const struct tm_run_t *const run, const char *const path)
+{
+	const struct tape_t *tape = NULL;
+	for (int i = 0; i < MAX_TAPES && !tape; i++)
+		tape = run->tapes[i];
+	assert(tape && tape->runs);
+
+	struct ckpt_runs_t runs = {{NULL, 0, 0}, 0};
+	int head;
+	const int first = tape->runs(tape, ckpt_add_run, &runs, &head);
+
+	const struct tm_def_t *const def = run->def;
+	struct ckpt_buf_t buf = {NULL, 0, 0};
+	const char *const magic = "TMCK";
+	for (int i = 0; i < 4; i++)
+		ckpt_put(&buf, (unsigned char) magic[i]);
+	ckpt_put(&buf, CKPT_VERSION);
+	ckpt_put_uvar(&buf, (unsigned long long) def->n_syms);
+	ckpt_put_uvar(&buf, (unsigned long long) def->n_states);
+	for (int i = 0; i < def->n_states * def->n_syms; i++) {
+		ckpt_put(&buf, def->instr_tab[i].sym);
+		ckpt_put(&buf, def->instr_tab[i].dir);
+		ckpt_put(&buf, def->instr_tab[i].state);
+	}
+	ckpt_put(&buf, run->state);
+	for (int i = 0; i < 8; i++)
+		ckpt_put(&buf, (unsigned char) ((unsigned long long) run->steps >> (8 * i)));
+	ckpt_put_svar(&buf, first);
+	ckpt_put_svar(&buf, head);
+	ckpt_put_uvar(&buf, runs.n_runs);
+
+	// Write to a temporary file first, and only replace the old checkpoint once it is on disk
+	const size_t tmp_len = strlen(path) + sizeof ".tmp";
+	char *const tmp_path = malloc(tmp_len);
+	(void) snprintf(tmp_path, tmp_len, "%s.tmp", path);
+	int ok = 0;
+	FILE *const file = fopen(tmp_path, "wb");
+	if (file) {
+		ok = fwrite(buf.mem, 1, buf.len, file) == buf.len
+			&& fwrite(runs.buf.mem, 1, runs.buf.len, file) == runs.buf.len
+			&& fflush(file) == 0
+			&& fsync(fileno(file)) == 0;
+		ok = fclose(file) == 0 && ok;
+		ok = ok && rename(tmp_path, path) == 0;
+	}
+	if (!ok)
+		WARN("Could not write checkpoint %s.\n", path);
+
+	free(tmp_path);
+	free(buf.mem);
+	free(runs.buf.mem);
+	return ok ? 0 : -1;
+}
+
+/*
+ * A cursor into a checkpoint that is being decoded, which errors on truncated input.
+ */
+struct ckpt_in_t {
+	const unsigned char *mem;
+	size_t len;
+	size_t pos;
+	const char *path;	// for error messages
+};
+
+static unsigned char ckpt_get(struct ckpt_in_t *const in)
+{
+	if (in->pos >= in->len) {
+		ERROR("Truncated checkpoint %s.\n", in->path);
+	}
+	return in->mem[in->pos++];
+}
+
+static unsigned long long ckpt_get_uvar(struct ckpt_in_t *const in)
+{
+	unsigned long long val = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		const unsigned char byte = ckpt_get(in);
+		val |= (unsigned long long) (byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return val;
+	}
+	ERROR("Invalid number in checkpoint %s.\n", in->path);
+}
+
+/*
+ * Decodes a signed number, which must fit in an int, as all tape positions do.
+ */
+static int ckpt_get_pos(struct ckpt_in_t *const in)
+{
+	const unsigned long long val = ckpt_get_uvar(in);
+	if (val / 2 > INT_MAX) {
+		ERROR("Invalid position in checkpoint %s.\n", in->path);
+	}
+	return val & 1 ? -(int) (val / 2) - 1 : (int) (val / 2);
+}
+
+/*
+ * Whether a run of def can be in the given state, i.e. if it is one of the states of def, or
+ * a halting state that some transition of def goes to.
+ */
+static int ckpt_state_valid(const struct tm_def_t *const def, const state_t state)
+{
+	if (state < def->n_states)
+		return 1;
+	for (int i = 0; i < def->n_states * def->n_syms; i++) {
+		if (def->instr_tab[i].state == state)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Resumes the run from the checkpoint at path, which must be of the same machine, see above.
+ * The tapes of the run are reset and get the saved contents, whatever their representation,
+ * and the deciders are reset. Returns 0 on success, or -1 if there is no checkpoint file, so
+ * that the caller can start from the beginning instead. Errors if the file is malformed.
+ */
+int tm_ckpt_read(struct tm_run_t *const run, const char *const path)
+{
+	FILE *const file = fopen(path, "rb");
+	if (!file)
+		return -1;
+	struct ckpt_buf_t buf = {NULL, 0, 0};
+	int c;
+	while ((c = getc(file)) != EOF)
+		ckpt_put(&buf, (unsigned char) c);
+	if (ferror(file)) {
+		ERROR("Could not read checkpoint %s.\n", path);
+	}
+	(void) fclose(file);
+
+	struct ckpt_in_t in = {buf.mem, buf.len, 0, path};
+	const char *const magic = "TMCK";
+	for (int i = 0; i < 4; i++) {
+		if (ckpt_get(&in) != (unsigned char) magic[i]) {
+			ERROR("%s is not a checkpoint.\n", path);
+		}
+	}
+	const unsigned char version = ckpt_get(&in);
+	if (version != CKPT_VERSION) {
+		ERROR("Unsupported version %u of checkpoint %s.\n", version, path);
+	}
+
+	const struct tm_def_t *const def = run->def;
+	int same = ckpt_get_uvar(&in) == (unsigned long long) def->n_syms;
+	same = ckpt_get_uvar(&in) == (unsigned long long) def->n_states && same;
+	for (int i = 0; same && i < def->n_states * def->n_syms; i++) {
+		same = ckpt_get(&in) == def->instr_tab[i].sym;
+		same = ckpt_get(&in) == def->instr_tab[i].dir && same;
+		same = ckpt_get(&in) == def->instr_tab[i].state && same;
+	}
+	if (!same) {
+		ERROR("Checkpoint %s is of a different machine.\n", path);
+	}
+
+	tm_run_reset(run, def);
+	run->state = ckpt_get(&in);
+	if (!ckpt_state_valid(def, run->state)) {
+		ERROR("Invalid state in checkpoint %s.\n", path);
+	}
+	unsigned long long steps = 0;
+	for (int i = 0; i < 8; i++)
+		steps |= (unsigned long long) ckpt_get(&in) << (8 * i);
+	if (steps > LLONG_MAX) {
+		ERROR("Invalid step count in checkpoint %s.\n", path);
+	}
+	run->steps = (step_t) steps;
+	const int first = ckpt_get_pos(&in);
+	const int head = ckpt_get_pos(&in);
+	const unsigned long long n_runs = ckpt_get_uvar(&in);
+
+	// Write the runs to all tapes at once, keeping all heads at the same position
+	int pos = 0;
+	int end = first;
+	for (unsigned long long r = 0; r < n_runs; r++) {
+		const sym_t sym = ckpt_get(&in);
+		const unsigned long long len = ckpt_get_uvar(&in);
+		if ((int) sym >= def->n_syms || len == 0 || len > (unsigned long long) ((long long) INT_MAX - end)) {
+			ERROR("Invalid run in checkpoint %s.\n", path);
+		}
+		int next_pos = pos;
+		for (int i = 0; i < MAX_TAPES; i++) {
+			if (!run->tapes[i])
+				continue;
+			next_pos = pos;
+			tape_load_run(run->tapes[i], &next_pos, end, sym, (int) len);
+		}
+		pos = next_pos;
+		end += (int) len;
+	}
+	for (int i = 0; i < MAX_TAPES; i++) {
+		if (run->tapes[i]) {
+			int tape_pos = pos;
+			tape_move_to(run->tapes[i], &tape_pos, head);
+		}
+	}
+	if (in.pos != in.len) {
+		ERROR("Trailing data in checkpoint %s.\n", path);
+	}
+	free(buf.mem);
+	return 0;
+}
+
+/*
+ * A periodic checkpoint writer, see tm_ckpt_poll().
+ */
+struct tm_ckpt_t {
+	char *path;
+	double interval;	// seconds between checkpoints
+	double last;		// when the last checkpoint was started
+	pid_t writer;		// the process writing the last checkpoint, or 0 when it is done
+};
+
+/*
+ * Checks on the writer process, waiting for it to finish unless options is WNOHANG.
+ */
+static void ckpt_wait(struct tm_ckpt_t *const ckpt, const int options)
+{
+	int status;
+	const pid_t pid = waitpid(ckpt->writer, &status, options);
+	if (pid == 0)
+		return;
+	if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		WARN("The checkpoint writer of %s failed.\n", ckpt->path);
+	ckpt->writer = 0;
+}
+
+/*
+ * Creates a writer that saves checkpoints to path at most every interval seconds.
+ */
+struct tm_ckpt_t *tm_ckpt_init(const char *const path, const double interval)
+{
+	struct tm_ckpt_t *const ckpt = malloc(sizeof *ckpt);
+	const size_t len = strlen(path) + 1;
+	ckpt->path = malloc(len);
+	memcpy(ckpt->path, path, len);
+	ckpt->interval = interval;
+	ckpt->last = wall_seconds();
+	ckpt->writer = 0;
+	return ckpt;
+}
+
+/*
+ * Call this between batches of steps of a long run. When the last checkpoint is more than
+ * the interval old and has been written, forks a process that writes a new one, while the
+ * run continues in this process. Forking copies only the page tables, and pages are copied
+ * when the run writes to them, so this is much faster than writing the tape ourselves. The
+ * process must be single-threaded, as the child only gets a copy of the calling thread.
+ */
+void tm_ckpt_poll(struct tm_ckpt_t *const ckpt, const struct tm_run_t *const run)
+{
+	if (ckpt->writer)
+		ckpt_wait(ckpt, WNOHANG);
+	const double now = wall_seconds();
+	if (ckpt->writer || now - ckpt->last < ckpt->interval)
+		return;
+
+	const pid_t pid = fork();
+	if (pid == 0) {
+		// Skip exit handlers and stdio buffers, which belong to the parent
+		_exit(tm_ckpt_write(run, ckpt->path) == 0 ? 0 : 1);
+	}
+	if (pid < 0) {
+		WARN("Could not fork a checkpoint writer, writing %s directly.\n", ckpt->path);
+		(void) tm_ckpt_write(run, ckpt->path);
+	} else {
+		ckpt->writer = pid;
+	}
+	ckpt->last = now;
+}
+
+/*
+ * Waits for the last checkpoint to be written, and frees the writer.
+ */
+void tm_ckpt_free(struct tm_ckpt_t *const ckpt)
+{
+	if (ckpt->writer)
+		ckpt_wait(ckpt, 0);
+	free(ckpt->path);
+	free(ckpt);
+}
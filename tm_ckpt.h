@@ -0,0 +1,17 @@
+// Saving long runs to checkpoint files and resuming them
+#ifndef TM_CKPT_H
+#define TM_CKPT_H
+
+#include "tm_run.h"
+#include "util.h"
+
+struct tm_ckpt_t;
+
+int tm_ckpt_write(const struct tm_run_t *run, const char *path);
+int tm_ckpt_read(struct tm_run_t *run, const char *path);
+
+struct tm_ckpt_t *tm_ckpt_init(const char *path, double interval);
+void tm_ckpt_poll(struct tm_ckpt_t *ckpt, const struct tm_run_t *run);
+void tm_ckpt_free(struct tm_ckpt_t *ckpt);
+
+#endif
@@ -0,0 +1,237 @@
+// Needed for mmap() flags and madvise() with -std=c99
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tape.h"
+#include "tm_def.h"
+#include "util.h"
+
+#include "tm_db.h"
+
+/*
+ * This file reads lists of TMs from files, without reading the whole file into memory.
+ *
+ * The file is mapped read-only and records are decoded on demand, straight from the mapping
+ * into a tm_def_t provided by the caller. Thus a batch runner needs one definition buffer per
+ * worker, see tm_db_def_size(), no matter how many TMs there are, and the kernel takes care
+ * of reading ahead and dropping pages we are done with.
+ *
+ * The bbchallenge seed database starts with a 30-byte header, whose first 12 bytes are three
+ * big-endian 32-bit counts, followed by one 30-byte record per TM. A record has 5 states with
+ * 2 symbols each, and each transition is 3 bytes: the symbol to write (0 or 1), the direction
+ * (0 is right and 1 is left) and the next state (0 is undefined, i.e. halt, and 1-5 is A-E).
+ */
+
+#define BBC_HEADER_SIZE TM_DB_BBC_HEADER_SIZE
+#define BBC_RECORD_SIZE TM_DB_BBC_RECORD_SIZE
+#define BBC_N_STATES 5
+#define BBC_N_SYMS 2
+
+struct tm_db_t {
+	enum tm_db_format_t format;
+	const unsigned char *mem;	// the mapped file, or NULL if it is empty
+	size_t size;				// size of the file in bytes
+	int n_defs;					// number of TMs in the file
+	size_t *lines;				// for TM_DB_TEXT, offset of the start of each TM
+	size_t def_size;			// enough bytes for any TM in the file
+};
+
+static int is_space(const unsigned char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/*
+ * Finds the start of each non-empty line in a text file, skipping lines that start with #.
+ * This is the only pass over the whole file, and also finds the longest TM, to bound the size
+ * of its definition.
+ */
+static void tm_db_index_text(struct tm_db_t *const db)
+{
+	// Count first, so that the index is a single allocation
+	for (int pass = 0; pass < 2; pass++) {
+		int n_lines = 0;
+		size_t max_len = 0;
+		size_t pos = 0;
+		while (pos < db->size) {
+			while (pos < db->size && is_space(db->mem[pos]))
+				pos++;
+			if (pos >= db->size)
+				break;
+			const size_t start = pos;
+			while (pos < db->size && db->mem[pos] != '\n')
+				pos++;
+			if (db->mem[start] == '#')
+				continue;
+			size_t len = 0;
+			while (start + len < pos && !is_space(db->mem[start + len]))
+				len++;
+			if (len > max_len)
+				max_len = len;
+			if (n_lines == INT_MAX) {
+				ERROR("Too many lines in text file.\n");
+			}
+			if (pass == 1)
+				db->lines[n_lines] = start;
+			n_lines++;
+		}
+		if (pass == 0) {
+			db->n_defs = n_lines;
+			db->lines = malloc((size_t) (n_lines > 0 ? n_lines : 1) * sizeof *db->lines);
+			db->def_size = tm_def_parse_bound(max_len);
+		}
+	}
+}
+
+/*
+ * Maps the file at path, and finds the TMs in it. Errors if the file can not be read, or
+ * is not in the given format. Individual malformed records are only found when decoding.
+ */
+struct tm_db_t *tm_db_open(const char *const path, const enum tm_db_format_t format)
+{
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		ERROR("Could not open %s.\n", path);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		ERROR("Could not stat %s.\n", path);
+	}
+
+	struct tm_db_t *const db = malloc(sizeof *db);
+	db->format = format;
+	db->size = (size_t) st.st_size;
+	db->mem = NULL;
+	db->lines = NULL;
+	if (db->size > 0) {
+		void *const mem = mmap(NULL, db->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mem == MAP_FAILED) {
+			ERROR("Could not map %zu bytes of %s.\n", db->size, path);
+		}
+#ifdef MADV_SEQUENTIAL
+		// Batches are decoded mostly in order, so aggressive read-ahead pays off
+		(void) madvise(mem, db->size, MADV_SEQUENTIAL);
+#endif
+		db->mem = mem;
+	}
+	// The mapping keeps the file alive
+	close(fd);
+
+	switch (format) {
+	case TM_DB_BBCHALLENGE:
+		if (db->size < BBC_HEADER_SIZE || (db->size - BBC_HEADER_SIZE) % BBC_RECORD_SIZE != 0) {
+			ERROR("Invalid size %zu of %s, should be a %d-byte header and %d-byte records.\n",
+				db->size, path, BBC_HEADER_SIZE, BBC_RECORD_SIZE);
+		}
+		if ((db->size - BBC_HEADER_SIZE) / BBC_RECORD_SIZE > INT_MAX) {
+			ERROR("Too many records in %s.\n", path);
+		}
+		db->n_defs = (int) ((db->size - BBC_HEADER_SIZE) / BBC_RECORD_SIZE);
+		db->def_size = tm_def_size(BBC_N_SYMS, BBC_N_STATES);
+		break;
+	case TM_DB_TEXT:
+		tm_db_index_text(db);
+		break;
+	default:
+		ERROR("Invalid database format %d.\n", format);
+	}
+	return db;
+}
+
+void tm_db_close(struct tm_db_t *const db)
+{
+	if (db->mem)
+		munmap((void *) (uintptr_t) db->mem, db->size);
+	free(db->lines);
+	free(db);
+}
+
+int tm_db_count(const struct tm_db_t *const db)
+{
+	return db->n_defs;
+}
+
+/*
+ * The number of bytes of the definition buffer passed to tm_db_decode().
+ */
+size_t tm_db_def_size(const struct tm_db_t *const db)
+{
+	return db->def_size;
+}
+
+static int tm_db_decode_bbchallenge(const struct tm_db_t *const db, const int idx, struct tm_def_t *const def)
+{
+	const unsigned char *const rec = db->mem + BBC_HEADER_SIZE + (size_t) idx * BBC_RECORD_SIZE;
+	def->n_syms = BBC_N_SYMS;
+	def->n_states = BBC_N_STATES;
+	for (int i = 0; i < BBC_N_STATES * BBC_N_SYMS; i++) {
+		const unsigned char sym = rec[3 * i];
+		const unsigned char dir = rec[3 * i + 1];
+		const unsigned char state = rec[3 * i + 2];
+		if (sym >= BBC_N_SYMS || dir > 1 || state > BBC_N_STATES)
+			return -1;
+		// Write the table directly, as the layout is the same
+		def->instr_tab[i].sym = sym;
+		def->instr_tab[i].state = state == 0 ? STATE_UNDEF : (state_t) (state - 1);
+		def->instr_tab[i].dir = dir == 1 ? DIR_LEFT : DIR_RIGHT;
+	}
+	return 0;
+}
+
+static int tm_db_decode_text(const struct tm_db_t *const db, const int idx, struct tm_def_t *const def)
+{
+	const size_t start = db->lines[idx];
+	size_t len = 0;
+	while (start + len < db->size && !is_space(db->mem[start + len]))
+		len++;
+	const char *const txt = (const char *) db->mem + start;
+	return tm_def_parse_into(txt, len, def, db->def_size, NULL) == TM_PARSE_OK ? 0 : -1;
+}
+
+/*
+ * Encodes def as a bbchallenge record, the inverse of decoding. Returns -1 if def does not
+ * fit, i.e. if it has more than 5 states or not exactly 2 symbols. Missing states are padded
+ * with undefined transitions.
+ */
+int tm_db_encode_bbchallenge(const struct tm_def_t *const def, unsigned char *const rec)
+{
+	if (def->n_syms != BBC_N_SYMS || def->n_states > BBC_N_STATES)
+		return -1;
+	memset(rec, 0, BBC_RECORD_SIZE);
+	for (int i = 0; i < def->n_states * BBC_N_SYMS; i++) {
+		const struct tm_instr_t instr = def->instr_tab[i];
+		rec[3 * i] = (unsigned char) instr.sym;
+		rec[3 * i + 1] = instr.dir == DIR_LEFT ? 1 : 0;
+		rec[3 * i + 2] = (int) instr.state < def->n_states ? (unsigned char) (instr.state + 1) : 0;
+	}
+	return 0;
+}
+
+/*
+ * Decodes TM number idx of the file into def, which must have room for tm_db_def_size(db)
+ * bytes. Returns 0 on success, or -1 if the record is malformed, in which case the contents
+ * of def are unspecified. Decoding different TMs concurrently is fine.
+ */
+int tm_db_decode(const struct tm_db_t *const db, const int idx, struct tm_def_t *const def)
+{
+	assert(idx >= 0 && idx < db->n_defs);
+	switch (db->format) {
+	case TM_DB_BBCHALLENGE:
+		return tm_db_decode_bbchallenge(db, idx, def);
+	case TM_DB_TEXT:
+		return tm_db_decode_text(db, idx, def);
+	default:
+		ERROR("Invalid database format %d.\n", db->format);
+	}
+}
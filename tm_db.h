@@ -0,0 +1,30 @@
+// Memory-mapped lists of TM definitions, for running seed databases
+#ifndef TM_DB_H
+#define TM_DB_H
+
+#include <stddef.h>
+
+#include "tm_def.h"
+
+/*
+ * The supported file formats.
+ */
+enum tm_db_format_t {
+	TM_DB_BBCHALLENGE = 0,	// the bbchallenge seed database, 30-byte records of 5-state 2-symbol TMs
+	TM_DB_TEXT,				// one TM per line in standard text format, e.g. 1RB1LB_1LA1RZ
+};
+
+// Sizes of the bbchallenge format
+#define TM_DB_BBC_HEADER_SIZE 30
+#define TM_DB_BBC_RECORD_SIZE 30
+
+struct tm_db_t;
+
+struct tm_db_t *tm_db_open(const char *path, enum tm_db_format_t format);
+void tm_db_close(struct tm_db_t *db);
+int tm_db_count(const struct tm_db_t *db);
+size_t tm_db_def_size(const struct tm_db_t *db);
+int tm_db_decode(const struct tm_db_t *db, int idx, struct tm_def_t *def);
+int tm_db_encode_bbchallenge(const struct tm_def_t *def, unsigned char *rec);
+
+#endif
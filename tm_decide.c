@@ -0,0 +1,380 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tape.h"
+#include "tape_flat.h"
+#include "tape_rle.h"
+#include "tm_run.h"
+#include "util.h"
+
+#include "tm_decide.h"
+
+/*
+ * This file contains deciders, which run alongside tm_run_steps() and stop machines that
+ * provably never halt, instead of letting them use up their whole step budget.
+ *
+ * The cycler decider finds two kinds of cycles, both with Brent's algorithm: we keep one saved
+ * configuration, compare every new configuration to it, and replace it after a doubling number
+ * of steps, so that any cycle is found within a few periods of entering it.
+ *
+ * An (in-place) cycler returns to the exact same configuration, i.e. the same state, head
+ * position and tape contents. Since the visited span of a flat tape never shrinks, the span
+ * must be the same too, and comparing state, position and span first rules out most cases
+ * without looking at the tape.
+ *
+ * A translated cycler repeats the same behaviour shifted along the tape, moving into blank
+ * tape forever. We only save and compare the configurations where the head is at a new record
+ * position in one direction, say x1 at step t1 and x2 at step t2. If the state is the same at
+ * both, and m is the leftmost head position between t1 and t2, then the head only read the
+ * cells [m, x2] in that time, and the cells right of x1 were blank at t1. So if the cells
+ * [m, x1] at t1 equal the cells [m + d, x2] at t2, where d = x2 - x1, then the next d steps
+ * repeat exactly, shifted by d cells, and so on forever. Left records are the mirror image.
+ */
+
+/*
+ * A saved configuration, with a copy of the visited span of the tape.
+ */
+struct cycler_snap_t {
+	int valid;			// whether anything has been saved yet
+	step_t steps;		// the step at which we saved it
+	state_t state;
+	int pos;			// head position, relative to the origin as all positions
+	int min_pos;		// the saved span of the tape
+	int max_pos;
+	sym_t *syms;		// the symbols of [min_pos, max_pos]
+	int cap;			// number of symbols allocated for syms
+};
+
+/*
+ * The state of the translated cycler search in one direction.
+ */
+struct cycler_records_t {
+	struct cycler_snap_t snap;	// the last saved record configuration
+	int extreme;				// the head position furthest away from the records since snap
+	int n_records;				// number of records since snap
+	int power;					// save again after this many records
+};
+
+struct cycler_t {
+	struct cycler_snap_t snap;			// for in-place cycles
+	step_t power;						// save again after this many steps
+	struct cycler_records_t records[2];	// for translated cycles to the left and right
+	int prev_min;						// the span before the last step, to find records
+	int prev_max;
+};
+
+// Indices into records
+#define CYCLER_LEFT 0
+#define CYCLER_RIGHT 1
+
+static void cycler_save(struct cycler_snap_t *const snap, const struct tm_run_t *const run, const sym_t *const syms, const int pos, const int min_pos, const int max_pos)
+{
+	const int len = max_pos - min_pos + 1;
+	if (len > snap->cap) {
+		free(snap->syms);
+		snap->cap = 2 * len;
+		snap->syms = malloc((size_t) snap->cap * sizeof *snap->syms);
+	}
+	memcpy(snap->syms, syms + min_pos, (size_t) len * sizeof *snap->syms);
+	snap->valid = 1;
+	snap->steps = run->steps;
+	snap->state = run->state;
+	snap->pos = pos;
+	snap->min_pos = min_pos;
+	snap->max_pos = max_pos;
+}
+
+/*
+ * The symbol at a position of a saved tape, which is blank outside of the saved span.
+ */
+static sym_t cycler_snap_read(const struct cycler_snap_t *const snap, const int pos)
+{
+	return snap->min_pos <= pos && pos <= snap->max_pos ? snap->syms[pos - snap->min_pos] : 0;
+}
+
+/*
+ * Checks for a translated cycle at a new record in the given direction, see above. Returns
+ * the period if we found one, 0 otherwise.
+ */
+static step_t cycler_record(struct cycler_records_t *const rec, const int dir, const struct tm_run_t *const run, const sym_t *const syms, const int pos, const int min_pos, const int max_pos)
+{
+	const struct cycler_snap_t *const snap = &rec->snap;
+	if (snap->valid && snap->state == run->state) {
+		const int d = pos - snap->pos;
+		// The cells the head read since the snapshot, on the side away from the record
+		const int lo = dir == CYCLER_RIGHT ? rec->extreme : snap->pos;
+		const int hi = dir == CYCLER_RIGHT ? snap->pos : rec->extreme;
+		int i = lo;
+		while (i <= hi && cycler_snap_read(snap, i) == syms[i + d])
+			i++;
+		if (i > hi)
+			return run->steps - snap->steps;
+	}
+	if (!snap->valid || ++rec->n_records >= rec->power) {
+		cycler_save(&rec->snap, run, syms, pos, min_pos, max_pos);
+		rec->extreme = pos;
+		rec->n_records = 0;
+		rec->power *= 2;
+	}
+	return 0;
+}
+
+/*
+ * Finds the tape of the run with the given move function, i.e. of the given kind.
+ */
+static const struct tape_t *decider_tape(const struct tm_run_t *const run, void (*const move)(struct tape_t *, int))
+{
+	for (int i = 0; i < MAX_TAPES; i++) {
+		if (run->tapes[i] && run->tapes[i]->move == move)
+			return run->tapes[i];
+	}
+	ERROR("The decider needs a tape that the run does not have.\n");
+}
+
+static enum tm_stop_t cycler_step(struct tm_decider_t *const decider, const struct tm_run_t *const run)
+{
+	struct cycler_t *const cyc = decider->data;
+	const struct tape_t *const tape = decider_tape(run, flat_tape_move);
+	int pos, min_pos, max_pos;
+	const sym_t *const syms = flat_tape_span(tape, &pos, &min_pos, &max_pos);
+
+	// In-place cycles
+	struct cycler_snap_t *const snap = &cyc->snap;
+	if (snap->valid && run->state == snap->state && pos == snap->pos && min_pos == snap->min_pos && max_pos == snap->max_pos
+			&& memcmp(snap->syms, syms + min_pos, (size_t) (max_pos - min_pos + 1) * sizeof *syms) == 0) {
+		decider->verdict = TM_CYCLER;
+		decider->period = run->steps - snap->steps;
+		return TM_NONHALT;
+	}
+	if (!snap->valid || run->steps - snap->steps >= cyc->power) {
+		cycler_save(snap, run, syms, pos, min_pos, max_pos);
+		cyc->power *= 2;
+	}
+
+	// Translated cycles
+	struct cycler_records_t *const left = cyc->records + CYCLER_LEFT;
+	struct cycler_records_t *const right = cyc->records + CYCLER_RIGHT;
+	if (pos > left->extreme)
+		left->extreme = pos;
+	if (pos < right->extreme)
+		right->extreme = pos;
+	step_t period = 0;
+	if (min_pos < cyc->prev_min)
+		period = cycler_record(left, CYCLER_LEFT, run, syms, pos, min_pos, max_pos);
+	else if (max_pos > cyc->prev_max)
+		period = cycler_record(right, CYCLER_RIGHT, run, syms, pos, min_pos, max_pos);
+	cyc->prev_min = min_pos;
+	cyc->prev_max = max_pos;
+	if (period > 0) {
+		decider->verdict = TM_TRANSLATED_CYCLER;
+		decider->period = period;
+		return TM_NONHALT;
+	}
+	return TM_RUNNING;
+}
+
+static void cycler_reset(struct tm_decider_t *const decider)
+{
+	struct cycler_t *const cyc = decider->data;
+	cyc->snap.valid = 0;
+	cyc->power = 1;
+	for (int i = 0; i < 2; i++) {
+		cyc->records[i].snap.valid = 0;
+		cyc->records[i].power = 1;
+		cyc->records[i].n_records = 0;
+		cyc->records[i].extreme = 0;
+	}
+	cyc->prev_min = 0;
+	cyc->prev_max = 0;
+	decider->verdict = TM_UNDECIDED;
+	decider->period = 0;
+}
+
+static void cycler_free(struct tm_decider_t *const decider)
+{
+	struct cycler_t *const cyc = decider->data;
+	free(cyc->snap.syms);
+	for (int i = 0; i < 2; i++)
+		free(cyc->records[i].snap.syms);
+	free(cyc);
+	free(decider);
+}
+
+/*
+ * Creates a decider for cyclers and translated cyclers. It can only be used with runs that
+ * have a flat tape.
+ */
+struct tm_decider_t *tm_cycler_init(void)
+{
+	struct cycler_t *const cyc = malloc(sizeof *cyc);
+	cyc->snap.syms = NULL;
+	cyc->snap.cap = 0;
+	for (int i = 0; i < 2; i++) {
+		cyc->records[i].snap.syms = NULL;
+		cyc->records[i].snap.cap = 0;
+	}
+
+	struct tm_decider_t *const decider = malloc(sizeof *decider);
+	decider->data = cyc;
+	decider->free = cycler_free;
+	decider->step = cycler_step;
+	decider->reset = cycler_reset;
+	decider->next = NULL;
+	cycler_reset(decider);
+	return decider;
+}
+
+/*
+ * The bouncer decider looks for machines whose tape, seen as runs of equal symbols, keeps the
+ * same shape while some runs grow linearly, e.g. a head bouncing between the ends of a tape
+ * that grows by a cell per sweep. We take a record of the tape at every new record position
+ * of the head, and look for a period of k records over which the state, the direction of the
+ * record and the sequence of run symbols repeat, the run lengths grow by the same amounts,
+ * and the number of steps between records grows by the same amount, i.e. has a constant second
+ * difference. When this holds for enough records in a row, the machine is very likely a
+ * bouncer, but this is not a proof, so the verdict is TM_SUSPECT. Counters, whose run lengths
+ * grow exponentially, are not found this way.
+ */
+
+// Records with more runs than this are ignored
+#define BOUNCER_MAX_RUNS 64
+// The longest period (in records) that we look for
+#define BOUNCER_MAX_PERIOD 8
+// Number of records kept, enough to compare four records k apart for every period k
+#define BOUNCER_HISTORY (3 * BOUNCER_MAX_PERIOD + 1)
+
+struct bouncer_record_t {
+	step_t steps;
+	state_t state;
+	int dir;						// CYCLER_LEFT or CYCLER_RIGHT
+	int n_runs;						// -1 if there were too many runs
+	sym_t syms[BOUNCER_MAX_RUNS];	// the symbol of each run, from left to right
+	int lens[BOUNCER_MAX_RUNS];		// the length of each run
+};
+
+struct bouncer_t {
+	struct bouncer_record_t history[BOUNCER_HISTORY];	// a ring buffer of records
+	int n_records;										// total number of records
+	int min_pos;										// the visited span of the tape
+	int max_pos;
+	int threshold;			// number of confirmations in a row needed for a verdict
+	int period;				// the period of the last confirmation, in records
+	int confirmations;		// number of confirmations in a row with that period
+};
+
+static const struct bouncer_record_t *bouncer_history(const struct bouncer_t *const bnc, const int back)
+{
+	return bnc->history + (bnc->n_records - 1 - back) % BOUNCER_HISTORY;
+}
+
+/*
+ * Checks whether the last four records, each k records apart, look like a bouncer.
+ */
+static int bouncer_match(const struct bouncer_t *const bnc, const int k)
+{
+	const struct bouncer_record_t *r[4];
+	for (int i = 0; i < 4; i++) {
+		r[i] = bouncer_history(bnc, i * k);
+		if (r[i]->n_runs < 0 || r[i]->n_runs != r[0]->n_runs || r[i]->state != r[0]->state || r[i]->dir != r[0]->dir)
+			return 0;
+		if (memcmp(r[i]->syms, r[0]->syms, (size_t) r[0]->n_runs * sizeof *r[0]->syms) != 0)
+			return 0;
+	}
+	// The record furthest back comes first in time
+	int grows = 0;
+	for (int j = 0; j < r[0]->n_runs; j++) {
+		const int d = r[0]->lens[j] - r[1]->lens[j];
+		if (d < 0 || r[1]->lens[j] - r[2]->lens[j] != d || r[2]->lens[j] - r[3]->lens[j] != d)
+			return 0;
+		grows |= d > 0;
+	}
+	const step_t dd1 = r[0]->steps - 2 * r[1]->steps + r[2]->steps;
+	const step_t dd2 = r[1]->steps - 2 * r[2]->steps + r[3]->steps;
+	return grows && dd1 == dd2;
+}
+
+static enum tm_stop_t bouncer_step(struct tm_decider_t *const decider, const struct tm_run_t *const run)
+{
+	struct bouncer_t *const bnc = decider->data;
+	const struct tape_t *const tape = decider_tape(run, rle_tape_move);
+	const int pos = rle_tape_pos(tape);
+	int dir;
+	if (pos < bnc->min_pos)
+		dir = CYCLER_LEFT;
+	else if (pos > bnc->max_pos)
+		dir = CYCLER_RIGHT;
+	else
+		return TM_RUNNING;
+	if (pos < bnc->min_pos)
+		bnc->min_pos = pos;
+	if (pos > bnc->max_pos)
+		bnc->max_pos = pos;
+
+	struct bouncer_record_t *const rec = bnc->history + bnc->n_records % BOUNCER_HISTORY;
+	bnc->n_records++;
+	rec->steps = run->steps;
+	rec->state = run->state;
+	rec->dir = dir;
+	rec->n_runs = rle_tape_copy_runs(tape, rec->syms, rec->lens, BOUNCER_MAX_RUNS);
+
+	// Take the shortest period that matches
+	int k = 1;
+	while (k <= BOUNCER_MAX_PERIOD && (3 * k >= bnc->n_records || !bouncer_match(bnc, k)))
+		k++;
+	if (k > BOUNCER_MAX_PERIOD) {
+		bnc->confirmations = 0;
+		return TM_RUNNING;
+	}
+	if (k == bnc->period) {
+		bnc->confirmations++;
+	} else {
+		bnc->period = k;
+		bnc->confirmations = 1;
+	}
+	if (bnc->confirmations >= bnc->threshold) {
+		decider->verdict = TM_BOUNCER;
+		decider->period = run->steps - bouncer_history(bnc, k)->steps;
+		return TM_SUSPECT;
+	}
+	return TM_RUNNING;
+}
+
+static void bouncer_reset(struct tm_decider_t *const decider)
+{
+	struct bouncer_t *const bnc = decider->data;
+	bnc->n_records = 0;
+	bnc->min_pos = 0;
+	bnc->max_pos = 0;
+	bnc->period = 0;
+	bnc->confirmations = 0;
+	decider->verdict = TM_UNDECIDED;
+	decider->period = 0;
+}
+
+static void bouncer_free(struct tm_decider_t *const decider)
+{
+	free(decider->data);
+	free(decider);
+}
+
+/*
+ * Creates a decider that suspects bouncers, see above, after threshold matching records in a
+ * row. It can only be used with runs that have an RLE tape.
+ */
+struct tm_decider_t *tm_bouncer_init(const int threshold)
+{
+	assert(threshold > 0);
+	struct bouncer_t *const bnc = malloc(sizeof *bnc);
+	bnc->threshold = threshold;
+
+	struct tm_decider_t *const decider = malloc(sizeof *decider);
+	decider->data = bnc;
+	decider->free = bouncer_free;
+	decider->step = bouncer_step;
+	decider->reset = bouncer_reset;
+	decider->next = NULL;
+	bouncer_reset(decider);
+	return decider;
+}
@@ -0,0 +1,11 @@
+// Deciders that prove some machines never halt, see struct tm_decider_t
+#ifndef TM_DECIDE_H
+#define TM_DECIDE_H
+
+#include "tm_run.h"
+#include "util.h"
+
+struct tm_decider_t *tm_cycler_init(void);
+struct tm_decider_t *tm_bouncer_init(int threshold);
+
+#endif
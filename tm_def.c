@@ -38,17 +38,51 @@ struct tm_instr_t tm_def_lookup(const struct tm_def_t *const def, const state_t
 }
 
 /*
- * Allocates an empty transition table of the specified size. We must fill it with states
- * before running.
+ * The number of bytes needed to store a transition table of the specified size, for callers
+ * that provide their own storage.
  */
-static struct tm_def_t *tm_def_init(const int n_syms, const int n_states)
+size_t tm_def_size(const int n_syms, const int n_states)
 {
 	assert(n_syms > 0 && n_states > 0);
 	const size_t tab_size = (size_t) n_syms * (size_t) n_states;
-	struct tm_def_t *def = malloc(sizeof *def + tab_size * sizeof *def->instr_tab);
-	def->n_syms = n_syms;
-	def->n_states = n_states;
-	return def;
+	return sizeof (struct tm_def_t) + tab_size * sizeof (struct tm_instr_t);
+}
+
+/*
+ * Builds the hot encoding of the transition table, see tm_hot_t, into hot_tab which must have
+ * room for n_syms * n_states entries.
+ */
+void tm_def_hot(const struct tm_def_t *const def, tm_hot_t *const hot_tab)
+{
+	const int tab_size = def->n_syms * def->n_states;
+	for (int i = 0; i < tab_size; i++) {
+		const struct tm_instr_t instr = def->instr_tab[i];
+		const int delta = instr.dir == DIR_LEFT ? -1 : 1;
+		const int row = instr.state * def->n_syms;
+		// Always fits, as state_t and sym_t are both bytes
+		assert(row <= 0xFFFF);
+		hot_tab[i] = HOT_MAKE(instr.sym, delta, row);
+	}
+}
+
+/*
+ * Builds direct-threaded code for the transition table, see struct tm_thread_op_t, with the
+ * given handlers into code which must have room for n_syms * n_states entries.
+ */
+void tm_def_thread(const struct tm_def_t *const def, const void *const *const handlers, struct tm_thread_op_t *const code)
+{
+	const int tab_size = def->n_syms * def->n_states;
+	for (int i = 0; i < tab_size; i++) {
+		const struct tm_instr_t instr = def->instr_tab[i];
+		const int halts = instr.state >= def->n_states;
+		if (instr.dir == DIR_LEFT)
+			code[i].handler = handlers[halts ? THREAD_LEFT_HALT : THREAD_LEFT];
+		else
+			code[i].handler = handlers[halts ? THREAD_RIGHT_HALT : THREAD_RIGHT];
+		code[i].next = halts ? NULL : code + instr.state * def->n_syms;
+		code[i].sym = instr.sym;
+		code[i].state = instr.state;
+	}
 }
 
 /*
@@ -61,90 +95,154 @@ void tm_def_free(struct tm_def_t *const def)
 
 #define ONLY_ALNUM(c) ((c) != 0 ? (c) : '?')
 
-/* Parses a Turing Machine from a given standard text format
- * e.g. "1RB1LB_1LA1LZ". This is a bit ugly to deal with
- * possible input format errors...
+/*
+ * An upper bound on the size of a TM definition parsed from len characters of text, as each
+ * transition takes at least three characters.
  */
-struct tm_def_t *tm_def_parse(const char *const txt)
+size_t tm_def_parse_bound(const size_t len)
 {
-	// Find first underscore and thus number of columns
-	int cols = 0;
-	while(txt[cols] != 0 && txt[cols] != '_')
-		cols++;
+	assert(len / 3 + 1 <= INT_MAX);
+	return tm_def_size(1, (int) (len / 3 + 1));
+}
 
-	if (cols % 3 != 0) {
-		ERROR("Invalid width %d of row, should be divisible by 3.\n", cols);
+/*
+ * A description of a parse error, for printing.
+ */
+const char *tm_parse_err_str(const enum tm_parse_err_t err)
+{
+	switch (err) {
+	case TM_PARSE_OK: return "no error";
+	case TM_PARSE_WIDTH: return "invalid row width, should be divisible by 3";
+	case TM_PARSE_LENGTH: return "invalid length, should be a whole number of rows";
+	case TM_PARSE_SYM: return "invalid symbol";
+	case TM_PARSE_DIR: return "invalid direction, should be L or R";
+	case TM_PARSE_STATE: return "invalid state, should be A-Z";
+	case TM_PARSE_TERM: return "invalid row terminator, should be underscore";
+	case TM_PARSE_SPACE: return "definition does not fit in the buffer";
+	default: return "unknown error";
 	}
-	const int n_syms = cols / 3;
-
-	const size_t len = strlen(txt);
-	// Each row contains three characters per sym, and one underscode for each except the last row
-	// We check that the string is well-formed below, so no length check here
-	// Also this cast is OK because the number of states should fit in an int
-	const int n_states = ((int) len + 1) / (n_syms * 3 + 1);
+}
 
-	struct tm_def_t *def = tm_def_init(n_syms, n_states);
+/*
+ * Parses a Turing Machine from the first len characters of txt, in the standard text format
+ * e.g. "1RB1LB_1LA1LZ", into def which has room for cap bytes. The text does not need to
+ * be NUL-terminated. The first row is scanned twice, once to find its underscore and again
+ * to parse it, and every other character is only looked at once. On error, nothing is
+ * allocated or printed, the error is returned and the index of the offending character is
+ * stored in err_pos if it is not NULL. The contents of def are then unspecified.
+ * Use tm_def_parse_bound() to get a large enough cap for any input of a given length.
+ */
+enum tm_parse_err_t tm_def_parse_into(const char *const txt, const size_t len, struct tm_def_t *const def, const size_t cap, size_t *const err_pos)
+{
+	size_t dummy_pos;
+	size_t *const pos = err_pos ? err_pos : &dummy_pos;
 
-	for (state_t i_state = 0; i_state < (state_t) def->n_states; i_state++) {
-		for (sym_t i_sym = 0; i_sym < (sym_t) def->n_syms; i_sym++) {
-			const int txt_idx = i_state * (def->n_syms * 3 + 1) + i_sym * 3; // base index into txt
-
-			const char sym_c = txt[txt_idx];
-			if (!sym_c || sym_c < '0' || sym_c - '0' >= def->n_syms) {
-				// Allow unused states only if all three chars are '-'
-				// NB. short-circuiting prevents reading past end of string here
-				if (sym_c == '-' && txt[txt_idx + 1] == '-' && txt[txt_idx + 2] == '-') {
-					const struct tm_instr_t instr = {
-						0, 				// dummy, will not be read
-						STATE_UNDEF,	// halting state
-						DIR_LEFT, 		// dummy, will not be read
-					};
-					tm_def_store(def, i_state, i_sym, instr);
-					continue;
-				}
-				ERROR("Invalid symbol %c at row %d col %d, should be 0-%c.\n",
-					ONLY_ALNUM(sym_c), i_state, i_sym, '0' + def->n_syms - 1);
-			}
+	// Find first underscore and thus number of columns
+	size_t cols = 0;
+	while (cols < len && txt[cols] != '_')
+		cols++;
+	*pos = cols;
+	if (cols == 0 || cols % 3 != 0 || cols / 3 > 10)
+		return TM_PARSE_WIDTH;
+	// Each row contains three characters per sym, and one underscore for each except the last row
+	const size_t row_len = cols + 1;
+	*pos = len;
+	if ((len + 1) % row_len != 0 || (len + 1) / row_len > STATE_UNDEF + 1)
+		return TM_PARSE_LENGTH;
+	const int n_syms = (int) (cols / 3);
+	const int n_states = (int) ((len + 1) / row_len);
+	*pos = 0;
+	if (tm_def_size(n_syms, n_states) > cap)
+		return TM_PARSE_SPACE;
 
-			const char dir_c = txt[txt_idx + 1];
-			if (!dir_c || (dir_c != 'L' && dir_c != 'R')) {
-				ERROR("Invalid direction %c at row %d col %d.\n",
-					ONLY_ALNUM(dir_c), i_state, i_sym);
-			}
+	def->n_syms = n_syms;
+	def->n_states = n_states;
+	for (int i_state = 0; i_state < n_states; i_state++) {
+		const char *const row = txt + (size_t) i_state * row_len;
+		*pos = (size_t) i_state * row_len;
+		for (int i_sym = 0; i_sym < n_syms; i_sym++) {
+			const char *const c = row + 3 * i_sym;
+			*pos = (size_t) (c - txt);
 
-			const char state_c = txt[txt_idx + 2];
-			if (!state_c || state_c < 'A' || state_c - 'A' >= def->n_states) {
-				if (state_c != 'Z' && state_c != 'H') {
-					WARN("Unusual halting state state %c at row %d col %d, should be either A-%c or H or Z.\n",
-						ONLY_ALNUM(state_c), i_state, i_sym, 'A' + def->n_states - 1);
-				}
+			// Allow unused states only if all three chars are '-'
+			if (c[0] == '-' && c[1] == '-' && c[2] == '-') {
+				const struct tm_instr_t instr = {
+					0, 				// dummy, will not be read
+					STATE_UNDEF,	// halting state
+					DIR_LEFT, 		// dummy, will not be read
+				};
+				tm_def_store(def, (state_t) i_state, (sym_t) i_sym, instr);
+				continue;
 			}
-			// Save the instruction
+			if (c[0] < '0' || c[0] - '0' >= n_syms)
+				return TM_PARSE_SYM;
+			*pos += 1;
+			if (c[1] != 'L' && c[1] != 'R')
+				return TM_PARSE_DIR;
+			*pos += 1;
+			if (c[2] < 'A' || c[2] > 'Z')
+				return TM_PARSE_STATE;
 			const struct tm_instr_t instr = {
-				(sym_t) (sym_c - '0'),
-				(state_t) (state_c - 'A'),
-				dir_c == 'L' ? DIR_LEFT : DIR_RIGHT,
+				(sym_t) (c[0] - '0'),
+				(state_t) (c[2] - 'A'),
+				c[1] == 'L' ? DIR_LEFT : DIR_RIGHT,
 			};
-			tm_def_store(def, i_state, i_sym, instr);
+			tm_def_store(def, (state_t) i_state, (sym_t) i_sym, instr);
 		}
+		// The length check guarantees that the last row ends exactly at len
+		*pos = (size_t) i_state * row_len + cols;
+		if (i_state < n_states - 1 && row[cols] != '_')
+			return TM_PARSE_TERM;
+	}
+	return TM_PARSE_OK;
+}
 
-		// Read an underscore as terminator (just to verify input format)
-		const char term = txt[i_state * (def->n_syms * 3 + 1) + def->n_syms * 3];
-		// NB after the last row we expect a null char, otherwise an '_'
-		if (i_state < def->n_states - 1 && term != '_') {
-			printf("%d\n", term);
-			ERROR("Invalid row terminator %c at row %d, should be underscore.\n",
-				ONLY_ALNUM(term), i_state);
-		}
-		if (i_state == def->n_states - 1 && term != 0) {
-			ERROR("Trailing character %c at row %d, expected end of input.\n",
-				ONLY_ALNUM(term), i_state);
-		}
+/*
+ * Parses a Turing Machine from a given NUL-terminated string in the standard text format, see
+ * tm_def_parse_into(). Errors on malformed input, and warns about unusual halting states.
+ */
+struct tm_def_t *tm_def_parse(const char *const txt)
+{
+	const size_t len = strlen(txt);
+	const size_t cap = tm_def_parse_bound(len);
+	struct tm_def_t *const def = malloc(cap);
+
+	size_t err_pos;
+	const enum tm_parse_err_t err = tm_def_parse_into(txt, len, def, cap, &err_pos);
+	if (err != TM_PARSE_OK) {
+		ERROR("Could not parse %s, %s at character %zu (%c).\n",
+			txt, tm_parse_err_str(err), err_pos, err_pos < len ? ONLY_ALNUM(txt[err_pos]) : '?');
 	}
 
+	for (int i = 0; i < def->n_syms * def->n_states; i++) {
+		const state_t state = def->instr_tab[i].state;
+		if (state >= def->n_states && state != STATE_UNDEF && state != 'H' - 'A') {
+			WARN("Unusual halting state state %c at row %d col %d, should be either A-%c or H or Z.\n",
+				'A' + state, i / def->n_syms, i % def->n_syms, 'A' + def->n_states - 1);
+		}
+	}
 	return def;
 }
 
+/*
+ * Prints the given TM in the standard text format, e.g. "1RB1LB_1LA---", without a newline.
+ * Undefined transitions are printed as "---", see tm_def_parse_into().
+ */
+void tm_def_print_text(const struct tm_def_t *const def)
+{
+	for (state_t i_state = 0; i_state < (state_t) def->n_states; i_state++) {
+		if (i_state > 0)
+			printf("_");
+		for (sym_t i_sym = 0; i_sym < (sym_t) def->n_syms; i_sym++) {
+			const struct tm_instr_t instr = tm_def_lookup(def, i_state, i_sym);
+			if (instr.state == STATE_UNDEF)
+				printf("---");
+			else
+				printf("%d%c%c", instr.sym, instr.dir == DIR_LEFT ? 'L' : 'R', 'A' + instr.state);
+		}
+	}
+}
+
 /*
  * Prints the "program" of the given TM as a table.
  * We may optionally print the states as "directed" which means they are displayed as
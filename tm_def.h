@@ -1,6 +1,9 @@
 #ifndef TM_DEF_H
 #define TM_DEF_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "tape.h"
 #include "util.h"
 
@@ -28,8 +31,67 @@ struct tm_def_t {
 	struct tm_instr_t instr_tab[];	// symbol transition table
 };
 
+/*
+ * The "hot" encoding of a transition, for the inner loops of the specialized runners. One word
+ * holds the symbol to write in bits 0-7, the signed move delta in bits 8-15 and the row offset
+ * of the next state, i.e. next_state * n_syms, in bits 16-31. Thus the next lookup is just
+ * hot_tab[row + sym], and the machine has halted when row >= n_states * n_syms. A table for a
+ * 2-symbol 8-state machine is a single 64-byte cache line.
+ */
+typedef uint32_t tm_hot_t;
+#define HOT_SYM(hot) ((sym_t) ((hot) & 0xFF))
+#define HOT_DELTA(hot) (((int) (((hot) >> 8) & 0xFF) ^ 0x80) - 0x80)
+#define HOT_ROW(hot) ((int) ((hot) >> 16))
+#define HOT_MAKE(sym, delta, row) ((tm_hot_t) (sym) | (tm_hot_t) ((delta) & 0xFF) << 8 | (tm_hot_t) (row) << 16)
+
+/*
+ * The kinds of handlers of direct-threaded code, see struct tm_thread_op_t.
+ */
+enum tm_thread_handler_t {
+	THREAD_LEFT = 0,	// write, move left and continue in the next state
+	THREAD_RIGHT,		// write, move right and continue in the next state
+	THREAD_LEFT_HALT,	// write, move left and halt
+	THREAD_RIGHT_HALT,	// write, move right and halt
+	N_THREAD_HANDLERS,
+};
+
+/*
+ * One transition of direct-threaded code, for the threaded runners of the flat and bit tapes.
+ * The handler is the address of a label within the runner (a GNU C extension), which performs
+ * the transition and then jumps straight to the handler of next[sym] for the symbol it reads,
+ * so each step is a single indirect jump. The runners give the addresses of their handlers in
+ * the order of enum tm_thread_handler_t, to build the code with tm_def_thread().
+ */
+struct tm_thread_op_t {
+	const void *handler;				// the code that performs this transition
+	const struct tm_thread_op_t *next;	// the row of the next state, or NULL if it halts
+	sym_t sym;							// the symbol to write
+	state_t state;						// the next state
+};
+
+/*
+ * The errors of tm_def_parse_into().
+ */
+enum tm_parse_err_t {
+	TM_PARSE_OK = 0,
+	TM_PARSE_WIDTH,		// the first row is not 3 characters per symbol, for 1-10 symbols
+	TM_PARSE_LENGTH,	// the text is not a whole number of rows, for 1-26 states
+	TM_PARSE_SYM,		// a symbol is not a digit less than the number of symbols
+	TM_PARSE_DIR,		// a direction is not L or R
+	TM_PARSE_STATE,		// a state is not a letter A-Z
+	TM_PARSE_TERM,		// a row is not followed by an underscore
+	TM_PARSE_SPACE,		// the caller-provided buffer is too small
+};
+
 struct tm_def_t *tm_def_parse(const char *txt);
+enum tm_parse_err_t tm_def_parse_into(const char *txt, size_t len, struct tm_def_t *def, size_t cap, size_t *err_pos);
+size_t tm_def_parse_bound(size_t len);
+const char *tm_parse_err_str(enum tm_parse_err_t err);
+size_t tm_def_size(int n_syms, int n_states);
 struct tm_instr_t tm_def_lookup(const struct tm_def_t *def, state_t state, sym_t sym);
+void tm_def_hot(const struct tm_def_t *def, tm_hot_t *hot_tab);
+void tm_def_thread(const struct tm_def_t *def, const void *const *handlers, struct tm_thread_op_t *code);
+void tm_def_print_text(const struct tm_def_t *def);
 void tm_def_print(const struct tm_def_t *def, int directed);
 void tm_def_free(struct tm_def_t *def);
 
@@ -0,0 +1,293 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tape.h"
+#include "tape_flat.h"
+#include "tm_batch.h"
+#include "tm_def.h"
+#include "tm_run.h"
+#include "util.h"
+
+#include "tm_enum.h"
+
+/*
+ * This file enumerates all machines of a given size in tree normal form (TNF). We start from
+ * the machine with only A0 -> 1RB defined, and run it until it reaches an undefined transition.
+ * That machine halts there, and it is also the common prefix of all its children, which define
+ * the transition in every way that is new up to renaming: write a symbol that was already
+ * written or the next one, move either way, and go to a state that was already used or the
+ * next one. Rather than running each child from step 0, we take a snapshot of the tape when
+ * we reach the transition and restore it for each child, so each prefix is only run once.
+ *
+ * We run the machines with the specialized loop of the flat tape, with a hot table where the
+ * undefined transitions write what they read, stay put and go to the pseudo state n_states + s
+ * for state s. The loop thus stops right at the transition, and tells us which one it was.
+ *
+ * The tree is expanded breadth first on the calling thread until there are enough subtrees per
+ * thread, which are then run depth first by the batch runner, see tm_batch_for().
+ */
+
+// Expand the tree on the calling thread until there are at least this many subtrees per thread
+#define ENUM_SUBTREES_PER_THREAD 16
+
+// The transition of the parser for "---", see tm_def_parse_into()
+static const struct tm_instr_t ENUM_UNDEF = {0, STATE_UNDEF, DIR_LEFT};
+
+/*
+ * A copy of the visited part of the tape, the state and the number of steps of a run, just
+ * before it takes an undefined transition.
+ */
+struct enum_snap_t {
+	step_t steps;
+	state_t state;
+	int head;		// the position of the head
+	int min_pos;	// the position of the first cell
+	int len;		// the number of cells
+	sym_t cells[];
+};
+
+/*
+ * A subtree of machines, which all start out the same way as def up to snap.
+ */
+struct enum_node_t {
+	struct tm_def_t *def;				// owned by the node
+	const struct enum_snap_t *snap;		// shared between siblings, owned by enum_t
+};
+
+struct enum_list_t {
+	struct enum_node_t *nodes;
+	int len;
+	int cap;
+};
+
+/*
+ * The shared state of one tm_enum_run() call, with one tape and hot table per worker.
+ */
+struct enum_t {
+	int n_states;
+	int n_syms;
+	step_t max_steps;
+	tm_enum_fn_t fn;
+	void *ctx;
+
+	struct tape_t **tapes;
+	tm_hot_t **hot_tabs;
+
+	struct enum_list_t frontier;		// the subtrees for the batch runner
+	struct enum_snap_t **snaps;			// the snapshots of the frontier, freed at the end
+	int n_snaps;
+	int cap_snaps;
+};
+
+static void enum_list_push(struct enum_list_t *const list, struct tm_def_t *const def, const struct enum_snap_t *const snap)
+{
+	if (list->len == list->cap) {
+		list->cap = list->cap > 0 ? 2 * list->cap : 16;
+		list->nodes = realloc(list->nodes, (size_t) list->cap * sizeof *list->nodes);
+	}
+	list->nodes[list->len].def = def;
+	list->nodes[list->len].snap = snap;
+	list->len++;
+}
+
+static struct enum_snap_t *enum_snap_take(const struct tape_t *const tape, const step_t steps, const state_t state)
+{
+	int min_pos, max_pos;
+	const int head = tape->bounds(tape, &min_pos, &max_pos);
+	const int len = max_pos - min_pos + 1;
+	struct enum_snap_t *const snap = malloc(sizeof *snap + (size_t) len * sizeof *snap->cells);
+	snap->steps = steps;
+	snap->state = state;
+	snap->head = head;
+	snap->min_pos = min_pos;
+	snap->len = len;
+	tape->read_range(tape, min_pos, len, snap->cells);
+	return snap;
+}
+
+/*
+ * Restores a snapshot onto a tape, which is reset first. We only need to write the nonzero
+ * cells, and the span of the visited cells may now be smaller, which does not matter.
+ */
+static void enum_snap_restore(struct tape_t *const tape, const struct enum_snap_t *const snap)
+{
+	tape->reset(tape);
+	int pos = 0;
+	for (int i = 0; i < snap->len; i++)
+		tape_load_run(tape, &pos, snap->min_pos + i, snap->cells[i], 1);
+	tape_move_to(tape, &pos, snap->head);
+}
+
+/*
+ * Builds the hot table of a partial machine, where the undefined transition of state s stops
+ * in the pseudo state n_states + s without changing the tape, see the top of this file.
+ */
+static void enum_hot(const struct tm_def_t *const def, tm_hot_t *const hot_tab)
+{
+	tm_def_hot(def, hot_tab);
+	const int n_syms = def->n_syms;
+	for (int i = 0; i < def->n_states * n_syms; i++) {
+		if (def->instr_tab[i].state == STATE_UNDEF)
+			hot_tab[i] = HOT_MAKE(i % n_syms, 0, (def->n_states + i / n_syms) * n_syms);
+	}
+}
+
+/*
+ * Runs the machines of a subtree from its snapshot. A machine that runs out of steps is
+ * a leaf, and one that reaches an undefined transition halts there, after which we go on with
+ * its children. These are run right away depth first, reusing def, or if out is not NULL,
+ * pushed onto out as new subtrees with their own copy of def.
+ */
+static void enum_node(struct enum_t *const en, const int worker, struct tm_def_t *const def, const struct enum_snap_t *const snap, struct enum_list_t *const out)
+{
+	struct tape_t *const tape = en->tapes[worker];
+	const int n_states = en->n_states;
+	const int n_syms = en->n_syms;
+
+	enum_hot(def, en->hot_tabs[worker]);
+	enum_snap_restore(tape, snap);
+	state_t state = snap->state;
+	const step_t steps = snap->steps + flat_tape_run(tape, def, en->hot_tabs[worker], &state, en->max_steps - snap->steps);
+	if (state < n_states) {
+		const struct tm_result_t res = {steps, TM_BUDGET};
+		en->fn(en->ctx, worker, def, res);
+		return;
+	}
+	// The loop counted the undefined transition as a step, which is just what halting takes
+	const struct tm_result_t res = {steps, TM_HALTED};
+	en->fn(en->ctx, worker, def, res);
+
+	const state_t in_state = (state_t) (state - n_states);
+	const int idx = in_state * n_syms + tape->read(tape);
+	struct enum_snap_t *const next = enum_snap_take(tape, steps - 1, in_state);
+	if (out) {
+		if (en->n_snaps == en->cap_snaps) {
+			en->cap_snaps = en->cap_snaps > 0 ? 2 * en->cap_snaps : 16;
+			en->snaps = realloc(en->snaps, (size_t) en->cap_snaps * sizeof *en->snaps);
+		}
+		en->snaps[en->n_snaps++] = next;
+	}
+
+	// The states and symbols used so far, of which the children may use one more each
+	int max_state = 0, max_sym = 0;
+	for (int i = 0; i < n_states * n_syms; i++) {
+		const struct tm_instr_t instr = def->instr_tab[i];
+		if (instr.state != STATE_UNDEF) {
+			max_state = maximum(max_state, instr.state);
+			max_sym = maximum(max_sym, instr.sym);
+		}
+	}
+	const int n_next_states = max_state + 2 < n_states ? max_state + 2 : n_states;
+	const int n_next_syms = max_sym + 2 < n_syms ? max_sym + 2 : n_syms;
+
+	const size_t def_size = tm_def_size(n_syms, n_states);
+	for (int sym = 0; sym < n_next_syms; sym++) {
+		for (int dir = DIR_LEFT; dir <= DIR_RIGHT; dir++) {
+			for (int to = 0; to < n_next_states; to++) {
+				const struct tm_instr_t instr = {(sym_t) sym, (state_t) to, (dir_t) dir};
+				def->instr_tab[idx] = instr;
+				if (out) {
+					struct tm_def_t *const child = malloc(def_size);
+					memcpy(child, def, def_size);
+					enum_list_push(out, child, next);
+				} else {
+					enum_node(en, worker, def, next, NULL);
+				}
+			}
+		}
+	}
+	def->instr_tab[idx] = ENUM_UNDEF;
+
+	if (!out)
+		free(next);
+}
+
+static void enum_item(void *const ctx, const int worker, const int item)
+{
+	struct enum_t *const en = ctx;
+	const struct enum_node_t node = en->frontier.nodes[item];
+	enum_node(en, worker, node.def, node.snap, NULL);
+}
+
+/*
+ * Enumerates all machines with n_states states and n_syms symbols in tree normal form, see
+ * the top of this file, running each of them for at most max_steps steps on n_threads threads.
+ * Calls fn(ctx, worker, def, res) for each machine that halts or runs out of steps, in no
+ * particular order. The machines that halt right away in A0 are left out, as are those that
+ * start any other way than 1RB, which are the same up to renaming or mirroring.
+ */
+void tm_enum_run(const int n_states, const int n_syms, const step_t max_steps, const int n_threads, const tm_enum_fn_t fn, void *const ctx)
+{
+	// The pseudo states of enum_hot() must not meet STATE_UNDEF, and the symbols must be digits
+	if (n_states < 2 || n_states >= STATE_UNDEF || n_syms < 2 || n_syms > 10) {
+		ERROR("Can only enumerate 2-%d states and 2-10 symbols, got %d and %d.\n", STATE_UNDEF - 1, n_states, n_syms);
+	}
+	assert(max_steps >= 1 && n_threads >= 1);
+
+	struct enum_t en;
+	en.n_states = n_states;
+	en.n_syms = n_syms;
+	en.max_steps = max_steps;
+	en.fn = fn;
+	en.ctx = ctx;
+	en.tapes = malloc((size_t) n_threads * sizeof *en.tapes);
+	en.hot_tabs = malloc((size_t) n_threads * sizeof *en.hot_tabs);
+	for (int i = 0; i < n_threads; i++) {
+		en.tapes[i] = flat_tape_init(ceil_log2((unsigned) n_syms), FLAT_REUSE_LEN, FLAT_REUSE_LEN / 2, FLAT_HEAP);
+		en.hot_tabs[i] = malloc((size_t) (n_states * n_syms) * sizeof **en.hot_tabs);
+	}
+	en.frontier.nodes = NULL;
+	en.frontier.len = 0;
+	en.frontier.cap = 0;
+	en.snaps = NULL;
+	en.n_snaps = 0;
+	en.cap_snaps = 0;
+
+	// The root is the machine after its first step A0 -> 1RB
+	const size_t def_size = tm_def_size(n_syms, n_states);
+	struct tm_def_t *const root = malloc(def_size);
+	root->n_syms = n_syms;
+	root->n_states = n_states;
+	for (int i = 0; i < n_states * n_syms; i++)
+		root->instr_tab[i] = ENUM_UNDEF;
+	const struct tm_instr_t first = {1, 1, DIR_RIGHT};
+	root->instr_tab[0] = first;
+
+	struct enum_snap_t *const root_snap = malloc(sizeof *root_snap + sizeof *root_snap->cells);
+	root_snap->steps = 1;
+	root_snap->state = 1;
+	root_snap->head = 1;
+	root_snap->min_pos = 0;
+	root_snap->len = 1;
+	root_snap->cells[0] = 1;
+	enum_list_push(&en.frontier, root, root_snap);
+
+	while (en.frontier.len > 0 && en.frontier.len < ENUM_SUBTREES_PER_THREAD * n_threads) {
+		struct enum_list_t next = {NULL, 0, 0};
+		for (int i = 0; i < en.frontier.len; i++) {
+			enum_node(&en, 0, en.frontier.nodes[i].def, en.frontier.nodes[i].snap, &next);
+			tm_def_free(en.frontier.nodes[i].def);
+		}
+		free(en.frontier.nodes);
+		en.frontier = next;
+	}
+
+	tm_batch_for(en.frontier.len, n_threads, enum_item, &en);
+
+	for (int i = 0; i < en.frontier.len; i++)
+		tm_def_free(en.frontier.nodes[i].def);
+	free(en.frontier.nodes);
+	for (int i = 0; i < en.n_snaps; i++)
+		free(en.snaps[i]);
+	free(en.snaps);
+	free(root_snap);
+	for (int i = 0; i < n_threads; i++) {
+		en.tapes[i]->free(en.tapes[i]);
+		free(en.hot_tabs[i]);
+	}
+	free(en.hot_tabs);
+	free(en.tapes);
+}
@@ -0,0 +1,19 @@
+// Enumerating all machines of a given size in tree normal form
+#ifndef TM_ENUM_H
+#define TM_ENUM_H
+
+#include "tm_def.h"
+#include "tm_run.h"
+#include "util.h"
+
+/*
+ * Called once for each machine found by tm_enum_run(), from worker 0 <= worker < n_threads.
+ * The result is either TM_HALTED, with the steps including the halting transition, or
+ * TM_BUDGET. Transitions that were never reached are undefined, i.e. STATE_UNDEF as from
+ * "---" in tm_def_parse(). NOTE that def is only valid during the call.
+ */
+typedef void (*tm_enum_fn_t)(void *ctx, int worker, const struct tm_def_t *def, struct tm_result_t res);
+
+void tm_enum_run(int n_states, int n_syms, step_t max_steps, int n_threads, tm_enum_fn_t fn, void *ctx);
+
+#endif
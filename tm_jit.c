@@ -0,0 +1,418 @@
+// Needed for MAP_ANONYMOUS with -std=c99
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tape.h"
+#include "tm_def.h"
+#include "tm_run.h"
+#include "util.h"
+
+#include "tm_jit.h"
+
+/*
+ * This file contains a compiler from TM definitions directly to x86-64 machine code in
+ * executable memory, which can then be called as a function. The generated code has the same
+ * shape as the C emitted by comp.c, i.e. one label per state and a compare chain over the
+ * read symbol, but there is no compiler or subprocess involved, so compiling a machine takes
+ * microseconds instead of hundreds of milliseconds.
+ *
+ * The generated function takes a struct tm_jit_ctx_t * in rdi and keeps the machine in
+ * registers: rsi = tape, rdx = pos, rcx = len, r8 = remaining budget, r10 = lo, r11 = hi.
+ * It only uses caller saved registers and no stack. It returns an enum tm_stop_t in eax.
+ * A move only compares pos against lo or hi, and the tape edge is checked in the rarely
+ * taken stub that extends the visited span, so tracking the span costs nothing extra.
+ */
+
+#if defined(__x86_64__) && defined(__unix__)
+#define TM_JIT_X86_64
+#endif
+
+#ifdef TM_JIT_X86_64
+
+#include <sys/mman.h>
+
+typedef int (*jit_fn_t)(struct tm_jit_ctx_t *ctx);
+
+struct tm_jit_t {
+	unsigned char *mem;		// executable memory, the entry table followed by the code
+	size_t mem_len;			// size of the mapping in bytes
+	jit_fn_t fn;			// the entry point
+	int n_states;			// the states of the machine, larger ones halt
+};
+
+/*
+ * The kinds of labels in the generated code, each exists once per state.
+ */
+enum jit_label_t {
+	JIT_STATE = 0,		// start of the code for a state
+	JIT_BUDGET,			// exit stub when the budget runs out before a step in a state
+	JIT_EDGE,			// exit stub when we moved off the tape into a state
+	JIT_LEFT,			// stub that extends lo when we moved left of it into a state
+	JIT_RIGHT,			// stub that extends hi when we moved right of it into a state
+	JIT_N_LABELS,
+};
+
+/*
+ * A rel32 jump that can only be filled in when the label has been placed.
+ */
+struct jit_fixup_t {
+	size_t at;			// offset of the rel32 field
+	int label;			// kind * n_states + state
+};
+
+/*
+ * A code buffer together with the labels and pending fixups.
+ */
+struct jit_buf_t {
+	unsigned char *code;
+	size_t len;
+	size_t cap;
+	int n_states;
+	size_t *labels;					// offsets of the JIT_N_LABELS * n_states labels
+	struct jit_fixup_t *fixups;
+	int n_fixups;
+	int max_fixups;
+};
+
+static void emit_byte(struct jit_buf_t *const buf, const unsigned byte)
+{
+	assert(buf->len < buf->cap);
+	buf->code[buf->len++] = (unsigned char) byte;
+}
+
+/*
+ * Emits n bytes given as variadic unsigned ints.
+ */
+static void emit(struct jit_buf_t *const buf, const int n, ...)
+{
+	va_list args;
+	va_start(args, n);
+	for (int i = 0; i < n; i++)
+		emit_byte(buf, va_arg(args, unsigned));
+	va_end(args);
+}
+
+static void emit_u32(struct jit_buf_t *const buf, const unsigned long val)
+{
+	for (int i = 0; i < 4; i++)
+		emit_byte(buf, (unsigned) (val >> (8 * i)) & 0xFFU);
+}
+
+static void emit_u64(struct jit_buf_t *const buf, const unsigned long long val)
+{
+	for (int i = 0; i < 8; i++)
+		emit_byte(buf, (unsigned) (val >> (8 * i)) & 0xFFU);
+}
+
+/*
+ * Emits the given opcode bytes followed by a rel32 placeholder for a jump to the label.
+ */
+static void emit_jump(struct jit_buf_t *const buf, const unsigned op0, const unsigned op1, const enum jit_label_t kind, const int state)
+{
+	assert(0 <= state && state < buf->n_states);
+	emit_byte(buf, op0);
+	if (op1)
+		emit_byte(buf, op1);
+	assert(buf->n_fixups < buf->max_fixups);
+	buf->fixups[buf->n_fixups].at = buf->len;
+	buf->fixups[buf->n_fixups].label = (int) kind * buf->n_states + state;
+	buf->n_fixups++;
+	emit_u32(buf, 0);
+}
+
+/*
+ * Emits a rel32 jump to an already known code offset.
+ */
+static void emit_jump_back(struct jit_buf_t *const buf, const size_t target)
+{
+	emit_byte(buf, 0xE9);
+	const long rel = (long) target - (long) (buf->len + 4);
+	emit_u32(buf, (unsigned long) rel);
+}
+
+// Offsets of the context fields, all must fit in a disp8
+#define CTX_OFF(field) ((unsigned) offsetof(struct tm_jit_ctx_t, field))
+
+/*
+ * Emits the exit sequence: ctx->state = state, eax = stop, then jump to the epilogue.
+ */
+static void emit_exit(struct jit_buf_t *const buf, const int state, const enum tm_stop_t stop, const size_t epilogue)
+{
+	// mov dword [rdi + state], imm32
+	emit_byte(buf, 0xC7);
+	emit_byte(buf, 0x47);
+	emit_byte(buf, CTX_OFF(state));
+	emit_u32(buf, (unsigned long) state);
+	// mov eax, imm32
+	emit_byte(buf, 0xB8);
+	emit_u32(buf, (unsigned long) stop);
+	emit_jump_back(buf, epilogue);
+}
+
+/*
+ * Emits the code for one transition, with the head at [rsi + rdx] and the read symbol in eax.
+ */
+static void emit_instr(struct jit_buf_t *const buf, const struct tm_def_t *const def, const sym_t read_sym, const struct tm_instr_t instr, const size_t epilogue)
+{
+	if (instr.sym != read_sym) {
+		// mov byte [rsi + rdx], imm8
+		emit_byte(buf, 0xC6);
+		emit_byte(buf, 0x04);
+		emit_byte(buf, 0x16);
+		emit_byte(buf, instr.sym);
+	}
+	// dec r8
+	emit_byte(buf, 0x49);
+	emit_byte(buf, 0xFF);
+	emit_byte(buf, 0xC8);
+	// inc rdx or dec rdx
+	emit_byte(buf, 0x48);
+	emit_byte(buf, 0xFF);
+	emit_byte(buf, instr.dir == DIR_LEFT ? 0xCA : 0xC2);
+
+	if (instr.state >= def->n_states) {
+		// Halted, but the span must still be within the tape, so if we moved off it we exit
+		// like the edge stub does and tm_jit_run() grows the tape. The jumps are patched by hand.
+		size_t within, on_tape;
+		if (instr.dir == DIR_LEFT) {
+			emit(buf, 5, 0x4C, 0x39, 0xD2, 0x7D, 0x00);			// cmp rdx, r10; jge halt
+			within = buf->len;
+			emit(buf, 8, 0x49, 0x89, 0xD2, 0x48, 0x85, 0xD2, 0x79, 0x00);	// mov r10, rdx; test rdx, rdx; jns halt
+			on_tape = buf->len;
+		} else {
+			emit(buf, 5, 0x4C, 0x39, 0xDA, 0x7E, 0x00);			// cmp rdx, r11; jle halt
+			within = buf->len;
+			emit(buf, 8, 0x49, 0x89, 0xD3, 0x48, 0x39, 0xCA, 0x72, 0x00);	// mov r11, rdx; cmp rdx, rcx; jb halt
+			on_tape = buf->len;
+		}
+		emit_exit(buf, instr.state, TM_TAPE_LIMIT, epilogue);
+		assert(buf->len - within < 0x80);
+		buf->code[within - 1] = (unsigned char) (buf->len - within);
+		buf->code[on_tape - 1] = (unsigned char) (buf->len - on_tape);
+		emit_exit(buf, instr.state, TM_HALTED, epilogue);
+		return;
+	}
+
+	if (instr.dir == DIR_LEFT) {
+		emit(buf, 3, 0x4C, 0x39, 0xD2);						// cmp rdx, r10
+		emit_jump(buf, 0x0F, 0x8C, JIT_LEFT, instr.state);	// jl left stub
+	} else {
+		emit(buf, 3, 0x4C, 0x39, 0xDA);						// cmp rdx, r11
+		emit_jump(buf, 0x0F, 0x8F, JIT_RIGHT, instr.state);	// jg right stub
+	}
+	// jmp state
+	emit_jump(buf, 0xE9, 0, JIT_STATE, instr.state);
+}
+
+/*
+ * Upper bound for the size of the entry table and the generated code, see the emit functions.
+ */
+static size_t jit_code_size(const struct tm_def_t *const def)
+{
+	const size_t per_sym = 64;
+	const size_t per_state = 8 + 16 + 80 + per_sym * (size_t) def->n_syms;
+	return 128 + per_state * (size_t) def->n_states;
+}
+
+/*
+ * Compiles a TM definition to machine code. Returns NULL if we don't support JIT compilation
+ * on the current platform, in which case the caller should use some other backend.
+ */
+struct tm_jit_t *tm_jit_compile(const struct tm_def_t *const def)
+{
+	assert(CTX_OFF(state) < 128);
+
+	const int n_states = def->n_states;
+	const long page = 4096;
+	const size_t mem_len = (jit_code_size(def) + (size_t) page - 1) / (size_t) page * (size_t) page;
+	void *const mem = mmap(NULL, mem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		ERROR("Could not allocate %zu bytes for compiled TM.\n", mem_len);
+	}
+
+	struct jit_buf_t buf;
+	buf.code = mem;
+	buf.len = 0;
+	buf.cap = mem_len;
+	buf.n_states = n_states;
+	buf.labels = calloc((size_t) (JIT_N_LABELS * n_states), sizeof *buf.labels);
+	buf.max_fixups = 2 * n_states * def->n_syms + 5 * n_states;
+	buf.fixups = malloc((size_t) buf.max_fixups * sizeof *buf.fixups);
+	buf.n_fixups = 0;
+
+	// Entry table with the absolute address of each state, filled in at the end
+	const size_t table = buf.len;
+	buf.len += (size_t) n_states * sizeof (unsigned long long);
+
+	// Epilogue: write back the registers, the state and return value are set by the exit stub
+	const size_t epilogue = buf.len;
+	emit(&buf, 4, 0x48, 0x89, 0x57, CTX_OFF(pos));			// mov [rdi + pos], rdx
+	emit(&buf, 4, 0x4C, 0x89, 0x47, CTX_OFF(budget));		// mov [rdi + budget], r8
+	emit(&buf, 4, 0x4C, 0x89, 0x57, CTX_OFF(lo));			// mov [rdi + lo], r10
+	emit(&buf, 4, 0x4C, 0x89, 0x5F, CTX_OFF(hi));			// mov [rdi + hi], r11
+	emit(&buf, 1, 0xC3);									// ret
+
+	// Prologue: load the machine into registers and jump to the current state
+	const size_t entry = buf.len;
+	emit(&buf, 4, 0x48, 0x8B, 0x77, CTX_OFF(tape));		// mov rsi, [rdi + tape]
+	emit(&buf, 4, 0x48, 0x8B, 0x57, CTX_OFF(pos));		// mov rdx, [rdi + pos]
+	emit(&buf, 4, 0x48, 0x8B, 0x4F, CTX_OFF(len));		// mov rcx, [rdi + len]
+	emit(&buf, 4, 0x4C, 0x8B, 0x47, CTX_OFF(budget));	// mov r8, [rdi + budget]
+	emit(&buf, 4, 0x4C, 0x8B, 0x57, CTX_OFF(lo));		// mov r10, [rdi + lo]
+	emit(&buf, 4, 0x4C, 0x8B, 0x5F, CTX_OFF(hi));		// mov r11, [rdi + hi]
+	emit(&buf, 3, 0x8B, 0x47, CTX_OFF(state));			// mov eax, [rdi + state]
+	emit(&buf, 2, 0x49, 0xB9);							// movabs r9, table
+	emit_u64(&buf, (unsigned long long) (size_t) (buf.code + table));
+	emit(&buf, 4, 0x41, 0xFF, 0x24, 0xC1);				// jmp [r9 + rax * 8]
+
+	for (int state = 0; state < n_states; state++) {
+		buf.labels[JIT_STATE * n_states + state] = buf.len;
+		emit(&buf, 3, 0x4D, 0x85, 0xC0);				// test r8, r8
+		emit_jump(&buf, 0x0F, 0x8E, JIT_BUDGET, state);	// jle budget stub
+		emit(&buf, 4, 0x0F, 0xB6, 0x04, 0x16);			// movzx eax, byte [rsi + rdx]
+
+		// The compare chain jumps forward over the transitions, so we patch it by hand
+		size_t sym_jumps[256];
+		for (int sym = 0; sym < def->n_syms - 1; sym++) {
+			emit(&buf, 3, 0x83, 0xF8, sym);				// cmp eax, imm8
+			emit(&buf, 2, 0x0F, 0x84);					// je rel32
+			sym_jumps[sym] = buf.len;
+			emit_u32(&buf, 0);
+		}
+		// The last symbol falls through, as the tape never contains larger symbols
+		for (int sym = def->n_syms - 1; sym >= 0; sym--) {
+			if (sym < def->n_syms - 1) {
+				const long rel = (long) buf.len - (long) (sym_jumps[sym] + 4);
+				for (int i = 0; i < 4; i++)
+					buf.code[sym_jumps[sym] + (size_t) i] = (unsigned char) (((unsigned long) rel >> (8 * i)) & 0xFFU);
+			}
+			const struct tm_instr_t instr = tm_def_lookup(def, (state_t) state, (sym_t) sym);
+			emit_instr(&buf, def, (sym_t) sym, instr, epilogue);
+		}
+	}
+
+	// Exit stubs, they don't change pos, it is written back by the epilogue
+	for (int state = 0; state < n_states; state++) {
+		buf.labels[JIT_BUDGET * n_states + state] = buf.len;
+		emit_exit(&buf, state, TM_BUDGET, epilogue);
+		buf.labels[JIT_EDGE * n_states + state] = buf.len;
+		emit_exit(&buf, state, TM_TAPE_LIMIT, epilogue);
+
+		// Span stubs, lo and hi become -1 and len if we moved off the tape
+		buf.labels[JIT_LEFT * n_states + state] = buf.len;
+		emit(&buf, 6, 0x49, 0x89, 0xD2, 0x48, 0x85, 0xD2);		// mov r10, rdx; test rdx, rdx
+		emit_jump(&buf, 0x0F, 0x88, JIT_EDGE, state);			// js edge stub
+		emit_jump(&buf, 0xE9, 0, JIT_STATE, state);				// jmp state
+		buf.labels[JIT_RIGHT * n_states + state] = buf.len;
+		emit(&buf, 6, 0x49, 0x89, 0xD3, 0x48, 0x39, 0xCA);		// mov r11, rdx; cmp rdx, rcx
+		emit_jump(&buf, 0x0F, 0x83, JIT_EDGE, state);			// jae edge stub
+		emit_jump(&buf, 0xE9, 0, JIT_STATE, state);				// jmp state
+	}
+
+	for (int i = 0; i < buf.n_fixups; i++) {
+		const struct jit_fixup_t fixup = buf.fixups[i];
+		const long rel = (long) buf.labels[fixup.label] - (long) (fixup.at + 4);
+		for (int j = 0; j < 4; j++)
+			buf.code[fixup.at + (size_t) j] = (unsigned char) (((unsigned long) rel >> (8 * j)) & 0xFFU);
+	}
+	for (int state = 0; state < n_states; state++) {
+		const unsigned long long addr = (unsigned long long) (size_t) (buf.code + buf.labels[JIT_STATE * n_states + state]);
+		memcpy(buf.code + table + (size_t) state * sizeof addr, &addr, sizeof addr);
+	}
+	free(buf.labels);
+	free(buf.fixups);
+
+	if (mprotect(mem, mem_len, PROT_READ | PROT_EXEC) != 0) {
+		ERROR("Could not make compiled TM executable.\n");
+	}
+
+	struct tm_jit_t *const jit = malloc(sizeof *jit);
+	jit->mem = mem;
+	jit->mem_len = mem_len;
+	// ISO C has no conversion from object to function pointers, but POSIX requires it to work
+	union {
+		void *obj;
+		jit_fn_t fn;
+	} conv;
+	conv.obj = buf.code + entry;
+	jit->fn = conv.fn;
+	jit->n_states = n_states;
+	return jit;
+}
+
+/*
+ * Doubles the tape on the side where the head moved off it, shifting all positions.
+ */
+static void tm_jit_grow(struct tm_jit_ctx_t *const ctx)
+{
+	const long long old_len = ctx->len;
+	const long long new_len = 2 * old_len;
+	if (ctx->pos < 0) {
+		sym_t *const tape = calloc((size_t) new_len, sizeof *tape);
+		memcpy(tape + old_len, ctx->tape, (size_t) old_len * sizeof *tape);
+		free(ctx->tape);
+		ctx->tape = tape;
+		ctx->pos += old_len;
+		ctx->lo += old_len;
+		ctx->hi += old_len;
+		ctx->origin += old_len;
+	} else {
+		ctx->tape = realloc(ctx->tape, (size_t) new_len * sizeof *ctx->tape);
+		memset(ctx->tape + old_len, 0, (size_t) old_len * sizeof *ctx->tape);
+	}
+	ctx->len = new_len;
+}
+
+/*
+ * Runs the compiled TM on the given context until it halts or the budget runs out. If the
+ * head moves off the tape we grow it, also on the halting step, so that lo, pos and hi always
+ * index into the tape. Thus ctx->tape must be allocated with malloc() and may be reallocated.
+ * Returns TM_HALTED or TM_BUDGET.
+ */
+enum tm_stop_t tm_jit_run(const struct tm_jit_t *const jit, struct tm_jit_ctx_t *const ctx)
+{
+	assert(0 <= ctx->lo && ctx->lo <= ctx->pos && ctx->pos <= ctx->hi && ctx->hi < ctx->len);
+	enum tm_stop_t stop;
+	while ((stop = (enum tm_stop_t) jit->fn(ctx)) == TM_TAPE_LIMIT) {
+		tm_jit_grow(ctx);
+		// The halting step moved off the tape, and is already taken
+		if (ctx->state >= jit->n_states)
+			return TM_HALTED;
+	}
+	return stop;
+}
+
+void tm_jit_free(struct tm_jit_t *const jit)
+{
+	munmap(jit->mem, jit->mem_len);
+	free(jit);
+}
+
+#else
+
+struct tm_jit_t *tm_jit_compile(const struct tm_def_t *const def)
+{
+	(void) def;
+	return NULL;
+}
+
+enum tm_stop_t tm_jit_run(const struct tm_jit_t *const jit, struct tm_jit_ctx_t *const ctx)
+{
+	(void) jit;
+	(void) ctx;
+	ERROR("JIT compilation is not supported on this platform.\n");
+	return TM_RUNNING;
+}
+
+void tm_jit_free(struct tm_jit_t *const jit)
+{
+	(void) jit;
+}
+
+#endif
@@ -0,0 +1,32 @@
+// In-process compiler from TM definitions to x86-64 machine code
+#ifndef TM_JIT_H
+#define TM_JIT_H
+
+#include "tape.h"
+#include "util.h"
+
+#include "tm_run.h"
+
+/*
+ * The machine state that compiled code runs on. It is read on entry and written back on exit,
+ * so a run can be resumed, e.g. with a new budget.
+ */
+struct tm_jit_ctx_t {
+	sym_t *tape;		// flat array of len symbols
+	long long pos;		// head position, index into tape
+	long long len;		// number of symbols in tape, grown as needed
+	long long lo;		// lowest position visited, index into tape
+	long long hi;		// highest position visited, index into tape
+	long long origin;	// the starting position, index into tape
+	step_t budget;		// number of steps we may still take, counts down
+	int state;			// current state, the state to start in on entry
+};
+
+struct tm_def_t;
+struct tm_jit_t;
+
+struct tm_jit_t *tm_jit_compile(const struct tm_def_t *def);
+enum tm_stop_t tm_jit_run(const struct tm_jit_t *jit, struct tm_jit_ctx_t *ctx);
+void tm_jit_free(struct tm_jit_t *jit);
+
+#endif
@@ -0,0 +1,205 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tape.h"
+#include "tape_flat.h"
+#include "tm_def.h"
+#include "tm_run.h"
+#include "util.h"
+
+#include "tm_lanes.h"
+
+/*
+ * This file contains a runner that steps LANES independent TMs in lockstep, for batches where
+ * most TMs only run for a few steps, so that the per-TM overhead of tm_run dominates.
+ *
+ * Each lane has its own small flat tape window and hot transition table, see tm_def_hot(),
+ * and the state of all lanes is kept in arrays indexed by lane (structure of arrays). One
+ * iteration of the inner loop does one step of every lane, which is a gather from the tables
+ * and a scatter to the tapes, without any branches. This is plain C, written so that compilers
+ * can vectorize it on targets with gather instructions, but even as scalar code the steps of
+ * different lanes are independent, so the CPU overlaps their loads instead of waiting for each
+ * lookup in turn as it does in a single TM.
+ *
+ * Halted lanes must keep stepping until the end of the chunk, so each lane table has an extra
+ * "sink" row, which the halting transitions go to, and which writes back the symbol it read
+ * without moving. Between chunks of LANE_CHUNK steps we retire the lanes that halted, and the
+ * lanes that are close to the edge of their window or to the step limit, which we hand over to
+ * a scalar run on a flat tape to finish. Then we refill the lanes with the next TMs.
+ */
+
+// Number of TMs stepped in lockstep
+#define LANES 16
+// Number of symbols of the tape window of each lane, the head starts in the middle
+#define LANE_WINDOW 256
+// Number of entries of the table of each lane, larger TMs are run by the scalar runner
+#define LANE_TAB 64
+// Number of steps between checks, a lane must be at least this far from the window edges
+#define LANE_CHUNK 32
+
+struct tm_lanes_t {
+	// Per-lane state, with rows and positions as absolute indices into tab and tape
+	int row[LANES];						// row of the current state
+	int pos[LANES];						// head position
+	int sink[LANES];					// row of the sink state, see above
+	step_t steps[LANES];				// number of steps taken
+	int item[LANES];					// index of the TM, or -1 if the lane is empty
+
+	tm_hot_t tab[LANES * LANE_TAB];		// the hot table of each lane
+	sym_t tape[LANES * LANE_WINDOW];	// the tape window of each lane
+
+	struct tm_run_t *scalar;			// for TMs that do not fit in a lane
+};
+
+struct tm_lanes_t *tm_lanes_init(void)
+{
+	struct tm_lanes_t *const lanes = malloc(sizeof *lanes);
+	struct tape_t *tape = flat_tape_init_any();
+	lanes->scalar = tm_run_init(NULL, 1, &tape);
+	return lanes;
+}
+
+void tm_lanes_free(struct tm_lanes_t *const lanes)
+{
+	struct tape_t *const tape = lanes->scalar->tapes[0];
+	tape->free(tape);
+	tm_run_free(lanes->scalar);
+	free(lanes);
+}
+
+/*
+ * Makes lane l empty. It then just sits in its sink on a blank tape.
+ */
+static void lanes_clear(struct tm_lanes_t *const lanes, const int l)
+{
+	const int base = l * LANE_TAB;
+	lanes->tab[base] = HOT_MAKE(0, 0, base);
+	lanes->row[l] = base;
+	lanes->sink[l] = base;
+	lanes->pos[l] = l * LANE_WINDOW + LANE_WINDOW / 2;
+	lanes->steps[l] = 0;
+	lanes->item[l] = -1;
+	memset(lanes->tape + l * LANE_WINDOW, 0, LANE_WINDOW);
+}
+
+/*
+ * Starts lane l on the given TM, which must fit in a lane.
+ */
+static void lanes_load(struct tm_lanes_t *const lanes, const int l, const struct tm_def_t *const def, const int item)
+{
+	const int n_syms = def->n_syms;
+	const int halt_row = def->n_states * n_syms;
+	assert(halt_row + n_syms <= LANE_TAB);
+
+	const int base = l * LANE_TAB;
+	const int sink = base + halt_row;
+	tm_hot_t *const tab = lanes->tab + base;
+	tm_def_hot(def, tab);
+	// Rebase the rows onto the lane, and send all halting transitions to the sink
+	for (int i = 0; i < halt_row; i++) {
+		const int row = HOT_ROW(tab[i]);
+		tab[i] = HOT_MAKE(HOT_SYM(tab[i]), HOT_DELTA(tab[i]), row < halt_row ? base + row : sink);
+	}
+	for (int sym = 0; sym < n_syms; sym++)
+		tab[halt_row + sym] = HOT_MAKE(sym, 0, sink);
+
+	lanes->row[l] = base;
+	lanes->sink[l] = sink;
+	lanes->pos[l] = l * LANE_WINDOW + LANE_WINDOW / 2;
+	lanes->steps[l] = 0;
+	lanes->item[l] = item;
+	memset(lanes->tape + l * LANE_WINDOW, 0, LANE_WINDOW);
+}
+
+/*
+ * Checks whether a TM can run in a lane at all.
+ */
+static int lanes_fits(const struct tm_def_t *const def, const step_t max_steps)
+{
+	return def->n_syms * (def->n_states + 1) <= LANE_TAB && max_steps >= LANE_CHUNK;
+}
+
+/*
+ * Finishes the TM of lane l with the scalar runner, continuing where the lane stopped, and
+ * returns its result. The lane itself is left as it is.
+ */
+static struct tm_result_t lanes_retire(struct tm_lanes_t *const lanes, const int l, const struct tm_def_t *const def, const step_t max_steps)
+{
+	struct tm_run_t *const run = lanes->scalar;
+	struct tape_t *const tape = run->tapes[0];
+	tm_run_reset(run, def);
+
+	// Copy the window, whose middle is the tape origin
+	const sym_t *const window = lanes->tape + l * LANE_WINDOW;
+	int head = LANE_WINDOW / 2;
+	for (int i = 0; i < LANE_WINDOW; i++)
+		tape_load_run(tape, &head, i, window[i], 1);
+	tape_move_to(tape, &head, lanes->pos[l] - l * LANE_WINDOW);
+
+	run->state = (state_t) ((lanes->row[l] - l * LANE_TAB) / def->n_syms);
+	run->steps = lanes->steps[l];
+	const struct tm_result_t res = tm_run_fast_flat(run, max_steps - run->steps);
+	return (struct tm_result_t) {run->steps, res.stop};
+}
+
+/*
+ * Runs each of the n_defs TMs for at most max_steps steps, and stores the result of defs[i]
+ * in results[i], where the steps are the total number of steps, as with tm_batch_run().
+ */
+void tm_lanes_run(struct tm_lanes_t *const lanes, const struct tm_def_t *const *const defs, const int n_defs, const step_t max_steps, struct tm_result_t *const results)
+{
+	for (int l = 0; l < LANES; l++)
+		lanes_clear(lanes, l);
+
+	int next = 0;
+	while (1) {
+		// Retire lanes and refill them with the next TMs that fit
+		int active = 0;
+		for (int l = 0; l < LANES; l++) {
+			const int item = lanes->item[l];
+			if (item >= 0) {
+				const int pos = lanes->pos[l] - l * LANE_WINDOW;
+				if (lanes->row[l] == lanes->sink[l]) {
+					results[item] = (struct tm_result_t) {lanes->steps[l], TM_HALTED};
+				} else if (pos < LANE_CHUNK || pos >= LANE_WINDOW - LANE_CHUNK || lanes->steps[l] > max_steps - LANE_CHUNK) {
+					results[item] = lanes_retire(lanes, l, defs[item], max_steps);
+				} else {
+					active++;
+					continue;
+				}
+				lanes_clear(lanes, l);
+			}
+			while (next < n_defs && !lanes_fits(defs[next], max_steps)) {
+				struct tm_run_t *const run = lanes->scalar;
+				tm_run_reset(run, defs[next]);
+				results[next++] = tm_run_fast_flat(run, max_steps);
+			}
+			if (next < n_defs) {
+				lanes_load(lanes, l, defs[next], next);
+				next++;
+				active++;
+			}
+		}
+		if (!active)
+			break;
+
+		// One chunk of steps of all lanes, the hot loop
+		int *const row = lanes->row;
+		int *const pos = lanes->pos;
+		const int *const sink = lanes->sink;
+		step_t *const steps = lanes->steps;
+		const tm_hot_t *const tab = lanes->tab;
+		sym_t *const tape = lanes->tape;
+		for (int i = 0; i < LANE_CHUNK; i++) {
+			for (int l = 0; l < LANES; l++) {
+				const tm_hot_t hot = tab[row[l] + tape[pos[l]]];
+				steps[l] += row[l] != sink[l];
+				tape[pos[l]] = HOT_SYM(hot);
+				pos[l] += HOT_DELTA(hot);
+				row[l] = HOT_ROW(hot);
+			}
+		}
+	}
+}
@@ -0,0 +1,15 @@
+// Running many short TMs in lockstep
+#ifndef TM_LANES_H
+#define TM_LANES_H
+
+#include "tm_def.h"
+#include "tm_run.h"
+#include "util.h"
+
+struct tm_lanes_t;
+
+struct tm_lanes_t *tm_lanes_init(void);
+void tm_lanes_free(struct tm_lanes_t *lanes);
+void tm_lanes_run(struct tm_lanes_t *lanes, const struct tm_def_t *const *defs, int n_defs, step_t max_steps, struct tm_result_t *results);
+
+#endif
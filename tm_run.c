@@ -7,6 +7,11 @@
 #include <string.h>
 
 #include "tape.h"
+#include "tape_bit.h"
+#include "tape_flat.h"
+#include "tape_gap.h"
+#include "tape_hybrid.h"
+#include "tape_rle.h"
 #include "tm_def.h"
 #include "util.h"
 
@@ -24,36 +29,94 @@ static void instr_print(const struct tm_instr_t *const instr, const unsigned sym
  */
 void tm_run_free(struct tm_run_t *run)
 {
+	free(run->hot_tab);
+	free(run->thread_code);
+	free(run->hist);
 	free(run);
 }
 
 /*
- * Initializes a new run (tape(s)) etc. for a given TM program.
- * We can specify if the machine should use a RLE tape or not.
- * We can also specify the initial length of the flat tape. This must be a (strictly) positive.
- * A non-positive value means that the flat tape is not enabled for this run.
- * We can also specify the flat tape offset. This is simply ignore if we have no flat tape.
+ * Sets the TM program of the run, and builds its hot table for the specialized loops. The
+ * table is only reallocated when it is too small, so reusing a run for many TMs is cheap.
+ */
+static void tm_run_set_def(struct tm_run_t *const run, const struct tm_def_t *const def)
+{
+	run->def = def;
+	if (!def)
+		return;
+	const int tab_size = def->n_syms * def->n_states;
+	if (tab_size > run->hot_cap) {
+		free(run->hot_tab);
+		run->hot_tab = malloc((size_t) tab_size * sizeof *run->hot_tab);
+		free(run->thread_code);
+		run->thread_code = malloc((size_t) tab_size * sizeof *run->thread_code);
+#ifdef TM_STATS
+		free(run->hist);
+		run->hist = malloc((size_t) tab_size * sizeof *run->hist);
+#endif
+		run->hot_cap = tab_size;
+	}
+	tm_def_hot(def, run->hot_tab);
+	run->thread_handlers = NULL;
+	if (run->hist)
+		memset(run->hist, 0, (size_t) tab_size * sizeof *run->hist);
+}
+
+/*
+ * Initializes a new run for a given TM program, using the given list of n_tapes tapes
+ * (at most MAX_TAPES). Entries may be NULL, but at least one tape must be used. All tapes
+ * are stepped in lockstep, so that they can be compared against each other.
  */
 struct tm_run_t *tm_run_init(
 		const struct tm_def_t *const def,
-		struct tape_t *const tape1,
-		struct tape_t *const tape2,
-		struct tape_t *const tape3)
+		const int n_tapes,
+		struct tape_t *const *const tapes)
 {
-	if (!(tape1 || tape2 || tape3)) {
-		ERROR("Must use at least one tape!\n");
+	if (n_tapes > MAX_TAPES) {
+		ERROR("Can use at most %d tapes, got %d!\n", MAX_TAPES, n_tapes);
 	}
 
 	struct tm_run_t *run = malloc(sizeof *run);
-	run->def = def;
-	run->tapes[0] = tape1;
-	run->tapes[1] = tape2;
-	run->tapes[2] = tape3;
+	int used = 0;
+	for (int i = 0; i < MAX_TAPES; i++) {
+		run->tapes[i] = i < n_tapes ? tapes[i] : NULL;
+		if (run->tapes[i])
+			used++;
+	}
+	if (!used) {
+		ERROR("Must use at least one tape!\n");
+	}
+
+	run->hot_tab = NULL;
+	run->hot_cap = 0;
+	run->thread_code = NULL;
+	run->thread_handlers = NULL;
+	run->hist = NULL;
+	run->decider = NULL;
+	tm_run_set_def(run, def);
 	run->steps = 0;
 	run->state = 0;	// always start in state 0, or 'A'
 	return run;
 }
 
+/*
+ * Restarts the run from the beginning for a new TM program, reusing the run and its tapes,
+ * which must all support reset, and its decider.
+ */
+void tm_run_reset(struct tm_run_t *const run, const struct tm_def_t *const def)
+{
+	for (int i = 0; i < MAX_TAPES; i++) {
+		struct tape_t *const tape = run->tapes[i];
+		if (tape)
+			tape->reset(tape);
+	}
+	tm_run_set_def(run, def);
+	run->steps = 0;
+	run->state = 0;
+	for (struct tm_decider_t *decider = run->decider; decider; decider = decider->next)
+		decider->reset(decider);
+}
+
 /*
  * Checks whether the machine has halted (i.e. reached an undefined state). Returns 1 if halted,
  * 0 otherwise.
@@ -63,16 +126,31 @@ int tm_run_halted(const struct tm_run_t *const run) {
 }
 
 /*
- * Runs one step for the machine. Return value is 1 if the machine halted, 0 otherwise.
+ * Runs one step for the machine. Returns TM_HALTED if the machine halted, TM_TAPE_LIMIT if
+ * some tape could not move (in which case no tape is modified), and TM_RUNNING otherwise.
  */
-int tm_run_step(struct tm_run_t *const run)
+enum tm_stop_t tm_run_step(struct tm_run_t *const run)
 {
 	if (tm_run_halted(run)) {
 		ERROR("Trying to step halted TM.\n");
 	}
 
 	const state_t i_state = run->state;
+	for (int i = 0; i < MAX_TAPES; i++) {
+		struct tape_t *tape = run->tapes[i];
+		if (!tape || !tape->can_move)
+			continue;
+
+		// Check the limits of bounded tapes before modifying any of the tapes
+		const struct tm_instr_t instr = tm_def_lookup(run->def, i_state, tape->read(tape));
+		if (!tape->can_move(tape, instr.dir == DIR_LEFT ? -1 : 1))
+			return TM_TAPE_LIMIT;
+	}
+
 	state_t o_state = 0;
+#ifdef TM_STATS
+	int counted = 0;
+#endif
 	for (int i = 0; i < MAX_TAPES; i++) {
 		struct tape_t *tape = run->tapes[i];
 		if (!tape)
@@ -80,6 +158,11 @@ int tm_run_step(struct tm_run_t *const run)
 
 		// Read the symbol
 		const sym_t i_sym = tape->read(tape);
+#ifdef TM_STATS
+		// All tapes read the same symbol, so we count the transition only once
+		if (!counted++)
+			run->hist[i_state * run->def->n_syms + i_sym]++;
+#endif
 
 		// Lookup the instruction
 		struct tm_instr_t instr = tm_def_lookup(run->def, i_state, i_sym);
@@ -98,22 +181,187 @@ int tm_run_step(struct tm_run_t *const run)
 	run->state = o_state;
 	run->steps++;
 
-	return run->state >= run->def->n_states;
+	return tm_run_halted(run) ? TM_HALTED : TM_RUNNING;
 }
 
 /*
- * Runs the machine until the given number of steps have passed, or
- * the machine has halted. Returns 1 on halt and 0 otherwise.
+ * Runs the machine until the given number of steps have passed, the machine has halted,
+ * or a tape has reached its limit, or one of the deciders of the run (if any) decided that it
+ * will never halt. Returns the number of steps taken and the reason we stopped.
  * Note that max_steps is not cumulative (run->steps) but rather counts from the first step
  * taken by the current invocation of this function.
  */
-int tm_run_steps(struct tm_run_t *const run, const int max_steps)
+struct tm_result_t tm_run_steps(struct tm_run_t *const run, const step_t max_steps)
+{
+	struct tm_result_t res = {0, TM_BUDGET};
+	if (tm_run_halted(run)) {
+		res.stop = TM_HALTED;
+		return res;
+	}
+	while (res.steps < max_steps) {
+		const enum tm_stop_t stop = tm_run_step(run);
+		if (stop == TM_TAPE_LIMIT) {
+			res.stop = stop;
+			return res;
+		}
+		res.steps++;
+		if (stop == TM_HALTED) {
+			res.stop = stop;
+			return res;
+		}
+		for (struct tm_decider_t *decider = run->decider; decider; decider = decider->next) {
+			const enum tm_stop_t verdict = decider->step(decider, run);
+			if (verdict != TM_RUNNING) {
+				res.stop = verdict;
+				return res;
+			}
+		}
+	}
+	return res;
+}
+
+/*
+ * Prints the statistics counted with -DTM_STATS: how often tm_run_step() took each transition,
+ * one state per line, and what the flat and RLE tapes did. Note that the specialized loops
+ * don't go through tm_run_step(), so they only show up in the tape statistics.
+ */
+void tm_run_print_stats(const struct tm_run_t *const run)
+{
+	if (run->hist) {
+		for (int state = 0; state < run->def->n_states; state++) {
+			printf("%c:", 'A' + state);
+			for (int sym = 0; sym < run->def->n_syms; sym++)
+				printf(" %lld", run->hist[state * run->def->n_syms + sym]);
+			printf("\n");
+		}
+	}
+	for (int i = 0; i < MAX_TAPES; i++) {
+		const struct tape_t *const tape = run->tapes[i];
+		if (tape && tape->move == flat_tape_move)
+			flat_tape_print_stats(tape);
+		else if (tape && tape->move == rle_tape_move)
+			rle_tape_print_stats(tape);
+	}
+}
+
+/*
+ * Returns the only tape used by the run. The specialized run functions below only
+ * support runs with exactly one tape, since they skip the loop over all tapes.
+ */
+static struct tape_t *tm_run_single_tape(const struct tm_run_t *const run)
 {
-	int steps = 0;
-	while (steps < max_steps) {
-		int halt = tm_run_step(run);
-		if (halt)
-			return 1;
+	struct tape_t *tape = NULL;
+	for (int i = 0; i < MAX_TAPES; i++) {
+		if (!run->tapes[i])
+			continue;
+		if (tape) {
+			ERROR("Specialized run requires exactly one tape.\n");
+		}
+		tape = run->tapes[i];
 	}
-	return 0;
+	assert(tape); // guaranteed by tm_run_init()
+	return tape;
+}
+
+/*
+ * Accounts for steps taken by one of the specialized loops. These stop early only if the machine
+ * halted or the tape reached its limit, so we can infer the reason from the number of steps.
+ */
+static struct tm_result_t tm_run_fast_result(struct tm_run_t *const run, const step_t steps, const step_t max_steps)
+{
+	run->steps += steps;
+	struct tm_result_t res = {steps, TM_BUDGET};
+	if (tm_run_halted(run))
+		res.stop = TM_HALTED;
+	else if (steps < max_steps)
+		res.stop = TM_TAPE_LIMIT;
+	return res;
+}
+
+/*
+ * Runs the machine for up to max_steps steps on a single flat tape, using a specialized
+ * loop instead of tm_run_step(). The result is the same as for tm_run_steps().
+ */
+struct tm_result_t tm_run_fast_flat(struct tm_run_t *const run, const step_t max_steps)
+{
+	struct tape_t *const tape = tm_run_single_tape(run);
+	const step_t steps = flat_tape_run(tape, run->def, run->hot_tab, &run->state, max_steps);
+	return tm_run_fast_result(run, steps, max_steps);
+}
+
+/*
+ * Same as tm_run_fast_flat() but for a single RLE tape.
+ */
+struct tm_result_t tm_run_fast_rle(struct tm_run_t *const run, const step_t max_steps)
+{
+	struct tape_t *const tape = tm_run_single_tape(run);
+	const step_t steps = rle_tape_run(tape, run->def, run->hot_tab, &run->state, max_steps, 0);
+	return tm_run_fast_result(run, steps, max_steps);
+}
+
+/*
+ * Same as tm_run_fast_rle() but skips through entire runs of symbols whenever possible,
+ * see rle_tape_skip(). The number of steps is the same as if we had stepped through them.
+ */
+struct tm_result_t tm_run_skip_rle(struct tm_run_t *const run, const step_t max_steps)
+{
+	struct tape_t *const tape = tm_run_single_tape(run);
+	const step_t steps = rle_tape_run(tape, run->def, run->hot_tab, &run->state, max_steps, 1);
+	return tm_run_fast_result(run, steps, max_steps);
+}
+
+/*
+ * Same as tm_run_fast_flat() but for a single bit tape.
+ */
+struct tm_result_t tm_run_fast_bit(struct tm_run_t *const run, const step_t max_steps)
+{
+	struct tape_t *const tape = tm_run_single_tape(run);
+	const step_t steps = bit_tape_run(tape, run->def, run->hot_tab, &run->state, max_steps);
+	return tm_run_fast_result(run, steps, max_steps);
+}
+
+/*
+ * Same as tm_run_fast_flat() but for a single gap tape.
+ */
+struct tm_result_t tm_run_fast_gap(struct tm_run_t *const run, const step_t max_steps)
+{
+	struct tape_t *const tape = tm_run_single_tape(run);
+	const step_t steps = gap_tape_run(tape, run->def, run->hot_tab, &run->state, max_steps);
+	return tm_run_fast_result(run, steps, max_steps);
+}
+
+/*
+ * Same as tm_run_fast_flat() but with the threaded runner of a single flat or bit tape, see
+ * struct tm_thread_op_t. The threaded code is built the first time, which is only a pass over
+ * the transition table, so even short runs are worth it.
+ */
+struct tm_result_t tm_run_fast_thread(struct tm_run_t *const run, const step_t max_steps)
+{
+	struct tape_t *const tape = tm_run_single_tape(run);
+	const int flat = tape->move == flat_tape_move;
+	if (!flat && tape->free != bit_tape_free) {
+		ERROR("Threaded run requires a flat or bit tape.\n");
+	}
+	if (tm_run_halted(run))
+		return tm_run_fast_result(run, 0, max_steps);
+
+	const void *const *const handlers = flat ? flat_tape_thread_handlers() : bit_tape_thread_handlers(tape);
+	if (run->thread_handlers != handlers) {
+		tm_def_thread(run->def, handlers, run->thread_code);
+		run->thread_handlers = handlers;
+	}
+	const step_t steps = flat
+		? flat_tape_thread(tape, run->def, run->thread_code, &run->state, max_steps)
+		: bit_tape_thread(tape, run->def, run->thread_code, &run->state, max_steps);
+	return tm_run_fast_result(run, steps, max_steps);
+}
+
+/*
+ * Same as tm_run_fast_flat() but for a single hybrid tape.
+ */
+struct tm_result_t tm_run_fast_hybrid(struct tm_run_t *const run, const step_t max_steps)
+{
+	struct tape_t *const tape = tm_run_single_tape(run);
+	const step_t steps = hybrid_tape_run(tape, run->def, run->hot_tab, &run->state, max_steps);
+	return tm_run_fast_result(run, steps, max_steps);
 }
@@ -5,7 +5,7 @@
 #include "tm_def.h"
 #include "util.h"
 
-#define MAX_TAPES 3
+#define MAX_TAPES 4
 
 /*
  * Represents a given run of a TM, which contains a reference to the transition
@@ -15,20 +15,84 @@
 struct tm_run_t {
 	// NOTE that the transition table is just a reference and not managed by this struct!
 	const struct tm_def_t *def;	// transition table (reference)
+	tm_hot_t *hot_tab;			// hot encoding of def, owned by the run, see tm_def_hot()
+	int hot_cap;				// number of entries allocated for hot_tab and thread_code
+	struct tm_thread_op_t *thread_code;	// threaded code of def, built on first use by tm_run_fast_thread()
+	const void *const *thread_handlers;	// the handlers thread_code was built for, NULL if not built yet
+	step_t *hist;				// with -DTM_STATS, how often tm_run_step() took each transition, else NULL
 
 	struct tape_t *tapes[MAX_TAPES];	// list of all the tapes to use, unused are set to NULL
 
-	int steps;							// the number of steps performed
+	step_t steps;						// the number of steps performed
 	state_t state;						// the current state
 	int prev_delta;						// last direction moved, initially zero, then always -1 or 1
+	struct tm_decider_t *decider;		// optional chain, used by tm_run_steps(), not owned by the run
 	// invariants: compare_rle_flat_tapes(rle_tape, flat_tape) == 0 given that both are non-null.
 };
 
 
-struct tm_run_t *tm_run_init(const struct tm_def_t *def, struct tape_t *tape1, struct tape_t *tape2, struct tape_t *tape3);
+/*
+ * The reason a run stopped, as returned by tm_run_step() and tm_run_steps().
+ */
+enum tm_stop_t {
+	TM_RUNNING = 0,		// did not stop, more steps can be taken
+	TM_HALTED,			// entered an undefined state
+	TM_BUDGET,			// used up the given number of steps
+	TM_TAPE_LIMIT,		// one of the tapes can not move any further
+	TM_NONHALT,			// proven to never halt
+	TM_SUSPECT,			// a decider suspects that it never halts, but has no proof
+};
+
+/*
+ * The result of running a machine for a number of steps.
+ */
+struct tm_result_t {
+	step_t steps;			// the number of steps actually taken
+	enum tm_stop_t stop;	// why we stopped, never TM_RUNNING
+};
+
+/*
+ * Why a decider thinks a machine never halts.
+ */
+enum tm_verdict_t {
+	TM_UNDECIDED = 0,		// no proof yet
+	TM_CYCLER,				// returns to the exact same configuration
+	TM_TRANSLATED_CYCLER,	// repeats the same configuration shifted along the tape
+	TM_BOUNCER,				// sweeps back and forth over runs that grow linearly, not a proof
+};
+
+/*
+ * A decider, which watches a run and may prove or suspect that the machine never halts. It is
+ * called after every step of tm_run_steps() to look at the new configuration, and returns
+ * TM_NONHALT when it has a proof, TM_SUSPECT when it has strong evidence but no proof, and
+ * TM_RUNNING otherwise. In the first two cases it describes why in verdict and period.
+ * Deciders can be chained with next, and are then called in order.
+ */
+struct tm_decider_t {
+	void *data;
+	void (*free)(struct tm_decider_t *decider);
+	enum tm_stop_t (*step)(struct tm_decider_t *decider, const struct tm_run_t *run);
+	void (*reset)(struct tm_decider_t *decider);	// forget everything, for a new run
+	struct tm_decider_t *next;	// the next decider to call (may be NULL)
+	enum tm_verdict_t verdict;	// TM_UNDECIDED until decided
+	step_t period;				// the number of steps of each repetition
+};
+
+struct tm_run_t *tm_run_init(const struct tm_def_t *def, int n_tapes, struct tape_t *const *tapes);
 void tm_run_free(struct tm_run_t *run);
+void tm_run_reset(struct tm_run_t *run, const struct tm_def_t *def);
 int tm_run_halted(const struct tm_run_t *run);
-int tm_run_step(struct tm_run_t *run);
-int tm_run_steps(struct tm_run_t *run, int max_steps);
+enum tm_stop_t tm_run_step(struct tm_run_t *run);
+struct tm_result_t tm_run_steps(struct tm_run_t *run, step_t max_steps);
+void tm_run_print_stats(const struct tm_run_t *run);
+
+// Specialized single-tape run loops, which skip the per-step tape_t dispatch
+struct tm_result_t tm_run_fast_flat(struct tm_run_t *run, step_t max_steps);
+struct tm_result_t tm_run_fast_rle(struct tm_run_t *run, step_t max_steps);
+struct tm_result_t tm_run_skip_rle(struct tm_run_t *run, step_t max_steps);
+struct tm_result_t tm_run_fast_bit(struct tm_run_t *run, step_t max_steps);
+struct tm_result_t tm_run_fast_gap(struct tm_run_t *run, step_t max_steps);
+struct tm_result_t tm_run_fast_hybrid(struct tm_run_t *run, step_t max_steps);
+struct tm_result_t tm_run_fast_thread(struct tm_run_t *run, step_t max_steps);
 
 #endif
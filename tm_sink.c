@@ -0,0 +1,282 @@
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tm_run.h"
+#include "util.h"
+
+#include "tm_sink.h"
+
+/*
+ * This file writes the results of many machines to a binary file, one fixed-size record per
+ * machine, so that a file of millions of results can be scanned quickly afterwards. All numbers
+ * are little-endian, and the layout is:
+ *
+ *   "TMRS" SINK_VERSION TM_SINK_RECORD_SIZE 0 0
+ *   records of: machine (4 bytes), stop, verdict, engine, 0 (1 byte each),
+ *               steps, sigma, span, wall_ns (8 bytes each)
+ *
+ * The records are in no particular order, as each worker fills a buffer of its own. Full
+ * buffers are handed to a writer thread, which writes them to the file while the worker goes on
+ * with an empty buffer. Buffers are reused once written, and only when the writer falls behind
+ * do we allocate another one, so the workers never wait for the file.
+ */
+
+#define SINK_VERSION 1
+
+// Number of records per buffer, so that each write is a few hundred kilobytes
+#define SINK_BUF_RECS 8192
+
+/*
+ * A buffer of encoded records, which is either filled by a worker, queued for the writer or
+ * on the free list.
+ */
+struct sink_buf_t {
+	struct sink_buf_t *next;	// the next buffer in the queue or free list
+	int n_recs;
+	unsigned char mem[SINK_BUF_RECS * TM_SINK_RECORD_SIZE];
+};
+
+struct tm_sink_t {
+	FILE *file;
+	int n_workers;
+	struct sink_buf_t **bufs;	// the buffer that each worker fills, only used by that worker
+	pthread_t writer;
+	int failed;					// set by the writer if a write failed, read after joining it
+
+	pthread_mutex_t lock;		// guards the fields below
+	pthread_cond_t cond;		// signals the writer that there are full buffers or we close
+	struct sink_buf_t *full_head;
+	struct sink_buf_t *full_tail;
+	struct sink_buf_t *free_bufs;
+	int closing;
+};
+
+static void sink_put_le(unsigned char *const mem, unsigned long long val, const int n_bytes)
+{
+	for (int i = 0; i < n_bytes; i++) {
+		mem[i] = (unsigned char) (val & 0xFF);
+		val >>= 8;
+	}
+}
+
+static unsigned long long sink_get_le(const unsigned char *const mem, const int n_bytes)
+{
+	unsigned long long val = 0;
+	for (int i = n_bytes - 1; i >= 0; i--)
+		val = val << 8 | mem[i];
+	return val;
+}
+
+static void sink_encode(const struct tm_sink_rec_t *const rec, unsigned char *const mem)
+{
+	assert(rec->machine >= 0);
+	sink_put_le(mem, (unsigned long long) rec->machine, 4);
+	mem[4] = rec->stop;
+	mem[5] = rec->verdict;
+	mem[6] = rec->engine;
+	mem[7] = 0;
+	sink_put_le(mem + 8, (unsigned long long) rec->steps, 8);
+	sink_put_le(mem + 16, (unsigned long long) rec->sigma, 8);
+	sink_put_le(mem + 24, (unsigned long long) rec->span, 8);
+	sink_put_le(mem + 32, (unsigned long long) rec->wall_ns, 8);
+}
+
+static void sink_decode(const unsigned char *const mem, struct tm_sink_rec_t *const rec)
+{
+	rec->machine = (int) sink_get_le(mem, 4);
+	rec->stop = mem[4];
+	rec->verdict = mem[5];
+	rec->engine = mem[6];
+	rec->steps = (step_t) sink_get_le(mem + 8, 8);
+	rec->sigma = (step_t) sink_get_le(mem + 16, 8);
+	rec->span = (step_t) sink_get_le(mem + 24, 8);
+	rec->wall_ns = (step_t) sink_get_le(mem + 32, 8);
+}
+
+static struct sink_buf_t *sink_buf_init(void)
+{
+	struct sink_buf_t *const buf = malloc(sizeof *buf);
+	buf->next = NULL;
+	buf->n_recs = 0;
+	return buf;
+}
+
+/*
+ * Queues a buffer for the writer. Must hold the lock.
+ */
+static void sink_enqueue(struct tm_sink_t *const sink, struct sink_buf_t *const buf)
+{
+	buf->next = NULL;
+	if (sink->full_tail)
+		sink->full_tail->next = buf;
+	else
+		sink->full_head = buf;
+	sink->full_tail = buf;
+	pthread_cond_signal(&sink->cond);
+}
+
+static void *sink_writer(void *const arg)
+{
+	struct tm_sink_t *const sink = arg;
+	pthread_mutex_lock(&sink->lock);
+	for (;;) {
+		while (!sink->full_head && !sink->closing)
+			pthread_cond_wait(&sink->cond, &sink->lock);
+		struct sink_buf_t *const buf = sink->full_head;
+		if (!buf)
+			break;
+		sink->full_head = buf->next;
+		if (!sink->full_head)
+			sink->full_tail = NULL;
+		pthread_mutex_unlock(&sink->lock);
+
+		// After a failed write the file is broken anyway, so we only keep taking buffers
+		if (!sink->failed && fwrite(buf->mem, TM_SINK_RECORD_SIZE, (size_t) buf->n_recs, sink->file) != (size_t) buf->n_recs)
+			sink->failed = 1;
+		buf->n_recs = 0;
+
+		pthread_mutex_lock(&sink->lock);
+		buf->next = sink->free_bufs;
+		sink->free_bufs = buf;
+	}
+	pthread_mutex_unlock(&sink->lock);
+	return NULL;
+}
+
+/*
+ * Creates (or truncates) a results file at path, and starts its writer thread. Each of the
+ * n_workers workers, e.g. of tm_batch_for(), may then add records with tm_sink_put(). Errors
+ * if the file can not be created.
+ */
+struct tm_sink_t *tm_sink_open(const char *const path, const int n_workers)
+{
+	assert(n_workers >= 1);
+	FILE *const file = fopen(path, "wb");
+	if (!file) {
+		ERROR("Could not create results file %s.\n", path);
+	}
+	unsigned char header[TM_SINK_HEADER_SIZE] = {'T', 'M', 'R', 'S', SINK_VERSION, TM_SINK_RECORD_SIZE, 0, 0};
+	if (fwrite(header, 1, sizeof header, file) != sizeof header) {
+		ERROR("Could not write results file %s.\n", path);
+	}
+
+	struct tm_sink_t *const sink = malloc(sizeof *sink);
+	sink->file = file;
+	sink->n_workers = n_workers;
+	sink->bufs = malloc((size_t) n_workers * sizeof *sink->bufs);
+	for (int i = 0; i < n_workers; i++)
+		sink->bufs[i] = sink_buf_init();
+	sink->failed = 0;
+	pthread_mutex_init(&sink->lock, NULL);
+	pthread_cond_init(&sink->cond, NULL);
+	sink->full_head = NULL;
+	sink->full_tail = NULL;
+	sink->free_bufs = NULL;
+	sink->closing = 0;
+	if (pthread_create(&sink->writer, NULL, sink_writer, sink) != 0) {
+		ERROR("Could not create the writer thread of %s.\n", path);
+	}
+	return sink;
+}
+
+/*
+ * Adds a record from the given worker. Only one thread may use each worker at a time, but
+ * different workers need no synchronization, except for a short lock every SINK_BUF_RECS
+ * records to hand over the full buffer.
+ */
+void tm_sink_put(struct tm_sink_t *const sink, const int worker, const struct tm_sink_rec_t *const rec)
+{
+	assert(0 <= worker && worker < sink->n_workers);
+	struct sink_buf_t *const buf = sink->bufs[worker];
+	sink_encode(rec, buf->mem + (size_t) buf->n_recs * TM_SINK_RECORD_SIZE);
+	if (++buf->n_recs < SINK_BUF_RECS)
+		return;
+
+	pthread_mutex_lock(&sink->lock);
+	sink_enqueue(sink, buf);
+	struct sink_buf_t *next = sink->free_bufs;
+	if (next)
+		sink->free_bufs = next->next;
+	pthread_mutex_unlock(&sink->lock);
+	sink->bufs[worker] = next ? next : sink_buf_init();
+}
+
+/*
+ * Writes the remaining records, waits for the writer thread and closes the file. All workers
+ * must be done adding records. Returns 0 on success, or -1 if some records could not be written.
+ */
+int tm_sink_close(struct tm_sink_t *const sink)
+{
+	pthread_mutex_lock(&sink->lock);
+	for (int i = 0; i < sink->n_workers; i++) {
+		struct sink_buf_t *const buf = sink->bufs[i];
+		if (buf->n_recs > 0) {
+			sink_enqueue(sink, buf);
+		} else {
+			buf->next = sink->free_bufs;
+			sink->free_bufs = buf;
+		}
+	}
+	sink->closing = 1;
+	pthread_cond_signal(&sink->cond);
+	pthread_mutex_unlock(&sink->lock);
+	pthread_join(sink->writer, NULL);
+
+	int res = sink->failed ? -1 : 0;
+	if (fclose(sink->file) != 0)
+		res = -1;
+	while (sink->free_bufs) {
+		struct sink_buf_t *const next = sink->free_bufs->next;
+		free(sink->free_bufs);
+		sink->free_bufs = next;
+	}
+	pthread_cond_destroy(&sink->cond);
+	pthread_mutex_destroy(&sink->lock);
+	free(sink->bufs);
+	free(sink);
+	return res;
+}
+
+/*
+ * Reads the results file at path, calling fn(ctx, rec) for each record in the order of the
+ * file. Returns the number of records, or -1 if the file can not be read, is not a results
+ * file, or ends within a record.
+ */
+long long tm_sink_scan(const char *const path, const tm_sink_fn_t fn, void *const ctx)
+{
+	FILE *const file = fopen(path, "rb");
+	if (!file)
+		return -1;
+	unsigned char header[TM_SINK_HEADER_SIZE];
+	if (fread(header, 1, sizeof header, file) != sizeof header || memcmp(header, "TMRS", 4) != 0
+			|| header[4] != SINK_VERSION || header[5] != TM_SINK_RECORD_SIZE) {
+		(void) fclose(file);
+		return -1;
+	}
+
+	unsigned char *const mem = malloc(SINK_BUF_RECS * TM_SINK_RECORD_SIZE);
+	long long n_recs = 0;
+	size_t len;
+	while ((len = fread(mem, 1, SINK_BUF_RECS * TM_SINK_RECORD_SIZE, file)) > 0) {
+		if (len % TM_SINK_RECORD_SIZE != 0) {
+			n_recs = -1;
+			break;
+		}
+		for (size_t i = 0; i < len; i += TM_SINK_RECORD_SIZE) {
+			struct tm_sink_rec_t rec;
+			sink_decode(mem + i, &rec);
+			fn(ctx, &rec);
+			n_recs++;
+		}
+	}
+	if (ferror(file))
+		n_recs = -1;
+	free(mem);
+	(void) fclose(file);
+	return n_recs;
+}
@@ -0,0 +1,51 @@
+// Append-only binary files of per-machine results, written in the background
+#ifndef TM_SINK_H
+#define TM_SINK_H
+
+#include "tm_run.h"
+#include "util.h"
+
+/*
+ * The engine that produced a result.
+ */
+enum tm_engine_t {
+	TM_ENGINE_DISPATCHED = 0,	// tm_run_steps()
+	TM_ENGINE_SPECIALIZED,		// one of the tm_run_fast_X() loops
+	TM_ENGINE_SKIPPING,			// tm_run_skip_rle()
+	TM_ENGINE_THREADED,			// tm_run_fast_thread()
+	TM_ENGINE_MACRO,			// mm_run_steps()
+	TM_ENGINE_LANES,			// tm_lanes_run()
+	TM_ENGINE_COMPILED,			// tm_jit.c
+};
+
+/*
+ * The result of running one machine, which is stored as a fixed-size record.
+ */
+struct tm_sink_rec_t {
+	int machine;			// the index of the machine, e.g. in its tm_db_t
+	unsigned char stop;		// enum tm_stop_t, or TM_RUNNING if the machine could not be run
+	unsigned char verdict;	// enum tm_verdict_t of the deciders, TM_UNDECIDED without any
+	unsigned char engine;	// enum tm_engine_t
+	step_t steps;			// the number of steps taken
+	step_t sigma;			// the number of nonzero symbols on the tape at the end
+	step_t span;			// the number of cells visited
+	step_t wall_ns;			// the wall time of the run in nanoseconds
+};
+
+// Sizes of the results file format, see tm_sink.c
+#define TM_SINK_HEADER_SIZE 8
+#define TM_SINK_RECORD_SIZE 40
+
+struct tm_sink_t;
+
+/*
+ * Called once for each record by tm_sink_scan().
+ */
+typedef void (*tm_sink_fn_t)(void *ctx, const struct tm_sink_rec_t *rec);
+
+struct tm_sink_t *tm_sink_open(const char *path, int n_workers);
+void tm_sink_put(struct tm_sink_t *sink, int worker, const struct tm_sink_rec_t *rec);
+int tm_sink_close(struct tm_sink_t *sink);
+long long tm_sink_scan(const char *path, tm_sink_fn_t fn, void *ctx);
+
+#endif
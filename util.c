@@ -1,3 +1,6 @@
+// Needed for clock_gettime() with -std=c99
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
@@ -15,6 +18,25 @@ double seconds(const clock_t t1, const clock_t t0)
 	return ((double) (t1 - t0)) / CLOCKS_PER_SEC;
 }
 
+/*
+ * The wall clock time in nanoseconds from some fixed point, unlike clock(), which sums the
+ * CPU time of all threads.
+ */
+step_t wall_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (step_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * The wall clock time in seconds, see wall_ns().
+ */
+double wall_seconds(void)
+{
+	return (double) wall_ns() * 1e-9;
+}
+
 
 /*
  * The maximum of two integers, used for clamping values etc.
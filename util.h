@@ -10,6 +10,14 @@
 #define ERROR(...) ((void) fprintf(stderr, "ERROR: " __VA_ARGS__), exit(1))
 #define WARN(...) ((void) fprintf(stderr, "WARNING: " __VA_ARGS__))
 
+// Counts an event for the statistics of tapes and runs when built with -DTM_STATS, and
+// compiles to nothing otherwise
+#ifdef TM_STATS
+#define STAT(expr) ((void) (expr))
+#else
+#define STAT(expr) ((void) 0)
+#endif
+
 /*
  * Move direction representation, is actually only a single bit.
  */
@@ -24,7 +32,12 @@ typedef unsigned char state_t;
 // Sentinel value for representing undefined states.
 #define STATE_UNDEF ('Z' - 'A')
 
+// Step counter type. An int only covers about 2 * 10^9 steps, which BB(5)-class runs exceed.
+typedef long long step_t;
+
 double seconds(clock_t t1, clock_t t0);
+step_t wall_ns(void);
+double wall_seconds(void);
 int maximum(int a, int b);
 unsigned ceil_log2(unsigned n);
 unsigned long bitmask(unsigned from, unsigned to);
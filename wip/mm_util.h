@@ -1,4 +0,0 @@
-#ifndef TM_MM_UTIL
-#define TM_MM_UTIL
-
-#endif